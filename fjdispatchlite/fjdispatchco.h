@@ -0,0 +1,389 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjdispatchco.h
+ * @author FJD
+ * @brief FJDispatchLiteのC++20コルーチン対応(任意)
+ * @note C++20でビルドするときだけインクルードすること。本体(fjdispatchlite.h)はC++14のまま変わらない。
+ * @date 2026.10.16
+ */
+#ifndef __FJDISPATCHCO_H__
+#define __FJDISPATCHCO_H__
+
+#if __cplusplus < 202002L
+#error "fjdispatchco.h requires C++20"
+#endif
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#endif
+
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+/**
+ * @brief ディスパッチャ上で動くコルーチンの戻り値型
+ * @note 呼び出したワーカーで最初の中断まで実行し、完了すると自身を破棄する(結果は返さない)。
+ *       FJUnitFramesの派生クラスのメンバ関数なら、そのインスタンスのシーケンシャル実行として再開する。
+ *       中断中はインスタンスの他のメッセージが処理されるので、メンバ変数は再開後に読み直すこと。
+ *       中断中にインスタンスが登録解除(破棄)されたら、再開せずにその場でコルーチンを破棄する。
+ *       それ以外のコルーチンはパラレル実行として再開する。
+ * @note 引数はポインタのままフレームにコピーされる。メッセージハンドラのbuf等、投入元のタスクが持つ領域は
+ *       最初の中断でタスクが完了すると解放されるので、中断後も使うなら中断前にフレームへコピーすること。
+ */
+class FJCoTask {
+public:
+    struct promise_type {
+	FJUnitFrames* owner = nullptr; //!< 再開先のインスタンス(nullptrならパラレル実行)
+
+	promise_type() = default;
+
+	/**
+	 * @brief FJUnitFramesのメンバ関数(または第1引数がFJUnitFrames)のコルーチン
+	 * @note 処理系によってはSelfが参照型に推論されるので、参照を外して判定する。
+	 */
+	template <typename Self, typename... Args>
+	    requires std::is_base_of_v<FJUnitFrames, std::remove_cvref_t<Self>>
+	promise_type(Self& self, Args&...) : owner(&self) {}
+
+	FJCoTask get_return_object() noexcept { return FJCoTask(); }
+	std::suspend_never initial_suspend() noexcept { return {}; }
+	std::suspend_never final_suspend() noexcept { return {}; }
+	void return_void() noexcept {}
+	void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * @brief コルーチンの再開
+ */
+class FJCo {
+public:
+    /**
+     * @brief 別インスタンスへメッセージを送り、その返り値を待つ
+     * @note bufは送信時にコピーする。実行開始期限切れ等で実行されなかったときは空を返す。
+     * @return 待ち受け(co_awaitの結果はstd::optional<int>)
+     */
+    template <typename T>
+    static auto send(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, const void* buf, uint32_t len, const FJPostAttr& attr = FJPostAttr()) {
+	std::vector<char> data(static_cast<const char*>(buf), static_cast<const char*>(buf) + len);
+	return FJDispatchLite::GetQueueFor(obj)->post(obj, [obj, mf, msg, data = std::move(data)]() mutable {
+	    return (obj->*mf)(msg, data.data(), static_cast<uint32_t>(data.size()));
+	}, true, attr);
+    }
+
+    /**
+     * @brief 別インスタンスへイベントを送り、その返り値を待つ
+     * @return 待ち受け(co_awaitの結果はstd::optional<int>)
+     */
+    template <typename T>
+    static auto event(T* obj, int (T::*mf)(uint32_t), uint32_t msg, const FJPostAttr& attr = FJPostAttr()) {
+	return FJDispatchLite::GetQueueFor(obj)->post(obj, [obj, mf, msg]() {
+	    return (obj->*mf)(msg);
+	}, true, attr);
+    }
+
+    /**
+     * @brief 結果ハンドルを待つ
+     * @note 結果の登録時にFJDispatchLite::whenResult()の継続から再開する。
+     * @param[in] queue ハンドルを発行したキュー
+     * @param[in] handle 待受ハンドル
+     * @return 待ち受け(co_awaitの結果はstd::optional<int>、ハンドルが見つからなければ空)
+     */
+    static auto result(FJDispatchLite* queue, fjt_handle_t handle);
+
+    /**
+     * @brief 指定時間中断する
+     * @param[in] msec 中断する時間(msec)
+     * @return 待ち受け
+     */
+    static auto sleep(uint32_t msec);
+
+    /**
+     * @brief 中断したコルーチンの再開の予約
+     * @note 再開先のインスタンスに登録しておき、登録解除されたらその場でコルーチンを破棄する。
+     *       完了を知らせる側はclaim()が成功したときだけ待ち受け(フレーム内)に触れ、resume()で再開させること。
+     *       コピーは同じ予約を指す(claim()とresume()はどれか1つから一度だけ呼ぶ)。
+     */
+    class Pending {
+    public:
+	/**
+	 * @brief 予約する(中断する直前、再開先のインスタンスの実行中に呼ぶ)
+	 * @param[in] owner 再開先のインスタンス(nullptrならパラレル実行で再開し、取り消さない)
+	 * @param[in] h 再開するコルーチン
+	 */
+	Pending(FJUnitFrames* owner, std::coroutine_handle<> h) : h_(h) {
+	    if (owner != nullptr) s_ = FJDispatchLite::GetQueueFor(owner)->_suspend(owner, &_run, &_discard, h.address());
+	}
+
+	/**
+	 * @brief 再開する権利を取る
+	 * @retval [true] 取った
+	 * @retval [false] 登録解除で破棄済み(以降フレームに触れないこと)
+	 */
+	bool claim() {
+	    return s_ == nullptr || FJDispatchLite::_claim_suspension(s_);
+	}
+
+	/**
+	 * @brief claim()が成功した後に再開先へ積む
+	 */
+	void resume() {
+	    if (s_ == nullptr) {
+		_resume(0, h_);
+	    } else {
+		FJDispatchLite::_resume_suspension(s_, 0, true);
+	    }
+	}
+
+	/**
+	 * @brief 指定時間後に再開させる
+	 * @note 再開先のインスタンスへの登録は再開するまで残す(claim()は不要)。
+	 * @param[in] delay_msec 再開までの遅延(msec)
+	 */
+	void resumeAfter(uint32_t delay_msec) {
+	    if (s_ == nullptr) {
+		_resume(delay_msec, h_);
+	    } else {
+		FJDispatchLite::_resume_suspension(s_, delay_msec, false);
+	    }
+	}
+
+    private:
+	static void _run(void* ctx) {
+	    std::coroutine_handle<>::from_address(ctx).resume();
+	}
+
+	static void _discard(void* ctx) {
+	    std::coroutine_handle<>::from_address(ctx).destroy();
+	}
+
+	std::coroutine_handle<> h_; //!< 再開するコルーチン
+	FJDispatchLite::Suspension* s_ = nullptr; //!< 再開先のインスタンスに登録した再開待ち(パラレル実行ならnullptr)
+    };
+
+    /**
+     * @brief 中断したコルーチンの再開先インスタンス
+     */
+    template <typename P>
+    static FJUnitFrames* _owner(std::coroutine_handle<P> h) {
+	if constexpr (std::is_same_v<P, FJCoTask::promise_type>) {
+	    return h.promise().owner;
+	} else {
+	    return nullptr;
+	}
+    }
+
+private:
+    /**
+     * @brief インスタンスに属さない中断したコルーチンを再開させる
+     * @note 再開が取り消されたときは、コルーチンを破棄する。
+     * @param[in] delay_msec 再開までの遅延(msec)
+     * @param[in] h 再開するコルーチン
+     */
+    static void _resume(uint32_t delay_msec, std::coroutine_handle<> h) {
+	FJUnitFrames* target = _detached();
+	FJDispatchLite* queue = FJDispatchLite::GetQueueFor(target);
+	if (delay_msec == 0) {
+	    queue->post(target, Resumer(h), false);
+	} else {
+	    queue->postAfter(delay_msec, target, Resumer(h), false);
+	}
+    }
+
+    /**
+     * @brief コルーチンを再開するタスク
+     * @note 実行されずに破棄されたら(取り消し、受け付けなかった等)、中断したままのコルーチンを破棄する。
+     */
+    class Resumer {
+    public:
+	explicit Resumer(std::coroutine_handle<> h) : h_(h) {}
+	Resumer(Resumer&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+	Resumer(const Resumer&) = delete;
+	Resumer& operator=(const Resumer&) = delete;
+
+	~Resumer() {
+	    if (h_) h_.destroy();
+	}
+
+	void operator()() {
+	    std::exchange(h_, nullptr).resume();
+	}
+
+    private:
+	std::coroutine_handle<> h_; //!< 再開するコルーチン(再開または破棄したらnullptr)
+    };
+
+    /**
+     * @brief インスタンスに属さないコルーチンの再開に使うインスタンス
+     */
+    static FJUnitFrames* _detached() {
+	static FJUnitFrames unit;
+	return &unit;
+    }
+};
+
+/**
+ * @brief FJFutureの待ち受け
+ */
+template <typename R>
+class FJCoFutureAwaiter {
+public:
+    explicit FJCoFutureAwaiter(FJFuture<R>&& future) : future_(std::move(future)) {}
+
+    bool await_ready() const noexcept {
+	// 無効なFJFutureは待たずに値なしで再開する
+	return !future_.valid();
+    }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+	FJCo::Pending pending(FJCo::_owner(h), h);
+	// 完了時に値を受け取り、コルーチンを再開先に積む(以降thisに触れない)
+	future_.whenReady([this, pending](FJFuture<R>&& done) mutable {
+	    // 再開先が登録解除されていればフレームごと破棄済み
+	    if (!pending.claim()) return;
+	    done.take(0, [this](R&& value) { value_.emplace(std::move(value)); });
+	    pending.resume();
+	});
+    }
+
+    std::optional<R> await_resume() {
+	return std::move(value_);
+    }
+
+private:
+    FJFuture<R> future_; //!< 待つ結果
+    std::optional<R> value_; //!< 受け取った値
+};
+
+/**
+ * @brief FJFuture<void>の待ち受け
+ */
+template <>
+class FJCoFutureAwaiter<void> {
+public:
+    explicit FJCoFutureAwaiter(FJFuture<void>&& future) : future_(std::move(future)) {}
+
+    bool await_ready() const noexcept {
+	return !future_.valid();
+    }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+	FJCo::Pending pending(FJCo::_owner(h), h);
+	future_.whenReady([this, pending](FJFuture<void>&& done) mutable {
+	    if (!pending.claim()) return;
+	    ok_ = done.get(0);
+	    pending.resume();
+	});
+    }
+
+    /**
+     * @return [true]:実行された, [false]:実行されずに破棄された
+     */
+    bool await_resume() {
+	return ok_;
+    }
+
+private:
+    FJFuture<void> future_; //!< 待つ結果
+    bool ok_ = false; //!< 実行されたか
+};
+
+/**
+ * @brief FJFutureをco_awaitできるようにする
+ */
+template <typename R>
+FJCoFutureAwaiter<R> operator co_await(FJFuture<R>&& future) {
+    return FJCoFutureAwaiter<R>(std::move(future));
+}
+
+/**
+ * @brief 結果ハンドルの待ち受け
+ */
+class FJCoResultAwaiter {
+public:
+    FJCoResultAwaiter(FJDispatchLite* queue, fjt_handle_t handle) : queue_(queue), handle_(handle) {}
+
+    bool await_ready() {
+	state_ = queue_->peekResult(handle_, value_);
+	return state_ != FJDispatchLite::RESULT_PENDING;
+    }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+	FJCo::Pending pending(FJCo::_owner(h), h);
+	// 結果の登録時に値を受け取り、コルーチンを再開先に積む(以降thisに触れない)
+	queue_->whenResult(handle_, [this, pending](int state, int value) mutable {
+	    // 再開先が登録解除されていればフレームごと破棄済み
+	    if (!pending.claim()) return;
+	    state_ = state;
+	    value_ = value;
+	    pending.resume();
+	});
+    }
+
+    std::optional<int> await_resume() {
+	if (state_ != FJDispatchLite::RESULT_READY) return std::nullopt;
+	return value_;
+    }
+
+private:
+    FJDispatchLite* queue_; //!< ハンドルを発行したキュー
+    fjt_handle_t handle_; //!< 待受ハンドル
+    int state_ = FJDispatchLite::RESULT_PENDING; //!< 最後に確認した状態
+    int value_ = 0; //!< 結果
+};
+
+/**
+ * @brief 時間経過の待ち受け
+ */
+class FJCoSleepAwaiter {
+public:
+    explicit FJCoSleepAwaiter(uint32_t msec) : msec_(msec) {}
+
+    bool await_ready() const noexcept {
+	return msec_ == 0;
+    }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+	// 再開するまでインスタンスに登録しておき、登録解除されたらその場で破棄する
+	FJCo::Pending(FJCo::_owner(h), h).resumeAfter(msec_);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    uint32_t msec_; //!< 中断する時間(msec)
+};
+
+inline auto FJCo::result(FJDispatchLite* queue, fjt_handle_t handle) {
+    return FJCoResultAwaiter(queue, handle);
+}
+
+inline auto FJCo::sleep(uint32_t msec) {
+    return FJCoSleepAwaiter(msec);
+}
+
+#endif //__FJDISPATCHCO_H__
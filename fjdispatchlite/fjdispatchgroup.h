@@ -0,0 +1,170 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjdispatchgroup.h
+ * @author FJD
+ * @brief 複数タスクの完了をまとめて待つグループ
+ * @date 2026.10.16
+ */
+#ifndef __FJDISPATCHGROUP_H__
+#define __FJDISPATCHGROUP_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#endif
+
+#include "fjtypes.h"
+#include "fjfutex.h"
+
+/**
+ * @brief ディスパッチグループ
+ * @note FJPostAttr::withGroup()で投入したタスクは投入時にenter()、完了(または破棄)時にleave()される。
+ *       グループは所属するタスクが全て完了するまで破棄しないこと。
+ */
+class FJDispatchGroup {
+public:
+    /**
+     * @brief コンストラクタ
+     */
+    FJDispatchGroup() : count_(0), seq_(0), waiters_(0) {
+	pthread_mutex_init(&mutex_, NULL);
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FJDispatchGroup() {
+	// 最後のleave()が抜けるのを待つ
+	pthread_mutex_lock(&mutex_);
+	pthread_mutex_unlock(&mutex_);
+	pthread_mutex_destroy(&mutex_);
+    }
+
+    /**
+     * @brief 未完了のタスクを1つ増やす
+     */
+    void enter() {
+	count_.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief 未完了のタスクを1つ減らす
+     * @note 0になったらwait()中のスレッドを起こし、notify()で登録した処理をこのスレッドで実行する。
+     *       0にする減算はmutex_の中で行うので、wait()から戻った後にグループへ触れることはない。
+     */
+    void leave() {
+	int64_t count = count_.load(std::memory_order_relaxed);
+	while (count > 1) {
+	    if (count_.compare_exchange_weak(count, count - 1, std::memory_order_seq_cst)) return;
+	}
+	std::vector<std::function<void()>> fns;
+	pthread_mutex_lock(&mutex_);
+	if (count_.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+	    seq_.fetch_add(1, std::memory_order_seq_cst);
+	    if (waiters_.load(std::memory_order_seq_cst) > 0) FJFutex::wake(&seq_);
+	    fns.swap(notify_);
+	}
+	pthread_mutex_unlock(&mutex_);
+	for (auto& fn : fns) fn();
+    }
+
+    /**
+     * @brief 全タスクの完了を待つ
+     * @note ワーカースレッドから待つ間は塞がっているものとして扱う(FJBlockingHook参照)。
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @retval [true] 未完了のタスクがなくなった
+     * @retval [false] タイムアウト
+     */
+    bool wait(int64_t timeout_msec = -1) {
+	int64_t start = _get_time();
+	waiters_.fetch_add(1, std::memory_order_seq_cst);
+	bool done = false;
+	bool blocking = false;
+	while (true) {
+	    uint32_t seq = seq_.load(std::memory_order_seq_cst);
+	    if (count_.load(std::memory_order_seq_cst) <= 0) {
+		done = true;
+		break;
+	    }
+	    int64_t remain = -1;
+	    if (timeout_msec >= 0) {
+		remain = timeout_msec - (_get_time() - start);
+		if (remain <= 0) break;
+	    }
+	    if (!blocking) {
+		FJBlockingHook::begin();
+		blocking = true;
+	    }
+	    FJFutex::wait(&seq_, seq, remain);
+	}
+	if (blocking) FJBlockingHook::end();
+	waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	if (done) {
+	    // 0にしたleave()が抜けるのを待つ
+	    pthread_mutex_lock(&mutex_);
+	    pthread_mutex_unlock(&mutex_);
+	}
+	return done;
+    }
+
+    /**
+     * @brief 全タスクの完了時に実行する処理を登録する
+     * @note 既に未完了のタスクがなければ呼び出したスレッドで直ちに実行する。
+     *       処理は最後にleave()したワーカーで実行されるので、重い処理はpostQueue等で投げ直すこと。
+     * @param[in] fn 処理
+     */
+    void notify(std::function<void()> fn) {
+	pthread_mutex_lock(&mutex_);
+	if (count_.load(std::memory_order_seq_cst) > 0) {
+	    notify_.push_back(std::move(fn));
+	    pthread_mutex_unlock(&mutex_);
+	    return;
+	}
+	pthread_mutex_unlock(&mutex_);
+	fn();
+    }
+
+    /**
+     * @brief 未完了のタスク数
+     */
+    int64_t pending() const {
+	return count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJDispatchGroup(const FJDispatchGroup&) = delete;
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJDispatchGroup& operator=(const FJDispatchGroup&) = delete;
+
+private:
+    std::atomic<int64_t> count_; //!< 未完了のタスク数
+    std::atomic<uint32_t> seq_; //!< 未完了が0になるたびに進むfutexワード
+    std::atomic<uint32_t> waiters_; //!< wait()中のスレッド数
+    pthread_mutex_t mutex_; //!< notify_の排他
+    std::vector<std::function<void()>> notify_; //!< 完了時に実行する処理
+};
+
+#endif //__FJDISPATCHGROUP_H__
@@ -28,28 +28,75 @@
 #include <string>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <tuple>
 #include <functional>
 #include <vector>
 #include <cstring>
+#include <climits>
 #include <future>
+#include <atomic>
+#include <memory>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #endif
 
 #include "fjtypes.h"
 #include "fjunitframes.h"
+#include "fjworkdeque.h"
+#include "fjmpscqueue.h"
+#include "fjslabpool.h"
+#include "fjfutex.h"
+#include "fjdispatchgroup.h"
+#include "fjfuture.h"
+#include "fjhistogram.h"
 
-#define FJDISPATCHLITE_DEFAULT_THREADS (2) //!< ワーカースレッド数初期値
-#define FJDISPATCHLITE_MAX_THREADS (8) //!< ワーカースレッド数最大値
-#define FJDISPATCHLITE_MIN_THREADS (1) //!< ワーカースレッド数最小値
-#define FJDISPATCHLITE_MAX_RESULTS (100) //!< リザルトキューの最大値
-#define FJDISPATCHLITE_IDLE_TIMEOUT_MSEC (60000)  //!< スレッドをシュリンクするタイムアウト値
+#define FJDISPATCHLITE_DEFAULT_THREADS (2) //!< ワーカースレッド数初期値(Configで変更可)
+#define FJDISPATCHLITE_MAX_THREADS (8) //!< ワーカースレッド数最大値(Configで変更可)
+#define FJDISPATCHLITE_MIN_THREADS (1) //!< ワーカースレッド数最小値(Configで変更可)
+#define FJDISPATCHLITE_MAX_RESULTS (1024) //!< メインプールのリザルトスロット数(実行待ち・実行中の結果はこの数まで保持できる、Configで変更可)
+#define FJDISPATCHLITE_QUEUE_MAX_RESULTS (256) //!< CreateQueue()で作るキューのリザルトスロット数初期値
+#define FJDISPATCHLITE_IDLE_TIMEOUT_MSEC (60000)  //!< この時間タスクを実行しなかったワーカーは自ら終了する(Configで変更可)
 #define FJDISPATCHLITE_HUNG_TIMEOUT_MSEC (15000)   //!< タスクが固まった判定タイムアウト値
+#define FJDISPATCHLITE_WORKSTEAL (0) //!< [1]:ワークスティーリングを既定のスケジューラにする
+#define FJDISPATCHLITE_LOCAL_QUEUE_SIZE (1024) //!< ワーカーごとのローカル実行待ちキュー容量
+#define FJDISPATCHLITE_CACHE_LINE (64) //!< 書き込み側の異なるメンバを分ける間隔(キャッシュラインのバイト数)
+#define FJDISPATCHLITE_IDLE_SPIN_USEC (50) //!< ワーカーが眠る前に実行待ちを待つ最大時間(usec、Configで変更可、CPUが1つなら使わない)
+#define FJDISPATCHLITE_SCALE_UP_DELAY_USEC (1000) //!< 平均キュー遅延がこれを超えたらワーカーを増やす(usec、Configで変更可)
+#define FJDISPATCHLITE_SCALE_IVAL_MSEC (5) //!< キュー遅延と稼働率からワーカー数を見直す最短間隔
+#define FJDISPATCHLITE_SCALE_TARGET_UTIL (75) //!< ワーカーを増やすときに目標とする稼働率(%)
+#define FJDISPATCHLITE_MAX_SPARE_THREADS (8) //!< 塞がったワーカーの代わりにmax_threadsを超えて足せる数(Configで変更可)
+#define FJDISPATCHLITE_MAILBOX_BATCH (8) //!< 1回の実行機会でインスタンスのメールボックスから連続して処理するタスク数
+#define FJDISPATCHLITE_INLINE_PAYLOAD (128) //!< タスクノード内に保持するデータの最大バイト長
+#define FJDISPATCHLITE_TASK_FN_SIZE (48) //!< タスクノード内に保持する呼び出し対象の最大バイト長
+#define FJDISPATCHLITE_TASK_POOL_CHUNK (256) //!< タスクノードプールの1チャンクあたりのノード数
+#define FJDISPATCHLITE_PAYLOAD_CLASSES (4) //!< 大きいデータ用スラブのサイズクラス数(512, 2K, 8K, 32Kバイト)
+#define FJDISPATCHLITE_PAYLOAD_CLASS_MIN (512) //!< 最小サイズクラスのバイト長(クラスごとに4倍)
+#define FJDISPATCHLITE_PAYLOAD_CHUNK_BYTES (65536) //!< サイズクラスごとの1チャンクあたりのバイト数
+#define FJDISPATCHLITE_PRIO_LANES (3) //!< 優先度レーン数(EN_MSG_IDに対応)
+#define FJDISPATCHLITE_PRIO_WEIGHT_HIGH (8) //!< 重み付き方式でのC_MESSAGE_HIGHの連続処理数
+#define FJDISPATCHLITE_PRIO_WEIGHT_MID (4) //!< 重み付き方式でのC_MESSAGE_MIDの連続処理数
+#define FJDISPATCHLITE_PRIO_WEIGHT_LOW (1) //!< 重み付き方式でのC_MESSAGE_LOWの連続処理数
+#define FJDISPATCHLITE_BATCH_CHUNK (64) //!< 一括投入で1回のロックでまとめて実行待ちに積む最大数
+#define FJDISPATCHLITE_MAIN_QUEUE "main" //!< メインプールのキュー名
+#define FJDISPATCHLITE_RESULT_DROPPED (INT_MIN) //!< 実行開始期限切れ、またはキューあふれで古いものから破棄したタスクの結果値
+#define FJDISPATCHLITE_RESULT_CANCELLED (INT_MIN + 1) //!< 実行前に取り消したタスクの結果値
+#define FJDISPATCHLITE_RESULT_REJECTED (INT_MIN + 2) //!< キューの上限で受け付けなかったタスクの結果値
+#define FJDISPATCHLITE_BLOCK_TIMEOUT_MSEC (1000) //!< OVERFLOW_BLOCKで投入側が空きを待つ最大時間の初期値(msec、過ぎたら受け付けない)
+#define FJDISPATCHLITE_APPLY_CHUNK_USEC (100) //!< dispatchApplyで1回に取るチャンクの目標実行時間(usec)
+#define FJDISPATCHLITE_APPLY_SPLIT (4) //!< dispatchApplyで参加者1人あたりに残すチャンク数の下限(負荷の偏り対策)
 
 #define FJDISPATCHLITE_DBG (0) //!< デバッグフラグ
 #define FJDISPATCHLITE_PROFILE_DBG (0) //!< メソッド実行プロファイラ
+#ifndef FJDISPATCHLITE_LATENCY_STATS
+#define FJDISPATCHLITE_LATENCY_STATS (1) //!< [1]:呼び出し元・メッセージIDごとにキュー遅延と実行時間のヒストグラムを記録する(-Dで0にすると記録も表も持たない)
+#endif
 #define FJDISPATCHLITE_PROFILE_TOO_DELAY_MSEC (200) //!< postQueueしてから実行されるまでの遅延許容値(msec)
 #define FJDISPATCHLITE_PROFILE_TOO_EXEC_MSEC (200) //!< メソッド実行にかかる時間の許容値(msec)
 #define FJDISPATCHLITE_PROFILE_MONITOR_IVAL_MSEC (5000) 
@@ -57,6 +104,63 @@
 
 // 前方参照
 class FJTimerLite;
+class FJCo;
+
+/**
+ * @brief 投入ごとの属性
+ * @note 優先度だけを指定する場合はEN_MSG_IDから暗黙に変換できる。
+ */
+struct FJPostAttr {
+    /**
+     * @brief 実行開始期限を過ぎたときの扱い
+     */
+    enum MissPolicy {
+	MISS_RUN, //!< そのまま実行する(期限切れとして数える)
+	MISS_DROP, //!< 実行せずに破棄し、結果にFJDISPATCHLITE_RESULT_DROPPEDを登録する
+	MISS_DEMOTE, //!< 期限を外してC_MESSAGE_LOWの末尾に回す
+    };
+
+    int prio; //!< 優先度(EN_MSG_ID)
+    int64_t deadline_usec; //!< 実行開始期限(_get_time_usec()基準の絶対時刻、0なら期限なし)
+    MissPolicy on_miss; //!< 期限を過ぎたときの扱い
+    FJDispatchGroup* group; //!< 所属するディスパッチグループ(nullptrなら所属しない)
+    bool coalesce; //!< postEventで同じ(インスタンス, メソッド, メッセージID)が開始前なら積まずにそのハンドルを返す
+
+    FJPostAttr(int p = C_MESSAGE_MID, int64_t deadline = 0, MissPolicy miss = MISS_RUN)
+	: prio(p), deadline_usec(deadline), on_miss(miss), group(nullptr), coalesce(false) {}
+
+    /**
+     * @brief ディスパッチグループに所属させる
+     * @param[in] g グループ
+     * @return 自身
+     */
+    FJPostAttr& withGroup(FJDispatchGroup* g) {
+	group = g;
+	return *this;
+    }
+
+    /**
+     * @brief postEventをまとめる
+     * @note 「状態が変わったので読み直せ」という通知向け。開始前の同じイベントがあればそれに相乗りする。
+     *       ハンドラが開始した後の投入は新たに積むので、最後の投入より後に一度は実行される。
+     * @return 自身
+     */
+    FJPostAttr& withCoalesce() {
+	coalesce = true;
+	return *this;
+    }
+
+    /**
+     * @brief 今からmsec以内に実行を開始すべき属性を作る
+     * @param[in] msec 期限までの時間(msec)
+     * @param[in] miss 期限を過ぎたときの扱い
+     * @param[in] p 優先度
+     * @return 属性
+     */
+    static FJPostAttr Within(uint32_t msec, MissPolicy miss = MISS_DROP, int p = C_MESSAGE_MID) {
+	return FJPostAttr(p, _get_time_usec() + static_cast<int64_t>(msec) * 1000, miss);
+    }
+};
 
 /**
  * @brief 最小限のディスパッチャ
@@ -65,23 +169,312 @@ class FJTimerLite;
 class FJDispatchLite {
 public:
     friend class FJTimerLite;
+    friend class FJCo;
 
     /**
      * @brief 各ハンドルごとの実行結果
+     * @note wordの上位62bitがハンドル、下位2bitが状態。ハンドルの下位ビットがスロット番号、残りが世代になる。
      */
     struct ResultItem {
-	int value; //!< タスクの返り値
-        bool ready; //!< 実行結果を受け取ったか
+	std::atomic<uint64_t> word; //!< ハンドルと状態
+	std::atomic<int> value; //!< タスクの返り値
+	std::atomic<uint32_t> seq; //!< 結果登録のたびに進むfutexワード
+	std::atomic<uint32_t> waiters; //!< このスロットで待っているスレッド数
+    };
+
+    /**
+     * @brief whenResult()で設定された継続
+     */
+    struct ResultWatch {
+	fjt_handle_t handle; //!< 待受ハンドル
+	std::function<void(int, int)> fn; //!< 継続
+    };
+
+    enum {
+	RESULT_FREE = 0, //!< 未使用
+	RESULT_PENDING = 1, //!< 実行待ちまたは実行中(スロットを再利用しない)
+	RESULT_READY = 2, //!< 実行結果を受け取った(古いものから再利用される)
+	RESULT_RUNNING = 3, //!< 実行中(内部状態、参照時はRESULT_PENDINGとして返す)
+    };
+
+    /**
+     * @brief スケジューラ方式
+     */
+    enum SchedMode {
+	SCHEDMODE_FIFO, //!< 共有の実行待ちキューのみを使う
+	SCHEDMODE_WORKSTEAL, //!< ワーカーごとのローカルキューとスティールを使う
+    };
+
+    /**
+     * @brief キューのQoSクラス
+     * @note ワーカースレッドのnice値に対応付ける(負のnice値は権限がなければ反映されない)。
+     */
+    enum QoS {
+	QOS_USER_INTERACTIVE, //!< 操作への即時応答(nice -10)
+	QOS_USER_INITIATED, //!< 操作を起点とする処理(nice -5)
+	QOS_DEFAULT, //!< 既定(nice 0)
+	QOS_UTILITY, //!< 進捗を伴う長めの処理(nice 5)
+	QOS_BACKGROUND, //!< 見えない所での処理(nice 10)
+    };
+
+    /**
+     * @brief ワーカープールの設定
+     * @note Configure()で最初のGetInstance()より前に与える。
+     */
+    struct Config {
+	size_t min_threads = FJDISPATCHLITE_MIN_THREADS; //!< ワーカースレッド数最小値
+	size_t initial_threads = FJDISPATCHLITE_DEFAULT_THREADS; //!< 起動時のワーカースレッド数
+	size_t max_threads = FJDISPATCHLITE_MAX_THREADS; //!< ワーカースレッド数最大値(0ならオンラインのCPU数)
+	size_t max_spare_threads = FJDISPATCHLITE_MAX_SPARE_THREADS; //!< 塞がったワーカーの代わりにmax_threadsを超えて足せる数
+	uint64_t idle_timeout_msec = FJDISPATCHLITE_IDLE_TIMEOUT_MSEC; //!< この時間タスクを実行しなかったワーカーは自ら終了する(min_threadsまで)
+	uint32_t scale_up_delay_usec = FJDISPATCHLITE_SCALE_UP_DELAY_USEC; //!< 平均キュー遅延がこれを超え、眠っているワーカーがいなければ増やす(usec)
+	std::vector<cpu_set_t> affinity; //!< ワーカーごとのCPUアフィニティ(i番目のワーカーにaffinity[i % size]、空なら指定しない)
+	int sched_policy = SCHED_OTHER; //!< ワーカーのスケジューリングポリシー(SCHED_OTHER, SCHED_FIFO, SCHED_RR等)
+	int sched_priority = 0; //!< ワーカーのスケジューリング優先度(SCHED_FIFO, SCHED_RRのとき)
+	SchedMode sched_mode = FJDISPATCHLITE_WORKSTEAL ? SCHEDMODE_WORKSTEAL : SCHEDMODE_FIFO; //!< スケジューラ方式
+	int nice = 0; //!< ワーカーのnice値(SCHED_OTHERのとき)
+	uint32_t idle_spin_usec = FJDISPATCHLITE_IDLE_SPIN_USEC; //!< ワーカーが眠る前に実行待ちを待つ最大時間(usec、0なら待たずに眠る)
+	size_t max_results = FJDISPATCHLITE_MAX_RESULTS; //!< リザルトスロット数(2のべき乗に切り上げる、起動時に確保する)
+
+	/**
+	 * @brief CPU番号の並びからワーカーごとのアフィニティを作る
+	 * @note ワーカーi番目をcpus[i % size]の1コアに固定する。
+	 * @param[in] cpus CPU番号
+	 */
+	void pinEach(const std::vector<int>& cpus) {
+	    affinity.clear();
+	    for (int cpu : cpus) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		affinity.push_back(set);
+	    }
+	}
+
+	/**
+	 * @brief 全ワーカーを同じCPU集合に制限する
+	 * @param[in] cpus CPU番号
+	 */
+	void pinAll(const std::vector<int>& cpus) {
+	    cpu_set_t set;
+	    CPU_ZERO(&set);
+	    for (int cpu : cpus) CPU_SET(cpu, &set);
+	    affinity.assign(1, set);
+	}
+    };
+
+    /**
+     * @brief 優先度レーンの選択方式
+     */
+    enum PrioPolicy {
+	PRIO_STRICT, //!< 常に最も優先度の高い空でないレーンから取り出す
+	PRIO_WEIGHTED, //!< レーンごとの重みの回数ずつ巡回して取り出す(低優先度も飢餓しない)
+    };
+
+    /**
+     * @brief 優先度レーンごとのキュー遅延統計
+     */
+    struct LaneStats {
+	uint64_t count; //!< 実行したタスク数
+	uint64_t total_delay_usec; //!< 投入から実行開始までの遅延の合計(usec)
+	uint64_t max_delay_usec; //!< 投入から実行開始までの遅延の最大(usec)
+    };
+
+    /**
+     * @brief 呼び出し元ごとのレイテンシ統計
+     * @note 全ワーカーの記録を合算したもの。
+     */
+    struct LatencyStats {
+	const char* srcfunc; //!< 呼び出し関数名(post()等で指定のないものはnullptr)
+	uint32_t srcline; //!< 呼び出し行数
+	uint32_t msg; //!< メッセージID(記録表からあふれた分はUINT32_MAX)
+	FJHistogram queue_delay; //!< 投入から実行開始までの遅延(usec)
+	FJHistogram exec_time; //!< 実行時間(usec)
+    };
+
+    /**
+     * @brief 実行開始期限の統計
+     */
+    struct DeadlineStats {
+	uint64_t met; //!< 期限内に実行を開始した数
+	uint64_t missed; //!< 期限を過ぎていた数(dropped, demotedを含む)
+	uint64_t dropped; //!< 期限切れで破棄した数
+	uint64_t demoted; //!< 期限切れでC_MESSAGE_LOWに回した数
+    };
+
+    /**
+     * @brief インスタンス管理の統計
+     */
+    struct InstanceStats {
+	size_t registered; //!< 登録中のインスタンス数
+	size_t live; //!< 確保中のインスタンス情報の数(登録解除後に残りのタスクを待っているものを含む)
+	uint64_t detached; //!< 登録解除した累計
+	uint64_t cancelled; //!< 登録解除またはcancel()で取り消したタスクの累計
+    };
+
+    /**
+     * @brief キューの上限を超えたときの扱い
+     */
+    enum OverflowPolicy {
+	OVERFLOW_BLOCK, //!< 空くまで投入側を待たせる(ワーカースレッドからの投入は待たせずに受け付ける)
+	OVERFLOW_FAIL, //!< 受け付けず、結果にFJDISPATCHLITE_RESULT_REJECTEDを登録したハンドルを返す
+	OVERFLOW_DROP_OLDEST, //!< 受け付け、取り出す側で上限を超えている分を古いものから破棄する(結果はFJDISPATCHLITE_RESULT_DROPPED)
+    };
+
+    /**
+     * @brief キューの上限による流量制御の統計
+     */
+    struct BackpressureStats {
+	int64_t queued; //!< 上限の対象として数えている未完了のタスク数
+	uint64_t rejected; //!< 受け付けなかった累計(OVERFLOW_FAIL、OVERFLOW_BLOCKの待ち時間切れ)
+	uint64_t dropped; //!< 古いものから破棄した累計(OVERFLOW_DROP_OLDEST)
+	uint64_t blocked; //!< 投入側を待たせた累計(OVERFLOW_BLOCK)
+    };
+
+    /**
+     * @brief ワーカー数の増減の統計
+     */
+    struct ScalingStats {
+	size_t threads; //!< 現在のワーカー数
+	size_t peak_threads; //!< ワーカー数の最大
+	uint64_t grown; //!< 増やしたワーカーの累計
+	uint64_t retired; //!< 仕事がなく自ら終了したワーカーの累計
+	uint64_t queue_delay_usec; //!< 直近の見直し時の平均キュー遅延(usec)
+	uint32_t utilization; //!< 直近の見直し時のワーカー稼働率(%)
+	size_t blocking; //!< FJBlockingScope等で塞がっているワーカー数
+	size_t hung; //!< 申告なしに固まっているとモニターが判定したワーカー数
+	uint64_t compensated; //!< 塞がったワーカーの代わりにmax_threadsを超えて足した累計
+    };
+
+    /**
+     * @brief 登録解除時に未実行のタスクをどうするか
+     */
+    enum DetachMode {
+	DETACH_CANCEL, //!< 取り消す(結果にFJDISPATCHLITE_RESULT_CANCELLEDを登録する)
+	DETACH_DRAIN, //!< 全て実行し終えるまで待つ
+    };
+
+    /**
+     * @brief postQueueBatchの1要素
+     */
+    template <typename T>
+    struct QueueItem {
+	T* obj; //!< FJUnitFramesのポインタ
+	int (T::*mf)(uint32_t, void*, uint32_t); //!< FJUnitFramesのメソッド
+	uint32_t msg; //!< メッセージID
+	void* buf; //!< データ
+	uint32_t len; //!< データバイト長
+    };
+
+    /**
+     * @brief postEventBatchの1要素
+     */
+    template <typename T>
+    struct EventItem {
+	T* obj; //!< FJUnitFramesのポインタ
+	int (T::*mf)(uint32_t); //!< FJUnitFramesのメソッド
+	uint32_t msg; //!< メッセージID
     };
 
     /*
      * @brief シングルトン
      */
     static FJDispatchLite* GetInstance() {
-        static FJDispatchLite instance;
+        static FJDispatchLite instance(_take_config(), FJDISPATCHLITE_MAIN_QUEUE, QOS_DEFAULT);
         return &instance;
     }
 
+    /**
+     * @brief 名前付きキューを作る
+     * @note キューは独立したワーカープールを持ち、プロセス終了まで解放しない。
+     *       ハンドルは投入したキューごとに発行されるので、waitResultは同じキューに対して呼ぶこと。
+     * @param[in] name キュー名(ワーカースレッド名にも使う)
+     * @param[in] qos QoSクラス
+     * @param[in] serial [true]:キュー全体で同時に一つずつ実行, [false]:max_threadsまで並行に実行
+     * @param[in] max_threads 並行実行時のワーカー数上限
+     * @param[in] max_results リザルトスロット数(未完了のタスクはこの数までしか持てない)
+     * @return キュー、同名のキューが既にあるか名前がFJDISPATCHLITE_MAIN_QUEUEならnullptr
+     */
+    static FJDispatchLite* CreateQueue(const std::string& name, QoS qos, bool serial, size_t max_threads = FJDISPATCHLITE_DEFAULT_THREADS, size_t max_results = FJDISPATCHLITE_QUEUE_MAX_RESULTS) {
+	if (name == FJDISPATCHLITE_MAIN_QUEUE) return nullptr;
+	Config config;
+	config.min_threads = 1;
+	config.initial_threads = 1;
+	config.max_threads = serial ? 1 : max_threads;
+	// 直列キューは同時に2つ実行しないよう代わりのワーカーも足さない
+	if (serial) config.max_spare_threads = 0;
+	config.nice = _qos_nice(qos);
+	config.max_results = max_results;
+	pthread_mutex_lock(_queue_mutex());
+	auto& slot = _queue_registry()[name];
+	FJDispatchLite* queue = nullptr;
+	if (!slot) {
+	    slot.reset(new FJDispatchLite(config, name, qos));
+	    queue = slot.get();
+	}
+	pthread_mutex_unlock(_queue_mutex());
+	return queue;
+    }
+
+    /**
+     * @brief 名前付きキューを探す
+     * @param[in] name キュー名(FJDISPATCHLITE_MAIN_QUEUEならメインプール)
+     * @return キュー、なければnullptr
+     */
+    static FJDispatchLite* GetQueue(const std::string& name) {
+	if (name == FJDISPATCHLITE_MAIN_QUEUE) return GetInstance();
+	pthread_mutex_lock(_queue_mutex());
+	auto it = _queue_registry().find(name);
+	FJDispatchLite* queue = (it != _queue_registry().end()) ? it->second.get() : nullptr;
+	pthread_mutex_unlock(_queue_mutex());
+	return queue;
+    }
+
+    /**
+     * @brief インスタンスの投入先キュー
+     * @param[in] obj FJUnitFramesのポインタ
+     * @return setDispatchQueue()で設定したキュー、未設定ならメインプール
+     */
+    static FJDispatchLite* GetQueueFor(FJUnitFrames* obj) {
+	FJDispatchLite* queue = obj->dispatch_queue_.load(std::memory_order_acquire);
+	return queue != nullptr ? queue : GetInstance();
+    }
+
+    /**
+     * @brief キュー名の取得
+     */
+    const std::string& getName() const {
+	return name_;
+    }
+
+    /**
+     * @brief QoSクラスの取得
+     */
+    QoS getQoS() const {
+	return qos_;
+    }
+
+    /**
+     * @brief ワーカープールの設定
+     * @note 最初のGetInstance()より前に一度だけ呼ぶこと(他スレッドのGetInstance()と並行して呼ばないこと)。
+     * @param[in] config 設定
+     * @retval [true] 設定した
+     * @retval [false] 既にインスタンスが生成されているので反映できない
+     */
+    static bool Configure(const Config& config) {
+	if (_instance_created().load(std::memory_order_acquire)) return false;
+	_pending_config() = config;
+	return true;
+    }
+
+    /**
+     * @brief 有効な設定の取得
+     * @return 設定(min/max等は補正後の値)
+     */
+    const Config& getConfig() const {
+	return config_;
+    }
+
     /**
      * @brief デストラクタ
      */
@@ -92,39 +485,124 @@ public:
 	    pthread_cond_broadcast(&cv_);
 	    pthread_mutex_unlock(&mutex_);
         }
+	// モニターの待機を打ち切る
+	monitor_wake_.store(1, std::memory_order_release);
+	FJFutex::wake(&monitor_wake_);
         pthread_join(monitor_thread_, nullptr);
-        for (auto& t : workers_) {
-	    pthread_join(t.thread, nullptr);
+        for (size_t i = 0; i < _slot_count(); ++i) {
+	    if (workers_[i].joinable) pthread_join(workers_[i].thread, nullptr);
         }
+	// 期限の来なかった遅延投入を破棄
+	while (!timers_.empty()) {
+	    DelayedItem d = timers_.top();
+	    timers_.pop();
+	    _free_task_node(d.node);
+	    _instance_release(d.info);
+	}
+	// 残っているインスタンスの登録を解除する(後始末から他のFJUnitFramesが破棄されうるのでテーブルは先に外す)
+	pthread_mutex_lock(&mutex_);
+	std::unordered_map<FJUnitFrames*, InstanceInfo*> instances;
+	instances.swap(instance_map_);
+	for (auto& entry : instances) {
+	    // キャッシュの要素は後から作られたキューが使うので残さない
+	    if (cache_slot_ >= 0) entry.first->dispatch_info_[cache_slot_].store(nullptr, std::memory_order_release);
+	    entry.first->dispatch_queues_.fetch_sub(1, std::memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&mutex_);
+	for (auto& entry : instances) {
+	    InstanceInfo* info = entry.second;
+	    info->detached.store(true, std::memory_order_seq_cst);
+	    _cancel_suspensions(info);
+	    // ワーカーは止まっているので残ったタスクはここで取り消す
+	    _cancel_mailbox(info);
+	    // 管理テーブルの参照を手放す(実行待ちキューに残った参照があれば解放しない)
+	    _instance_release(info);
+	}
+	// キャッシュを片付けてからキャッシュの要素を手放す
+	pthread_mutex_lock(_live_mutex());
+	auto& queues = _live_queues();
+	queues.erase(std::remove(queues.begin(), queues.end(), this), queues.end());
+	pthread_mutex_unlock(_live_mutex());
         pthread_mutex_destroy(&mutex_);
+	pthread_mutex_destroy(&watermark_mutex_);
+	pthread_mutex_destroy(&result_watch_mutex_);
         pthread_cond_destroy(&cv_);
-        pthread_mutex_destroy(&result_mutex_);
-        pthread_cond_destroy(&result_cv_);
     }
 
     /**
      * @brief 結果アイテムの生成
-     * @param[out] handle ハンドル
-     * @param[out] result 結果アイテム
+     * @note スロットをハンドル順に巡回して使う。実行待ちのスロットは飛ばすので、結果を受け取る前に消えることはない。
+     *       全スロットが実行待ち・実行中なら、結果の登録で空くのをsetBlockTimeout()の時間まで待つ。
+     *       ワーカースレッドからは待たない(待つと消化する側が止まる)。空かなければ受け付けなかった数に加えて0を返す。
+     * @return ハンドル、スロットが空かなければ0
      */
-    void _new_resultitem( fjt_handle_t &handle, std::shared_ptr<ResultItem> &result )
+    fjt_handle_t _new_resultitem()
     {
-	handle = getHandle();
-	{
-	    pthread_mutex_lock(&result_mutex_);
-	    // 結果アイテムの登録と古い結果をキューから削除
-	    results_[handle] = result;
-	    result_order_.push_back(handle);
-	    if (result_order_.size() > FJDISPATCHLITE_MAX_RESULTS) {
-		fjt_handle_t old = result_order_.front();
-		result_order_.pop_front();
-		results_.erase(old);
+	bool waiting = false;
+	int64_t start = 0;
+	while (true) {
+	    uint32_t seq = result_free_seq_.load(std::memory_order_seq_cst);
+	    for (size_t tries = 0; tries <= result_mask_; ++tries) {
+		fjt_handle_t handle = getHandle();
+		ResultItem& item = results_[handle & result_mask_];
+		uint64_t word = item.word.load(std::memory_order_acquire);
+		if (((word & 3) == RESULT_FREE || (word & 3) == RESULT_READY) &&
+		    item.word.compare_exchange_strong(word, (handle << 2) | RESULT_PENDING, std::memory_order_acq_rel)) {
+		    if (waiting) result_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+		    return handle;
+		}
 	    }
-	    pthread_cond_broadcast(&result_cv_);
-	    pthread_mutex_unlock(&result_mutex_);
+	    if (_is_own_worker()) break;
+	    if (!waiting) {
+		// 待ち手として数えてからもう一度探す(その間の結果登録を取りこぼさない)
+		waiting = true;
+		start = _get_time();
+		result_waiters_.fetch_add(1, std::memory_order_seq_cst);
+		continue;
+	    }
+	    int64_t elapsed = _get_time() - start;
+	    uint32_t timeout = block_timeout_msec_.load(std::memory_order_relaxed);
+	    if (elapsed >= static_cast<int64_t>(timeout)) break;
+	    FJFutex::wait(&result_free_seq_, seq, static_cast<uint32_t>(timeout - elapsed));
+	}
+	if (waiting) result_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	tasks_rejected_.fetch_add(1, std::memory_order_relaxed);
+	return 0;
+    }
+
+    /**
+     * @brief 使わなかった結果スロットを返す
+     * @note ハンドルを誰にも渡していないスロットに使う(結果は登録しない)。
+     * @param[in] handle ハンドル(0なら何もしない)
+     */
+    void _discard_resultitem(fjt_handle_t handle)
+    {
+	if (handle == 0) return;
+	ResultItem& item = results_[handle & result_mask_];
+	uint64_t word = (handle << 2) | RESULT_PENDING;
+	if (!item.word.compare_exchange_strong(word, RESULT_FREE, std::memory_order_acq_rel)) return;
+	// スロットの空きを待っている投入側がいれば起こす
+	if (result_waiters_.load(std::memory_order_seq_cst) > 0) {
+	    result_free_seq_.fetch_add(1, std::memory_order_seq_cst);
+	    FJFutex::wake(&result_free_seq_);
 	}
     }
 
+    /**
+     * @brief 結果スロットを実行中にする
+     * @note タスクの実行と取り消しはどちらもこれに成功した側だけが行う。
+     * @param[in] handle ハンドル(0なら何もしない)
+     * @retval [true] 実行中にした(この後に結果を登録すること)
+     * @retval [false] 既に取り消されていた
+     */
+    bool _claim_resultitem(fjt_handle_t handle)
+    {
+	if (handle == 0) return true;
+	ResultItem& item = results_[handle & result_mask_];
+	uint64_t word = (handle << 2) | RESULT_PENDING;
+	return item.word.compare_exchange_strong(word, (handle << 2) | RESULT_RUNNING, std::memory_order_acq_rel);
+    }
+
     /**
      * @brief 結果の登録
      * @param[in] handle ハンドル
@@ -132,13 +610,68 @@ public:
      */
     void _post_resultitem( fjt_handle_t handle, int value)
     {
-        pthread_mutex_lock(&result_mutex_);
-	auto it = results_.find(handle);
-	if (it != results_.end()) {
-	    it->second->value = value;
-	    it->second->ready = true;
+	ResultItem& item = results_[handle & result_mask_];
+	item.value.store(value, std::memory_order_relaxed);
+	item.word.store((handle << 2) | RESULT_READY, std::memory_order_release);
+	// このハンドルを待っているスレッドだけを起こす
+	item.seq.fetch_add(1, std::memory_order_seq_cst);
+	if (item.waiters.load(std::memory_order_seq_cst) > 0) FJFutex::wake(&item.seq);
+	// スロットの空きを待っている投入側がいれば起こす
+	if (result_waiters_.load(std::memory_order_seq_cst) > 0) {
+	    result_free_seq_.fetch_add(1, std::memory_order_seq_cst);
+	    FJFutex::wake(&result_free_seq_);
+	}
+	// 複数ハンドルを待っているスレッドがいればまとめて起こす
+	if (completion_waiters_.load(std::memory_order_seq_cst) > 0) {
+	    completion_seq_.fetch_add(1, std::memory_order_seq_cst);
+	    FJFutex::wake(&completion_seq_);
+	}
+	// whenResult()の継続があれば呼ぶ
+	if (result_watch_count_.load(std::memory_order_seq_cst) > 0) _fire_result_watches(handle, RESULT_READY, value);
+    }
+
+    /**
+     * @brief ハンドルに設定された継続を一覧から外して呼ぶ
+     * @note 継続はresult_watch_mutex_を放してから呼ぶ。
+     * @param[in] handle ハンドル
+     * @param[in] state 状態(RESULT_READYまたはRESULT_FREE)
+     * @param[in] value 結果
+     */
+    void _fire_result_watches(fjt_handle_t handle, int state, int value)
+    {
+	std::vector<std::function<void(int, int)>> fired;
+	pthread_mutex_lock(&result_watch_mutex_);
+	for (size_t i = 0; i < result_watches_.size();) {
+	    if (result_watches_[i].handle != handle) {
+		++i;
+		continue;
+	    }
+	    fired.push_back(std::move(result_watches_[i].fn));
+	    result_watches_[i] = std::move(result_watches_.back());
+	    result_watches_.pop_back();
 	}
-        pthread_mutex_unlock(&result_mutex_);
+	result_watch_count_.fetch_sub(static_cast<uint32_t>(fired.size()), std::memory_order_seq_cst);
+	pthread_mutex_unlock(&result_watch_mutex_);
+	for (auto& fn : fired) fn(state, value);
+    }
+
+    /**
+     * @brief 結果の参照
+     * @param[in] handle ハンドル
+     * @param[out] value 結果(RESULT_READYのとき)
+     * @return 状態、ハンドルが見つからなければRESULT_FREE
+     */
+    int _peek_resultitem( fjt_handle_t handle, int &value)
+    {
+	ResultItem& item = results_[handle & result_mask_];
+	uint64_t word = item.word.load(std::memory_order_acquire);
+	if ((word >> 2) != handle) return RESULT_FREE;
+	if ((word & 3) != RESULT_READY) return RESULT_PENDING;
+	value = item.value.load(std::memory_order_relaxed);
+	// 読んでいる間に再利用されていないこと
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (item.word.load(std::memory_order_relaxed) != word) return RESULT_FREE;
+	return RESULT_READY;
     }
 
     /**
@@ -149,299 +682,2659 @@ public:
      * @param[in] msg メッセージID
      * @param[in] buf データ
      * @param[in] len データバイト長
-     * @param[in] isseq [true]:obj単位でシーケンシャルに実行, [false]:パラレル実行(メソッド間の資源排他を行うこと)
-     * @param[in] srcfunc デバッグ表示用呼び出し関数名
+     * @param[in] isseq [true]:obj単位でシーケンシャルに実行, [false]:パラレル実行(メソッド間の資源排他を行うこと。objの他のタスクと並行して、順序も保証せずに実行される)
+     * @param[in] srcfunc デバッグ表示用呼び出し関数名(文字列リテラル等、静的な寿命を持つこと)
      * @param[in] srcline デバッグ表示用呼び出し行数
-     * @return ハンドル 
+     * @param[in] attr 投入属性(優先度)
+     * @return ハンドル、受け付けなかったら0
+     * @note 結果スロットはConfig::max_results個(CreateQueue()のキューはmax_results引数)で、未完了のタスクはこの数までしか持てない。
+     *       全て埋まっていると空くまでsetBlockTimeout()の時間だけ待ち(ワーカースレッドからは待たない)、
+     *       空かなければ実行せずに0を返す(getBackpressureStats()のrejectedに数える)。postEvent等も同じ。
     */
     template <typename T>
-    fjt_handle_t postQueue(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, bool isseq, std::string srcfunc, uint32_t srcline) {
+    fjt_handle_t postQueue(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, bool isseq, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
 	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
-	// start_time
-	auto start = _get_time();
-        // bufをコピー
-        char* buf_copy = new char[len];
-        std::memcpy(buf_copy, static_cast<char *>(buf), len);
-	// srcfuncをコピー
-	char *srcfunc_copy = new char[srcfunc.size()+1];
-	std::strcpy(srcfunc_copy, srcfunc.c_str());
-	// ResultItem
-	fjt_handle_t handle;
-	auto result = std::make_shared<ResultItem>();
-	_new_resultitem( handle, result );
+	TaskNode* node = _queue_node(obj, mf, msg, buf, len, srcfunc, srcline, attr);
+	fjt_handle_t handle = node->handle;
 #if FJDISPATCHLITE_DBG == 1
 	{
-	    std::cerr << COLOR_CYAN << "[" << start << "]:" << srcfunc  << COLOR_RESET << std::endl;
+	    std::cerr << COLOR_CYAN << "[" << node->start_usec / 1000 << "]:" << srcfunc  << COLOR_RESET << std::endl;
 	}
 #endif
-	// lambda式でタスクを定義
-        auto lambda = [=]() {
-	    auto delay = _get_time();
-            pthread_mutex_lock(&mutex_);
-            for (auto& w : workers_) {
-                if (pthread_self() == w.thread) {
-                    w.task_start_ms = delay;
-                    w.task_srcfunc = srcfunc_copy;
-                }
-            }
-            pthread_mutex_unlock(&mutex_);
-#if FJDISPATCHLITE_PROFILE_DBG == 1
-	    auto elapsed1 = delay - start;	    
-	    if (elapsed1 > FJDISPATCHLITE_PROFILE_TOO_DELAY_MSEC) {
-		std::cerr << COLOR_RED << "[" << delay << "]:" << srcfunc_copy << "(" << srcline << "): *WARNING* function execution is DELAYED. " << elapsed1 << " msec." << COLOR_RESET << std::endl;
-	    }
-#endif
-	    int ret = (obj->*mf)(msg, buf_copy, len);
-#if FJDISPATCHLITE_PROFILE_DBG == 1
-	    auto now = _get_time();
-	    auto elapsed2 = now - start;
-	    if (elapsed2 > FJDISPATCHLITE_PROFILE_TOO_EXEC_MSEC) {
-		std::cerr << COLOR_RED << "[" << now << "]" << srcfunc_copy << "(" << srcline << "): *WARNING* function execution time is TOO LONG. " << elapsed2 << " msec." << COLOR_RESET << std::endl;
-	    }
-#endif
-
-	    delete[] srcfunc_copy;
-            delete[] buf_copy;
 
-	    // 結果の登録
-	    _post_resultitem(handle, ret);
-        }; 
-
-	auto task = std::make_unique<std::packaged_task<void()>>(lambda);
-
-	// インスタンスのタスクキューに所有権を移動
-	{
-	    pthread_mutex_lock(&mutex_);
-	    auto& inst_info = instance_map_[static_cast<FJUnitFrames*>(obj)];
-	    inst_info.task_queue.push(std::move(task));
-	    // インスタンスのタスクキューが実行中でないか、パラで動作させるフラグが立っていたら
-	    if (!inst_info.running || !isseq) {
-		// 実行待ちタスクに登録して実行中に
-		ready_instances_.push(static_cast<FJUnitFrames*>(obj));
-		inst_info.running = true;
-		// イベント送信
-		pthread_cond_signal(&cv_);
-	    }
-	    // ワーカースレッドを必要に応じて拡張
-            _adjust_workers();
-	    pthread_mutex_unlock(&mutex_);
-         }
+	// インスタンスのメールボックスに所有権を移動
+	_submit(static_cast<FJUnitFrames*>(obj), node, isseq);
 
 	return handle;
     }
 
+    /**
+     * @brief キューにタスクを積む(呼び出し関数名をstd::stringで渡す)
+     * @note srcfuncは内部の表に複製して保持する(同じ名前は1つにまとめ、解放しない)。
+     *       投入のたびに表を引くので、頻繁に呼ぶ箇所では__FUNCTION__等の静的な文字列を渡すこと。その他はpostQueue参照。
+     */
+    template <typename T>
+    fjt_handle_t postQueue(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, bool isseq, const std::string& srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	return postQueue(obj, mf, msg, buf, len, isseq, _intern_srcfunc(srcfunc), srcline, attr);
+    }
+
     /**
      * @brief キューにイベントを積む
      * @note 本クラスから呼び出されるFJUnitFramesの生存期間はユーザーが保証すること。
      * @param[in] obj FJUnitFramesのポインタ
      * @param[in] mf FJUnitFramesのメソッド
      * @param[in] msg メッセージID
-     * @param[in] srcfunc デバッグ表示用呼び出し関数名
+     * @param[in] srcfunc デバッグ表示用呼び出し関数名(文字列リテラル等、静的な寿命を持つこと)
      * @param[in] srcline デバッグ表示用呼び出し行数
-     * @return ハンドル 
+     * @param[in] attr 投入属性(優先度)
+     * @return ハンドル、受け付けなかったら0(postQueue参照)
     */
     template <typename T>
-    fjt_handle_t postEvent(T* obj, int (T::*mf)(uint32_t), uint32_t msg, std::string srcfunc, uint32_t srcline) {
+    fjt_handle_t postEvent(T* obj, int (T::*mf)(uint32_t), uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
 	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
-	// start_time
-	auto start = _get_time();
-	// srcfuncをコピー
-	char *srcfunc_copy = new char[srcfunc.size()+1];
-	std::strcpy(srcfunc_copy, srcfunc.c_str());
-	// ResultItem
-	fjt_handle_t handle;
-	auto result = std::make_shared<ResultItem>();
-	_new_resultitem( handle, result );
+	fjt_handle_t handle = 0;
+	TaskNode* node = attr.coalesce ? _coalesce_event(obj, mf, msg, srcfunc, srcline, attr, handle) : _event_node(obj, mf, msg, srcfunc, srcline, attr);
+	// 開始前の同じイベントに相乗りした
+	if (node == nullptr) return handle;
+	handle = node->handle;
 #if FJDISPATCHLITE_DBG == 1
 	{
-	    std::cerr << COLOR_CYAN << "[" << start << "]:" << srcfunc  << COLOR_RESET << std::endl;
+	    std::cerr << COLOR_CYAN << "[" << node->start_usec / 1000 << "]:" << srcfunc  << COLOR_RESET << std::endl;
 	}
 #endif
-	// lambda式でタスクを定義
-        auto lambda = [=]() {
-	    auto delay = _get_time();
-            pthread_mutex_lock(&mutex_);
-            for (auto& w : workers_) {
-                if (pthread_self() == w.thread) {
-                    w.task_start_ms = delay;
-                    w.task_srcfunc = srcfunc_copy;
-                }
-            }
-            pthread_mutex_unlock(&mutex_);
-#if FJDISPATCHLITE_PROFILE_DBG == 1
-	    auto elapsed1 = delay - start;	    
-	    if (elapsed1 > FJDISPATCHLITE_PROFILE_TOO_DELAY_MSEC) {
-		std::cerr << COLOR_RED << "[" << delay << "]:" << srcfunc_copy << "(" << srcline << "): *WARNING* function execution is DELAYED. " << elapsed1 << " msec." << COLOR_RESET << std::endl;
-	    }
-#endif
-	    int ret = (obj->*mf)(msg);
-#if FJDISPATCHLITE_PROFILE_DBG == 1
-	    auto now = _get_time();
-	    auto elapsed2 = now - start;
-	    if (elapsed2 > FJDISPATCHLITE_PROFILE_TOO_EXEC_MSEC) {
-		std::cerr << COLOR_RED << "[" << now << "]" << srcfunc_copy << "(" << srcline << "): *WARNING* function execution time is TOO LONG. " << elapsed2 << " msec." << COLOR_RESET << std::endl;
-	    }
-#endif
-
-	    delete[] srcfunc_copy;
 
-	    // 結果の登録
-	    _post_resultitem(handle, ret);
-        };
-
-	auto task = std::make_unique<std::packaged_task<void()>>(lambda);
-
-	// インスタンスのタスクキューに所有権を移動
-	{
-	    pthread_mutex_lock(&mutex_);
-	    auto& inst_info = instance_map_[static_cast<FJUnitFrames*>(obj)];
-	    inst_info.task_queue.push(std::move(task));
-	    // インスタンスのタスクキューが実行中でないか
-	    if (!inst_info.running) {
-		// 実行待ちタスクに登録して実行中に
-		ready_instances_.push(static_cast<FJUnitFrames*>(obj));
-		inst_info.running = true;
-		// イベント送信
-		pthread_cond_signal(&cv_);
-	    }
-	    // ワーカースレッドを必要に応じて拡張
-            _adjust_workers();
-	    pthread_mutex_unlock(&mutex_);
-        }
+	// インスタンスのメールボックスに所有権を移動
+	_submit(static_cast<FJUnitFrames*>(obj), node, true);
 
 	return handle;
     }
 
+    /**
+     * @brief キューにイベントを積む(呼び出し関数名をstd::stringで渡す)
+     * @note srcfuncの扱いはstd::string版のpostQueue参照。
+     */
+    template <typename T>
+    fjt_handle_t postEvent(T* obj, int (T::*mf)(uint32_t), uint32_t msg, const std::string& srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	return postEvent(obj, mf, msg, _intern_srcfunc(srcfunc), srcline, attr);
+    }
+
     /**
      * @brief キューにタスクを積む
      * @note 本クラスから呼び出されるFJUnitFramesの生存期間はユーザーが保証すること。
      * @param[in] obj FJUnitFramesのポインタ
      * @param[in] task std::packaged_task
+     * @param[in] attr 投入属性(優先度)
+     * @return ハンドル(実行後にwaitResultで0が得られる)、受け付けなかったら0(postQueue参照)
      */
     template <typename T>
-    fjt_handle_t enqueueTask(T* obj, std::packaged_task<void()>&& task) {
+    fjt_handle_t enqueueTask(T* obj, std::packaged_task<void()>&& task, const FJPostAttr& attr = FJPostAttr()) {
 	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
-	fjt_handle_t handle = getHandle();
+	TaskNode* node = _new_task_node(0, nullptr, 0, attr);
+	_bind_callable(node, [t = std::move(task)](TaskNode*) mutable {
+	    t();
+	    return 0;
+	});
+	_assign_resultitem(node);
+	fjt_handle_t handle = node->handle;
 
-	// インスタンスのタスクキューに所有権を移動
-	{
-	    pthread_mutex_lock(&mutex_);
-	    auto& inst_info = instance_map_[static_cast<FJUnitFrames*>(obj)];
-	    auto task_ptr = std::make_unique<std::packaged_task<void()>>(std::move(task));
-	    inst_info.task_queue.push(std::move(task_ptr));
-	    // インスタンスのタスクキューが実行中でないか
-	    if (!inst_info.running) {
-		// 実行待ちタスクに登録して実行中に
-		ready_instances_.push(static_cast<FJUnitFrames*>(obj));
-		inst_info.running = true;
-		// イベント送信
-		pthread_cond_signal(&cv_);
-	    }
-	    // ワーカースレッドを必要に応じて拡張
-	    _adjust_workers();
-	    pthread_mutex_unlock(&mutex_);
-        }
+	// インスタンスのメールボックスに所有権を移動
+	_submit(static_cast<FJUnitFrames*>(obj), node, true);
 
 	return handle;
     }
 
     /**
-     * @brief タスクの実行結果を待つ
-     * @param[in] handle 待受ハンドル
-     * @param[in] timeout_msec 最大待ち時間(msec)
-     * @paaram[out] result_out タスクの返り値
-     * @retval [true] 実行結果が取得できた
-     * @retval [false] 待受ハンドルの実行結果が見つからない
+     * @brief キューに関数を積み、型付きの結果を受け取る
+     * @note 結果はint1つに限られず、then()で継続をつなげられる。リザルトスロットは使わない。
+     *       実行開始期限切れ等で実行されずに破棄されたときは値なしで完了する。
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] fn 引数なしの呼び出し対象(返り値が結果になる)
+     * @param[in] isseq [true]:obj単位でシーケンシャルに実行, [false]:パラレル実行
+     * @param[in] attr 投入属性
+     * @return 結果
      */
-    bool waitResult(fjt_handle_t handle, uint32_t timeout_msec, int& result_out) {
-	auto start = _get_time();
-        pthread_mutex_lock(&result_mutex_);
+    template <typename T, typename F>
+    FJFuture<decltype(std::declval<typename std::decay<F>::type&>()())> post(T* obj, F&& fn, bool isseq = true, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	typedef decltype(std::declval<typename std::decay<F>::type&>()()) R;
+	FJFutureState<R>* state = nullptr;
+	TaskNode* node = _future_node(std::forward<F>(fn), attr, state);
+	_submit(static_cast<FJUnitFrames*>(obj), node, isseq);
+	return FJFuture<R>(state);
+    }
 
-        while (true) {
-            auto it = results_.find(handle);
-            if (it != results_.end()) {
-		// テーブルに存在し
-                auto& item = it->second;
-                if (item->ready) {
-		    // 実行完了している
-                    result_out = item->value;
-                    pthread_mutex_unlock(&result_mutex_);
-                    return true;
-		}
-	    }		
-	    auto now = _get_time();
-	    auto elapsed = now - start;
-	    if (elapsed >= timeout_msec) {
-		pthread_mutex_unlock(&result_mutex_);
-		return false;
+    /**
+     * @brief 指定時間後にキューに関数を積み、型付きの結果を受け取る
+     * @param[in] delay_msec 遅延時間(msec)
+     * @note その他の引数はpostと同じ。
+     * @return 結果
+     */
+    template <typename T, typename F>
+    FJFuture<decltype(std::declval<typename std::decay<F>::type&>()())> postAfter(uint32_t delay_msec, T* obj, F&& fn, bool isseq = true, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	typedef decltype(std::declval<typename std::decay<F>::type&>()()) R;
+	FJFutureState<R>* state = nullptr;
+	TaskNode* node = _future_node(std::forward<F>(fn), attr, state);
+	_post_delayed(static_cast<FJUnitFrames*>(obj), node, isseq, _get_time_usec() + static_cast<int64_t>(delay_msec) * 1000);
+	return FJFuture<R>(state);
+    }
+
+    /**
+     * @brief 範囲を分割してワーカーで並列に実行する
+     * @note 呼び出したスレッドも処理に加わり、全ての範囲の処理が終わってから戻る。
+     *       チャンクの大きさは実測した1要素あたりの実行時間からFJDISPATCHLITE_APPLY_CHUNK_USEC程度になるよう調整する。
+     *       ワーカーから呼んでもよい(空いているワーカーがいなければ呼び出したスレッドだけで処理する)。
+     * @param[in] begin 範囲の先頭
+     * @param[in] end 範囲の末尾(含まない)
+     * @param[in] fn 処理 fn(chunk_begin, chunk_end)
+     */
+    template <typename F>
+    void dispatchApplyRange(size_t begin, size_t end, F&& fn) {
+	if (begin >= end) return;
+	typedef typename std::remove_reference<F>::type Fn;
+	ApplyState* state = new ApplyState(begin, end, [](void* ctx, size_t b, size_t e) {
+	    (*static_cast<Fn*>(ctx))(b, e);
+	}, &fn);
+	// まず1要素だけ実行してチャンクの大きさを決める
+	_apply_chunk(state, 1);
+	size_t left = end - state->next.load(std::memory_order_relaxed);
+	size_t chunk = state->chunk.load(std::memory_order_relaxed);
+	size_t helpers = std::min(config_.max_threads, left / chunk);
+	if (helpers > 0) {
+	    ReadyItem* ready[FJDISPATCHLITE_BATCH_CHUNK];
+	    helpers = std::min(helpers, static_cast<size_t>(FJDISPATCHLITE_BATCH_CHUNK));
+	    state->participants.store(helpers + 1, std::memory_order_relaxed);
+	    state->refs.fetch_add(helpers, std::memory_order_relaxed);
+	    for (size_t i = 0; i < helpers; ++i) {
+		TaskNode* node = _new_task_node(0, nullptr, 0, FJPostAttr());
+		_bind_callable(node, [this, state](TaskNode*) {
+		    _apply_run(state);
+		    _apply_release(state);
+		    return 0;
+		});
+		ready[i] = node;
 	    }
-	    struct timespec next;
-	    _get_future_timespec(&next, elapsed > 33 ? 33 : elapsed);
-	    pthread_cond_timedwait(&result_cv_, &result_mutex_, &next);
-        }
+	    _push_ready_batch(ready, helpers);
+	}
+	_apply_run(state);
+	// 他の参加者が実行中のチャンクを待つ
+	state->waiting.fetch_add(1, std::memory_order_seq_cst);
+	while (state->finished.load(std::memory_order_seq_cst) < state->count) {
+	    FJFutex::wait(&state->done, 0, -1);
+	}
+	state->waiting.fetch_sub(1, std::memory_order_seq_cst);
+	_apply_release(state);
     }
 
-private:
     /**
-     * @brief ワーカーの動作状況
+     * @brief 0〜count-1の各要素をワーカーで並列に実行する
+     * @note dispatchApplyRangeの要素単位版。
+     * @param[in] count 要素数
+     * @param[in] fn 処理 fn(index)
      */
-    struct WorkerInfo {
-        pthread_t thread;
-        uint64_t last_active_ms;
-        uint64_t task_start_ms = 0;
-        std::string task_srcfunc;
-    };
+    template <typename F>
+    void dispatchApply(size_t count, F&& fn) {
+	dispatchApplyRange(0, count, [&fn](size_t b, size_t e) {
+	    for (size_t i = b; i < e; ++i) fn(i);
+	});
+    }
 
     /**
-     * @brief 各FJUintFramesごとのインスタンス情報
+     * @brief インスタンスにバリアタスクを積む
+     * @note それまでに積んだobjのパラレル実行のタスクが全て完了してから実行され、
+     *       完了するまで後から積んだパラレル実行のタスクは開始しない。
+     *       バリアが未完了の間はメールボックスをレーンによらず積んだ順に取り出すので、
+     *       それ以前に積んだシーケンシャル実行のタスクは全てバリアより先に、以降に積んだものは後に実行する。
+     * @note その他の引数はpostQueueと同じ(attr.prioは無視する)。
+     * @return ハンドル
      */
-    struct InstanceInfo {
-	std::queue<std::unique_ptr<std::packaged_task<void()>>> task_queue; //!< タスクキュー
-        bool running = false; //!< このインスタンスのタスクがスレッドで実行中か
-    };
-    
+    template <typename T>
+    fjt_handle_t postBarrier(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	TaskNode* node = _queue_node(obj, mf, msg, buf, len, srcfunc, srcline, attr);
+	fjt_handle_t handle = node->handle;
+	node->kind = KIND_BARRIER;
+	node->prio = node->lane = C_MESSAGE_HIGH;
+	InstanceInfo* info = _instance_info(static_cast<FJUnitFrames*>(obj));
+	// 以降のパラレル実行はメールボックスを経由させる
+	info->barriers.fetch_add(1, std::memory_order_seq_cst);
+	ReadyItem* ready = _enqueue_mailbox(info, node);
+	if (ready != nullptr) _push_ready(ready);
+	return handle;
+    }
+
     /**
-     * @brief デフォルトコンストラクタ
+     * @brief 指定時間後にキューにタスクを積む
+     * @note タイマースレッドを介さず、ワーカーが期限の来たものを直接実行待ちに移す。
+     *       ハンドルは投入時に発行され、実行されるまでwaitResultで待てる。
+     * @param[in] delay_msec 遅延時間(msec)
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] mf FJUnitFramesのメソッド
+     * @param[in] msg メッセージID
+     * @param[in] buf データ(投入時にコピーする)
+     * @param[in] len データバイト長
+     * @param[in] isseq [true]:obj単位でシーケンシャルに実行, [false]:パラレル実行
+     * @param[in] srcfunc デバッグ表示用呼び出し関数名(文字列リテラル等、静的な寿命を持つこと)
+     * @param[in] srcline デバッグ表示用呼び出し行数
+     * @param[in] attr 投入属性
+     * @return ハンドル
      */
-    FJDispatchLite() : stop_(false), num_of_threads_(FJDISPATCHLITE_DEFAULT_THREADS) {
-        pthread_mutex_init(&mutex_, NULL);
-        pthread_cond_init(&cv_, NULL);
-        pthread_mutex_init(&result_mutex_, NULL);
-        pthread_cond_init(&result_cv_, NULL);
-        for (int i = 0; i < num_of_threads_; ++i) _spawn_worker();
-        pthread_create(&monitor_thread_, NULL, &FJDispatchLite::monitorFunc, this);
+    template <typename T>
+    fjt_handle_t postQueueAfter(uint32_t delay_msec, T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, bool isseq, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	return postQueueAt(_get_time_usec() + static_cast<int64_t>(delay_msec) * 1000, obj, mf, msg, buf, len, isseq, srcfunc, srcline, attr);
     }
 
-    void _spawn_worker() {
-        WorkerInfo info;
-        info.last_active_ms = _get_time();
-        pthread_create(&info.thread, NULL, &FJDispatchLite::workerFunc, this);
-        workers_.push_back(info);
+    /**
+     * @brief 指定時刻にキューにタスクを積む
+     * @param[in] when_usec 時刻(_get_time_usec()基準の絶対時刻)
+     * @note その他の引数はpostQueueAfterと同じ。
+     * @return ハンドル
+     */
+    template <typename T>
+    fjt_handle_t postQueueAt(int64_t when_usec, T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, void* buf, uint32_t len, bool isseq, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	TaskNode* node = _queue_node(obj, mf, msg, buf, len, srcfunc, srcline, attr);
+	fjt_handle_t handle = node->handle;
+	_post_delayed(static_cast<FJUnitFrames*>(obj), node, isseq, when_usec);
+	return handle;
     }
 
+    /**
+     * @brief 指定時間後にキューにイベントを積む
+     * @param[in] delay_msec 遅延時間(msec)
+     * @note その他の引数はpostEventと同じ。
+     * @return ハンドル
+     */
+    template <typename T>
+    fjt_handle_t postEventAfter(uint32_t delay_msec, T* obj, int (T::*mf)(uint32_t), uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	return postEventAt(_get_time_usec() + static_cast<int64_t>(delay_msec) * 1000, obj, mf, msg, srcfunc, srcline, attr);
+    }
+
+    /**
+     * @brief 指定時刻にキューにイベントを積む
+     * @param[in] when_usec 時刻(_get_time_usec()基準の絶対時刻)
+     * @note その他の引数はpostEventと同じ。
+     * @return ハンドル
+     */
+    template <typename T>
+    fjt_handle_t postEventAt(int64_t when_usec, T* obj, int (T::*mf)(uint32_t), uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	TaskNode* node = _event_node(obj, mf, msg, srcfunc, srcline, attr);
+	fjt_handle_t handle = node->handle;
+	_post_delayed(static_cast<FJUnitFrames*>(obj), node, true, when_usec);
+	return handle;
+    }
+
+    /**
+     * @brief キューにタスクをまとめて積む
+     * @note 実行待ちキューへの登録とワーカーの起床はFJDISPATCHLITE_BATCH_CHUNK個ごとに1回のロックで行う。
+     *       同じインスタンス宛ての要素は配列の順に実行される(isseq=trueかつ同じ優先度のとき)。
+     * @param[in] items 投入するメッセージ
+     * @param[in] count 要素数
+     * @param[in] isseq [true]:obj単位でシーケンシャルに実行, [false]:パラレル実行
+     * @param[in] srcfunc デバッグ表示用呼び出し関数名(文字列リテラル等、静的な寿命を持つこと)
+     * @param[in] srcline デバッグ表示用呼び出し行数
+     * @param[out] handles 要素ごとのハンドル(count個、不要ならnullptr)
+     * @param[in] attr 投入属性(全要素に共通)
+     * @return 投入した数
+     */
+    template <typename T>
+    size_t postQueueBatch(const QueueItem<T>* items, size_t count, bool isseq, const char* srcfunc, uint32_t srcline, fjt_handle_t* handles, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	ReadyItem* ready[FJDISPATCHLITE_BATCH_CHUNK];
+	for (size_t base = 0; base < count; base += FJDISPATCHLITE_BATCH_CHUNK) {
+	    size_t n = std::min(count - base, static_cast<size_t>(FJDISPATCHLITE_BATCH_CHUNK));
+	    size_t nready = 0;
+	    for (size_t i = 0; i < n; ++i) {
+		const QueueItem<T>& it = items[base + i];
+		TaskNode* node = _queue_node(it.obj, it.mf, it.msg, it.buf, it.len, srcfunc, srcline, attr);
+		if (handles != nullptr) handles[base + i] = node->handle;
+		ReadyItem* r = _enqueue(static_cast<FJUnitFrames*>(it.obj), node, isseq, ready, &nready);
+		if (r != nullptr) ready[nready++] = r;
+	    }
+	    _push_ready_batch(ready, nready);
+	}
+	return count;
+    }
+
+    /**
+     * @brief キューにイベントをまとめて積む
+     * @note postQueueBatchのイベント版。obj単位でシーケンシャルに実行される。
+     * @param[in] items 投入するイベント
+     * @param[in] count 要素数
+     * @param[in] srcfunc デバッグ表示用呼び出し関数名(文字列リテラル等、静的な寿命を持つこと)
+     * @param[in] srcline デバッグ表示用呼び出し行数
+     * @param[out] handles 要素ごとのハンドル(count個、不要ならnullptr)
+     * @param[in] attr 投入属性(全要素に共通)
+     * @return 投入した数
+     */
+    template <typename T>
+    size_t postEventBatch(const EventItem<T>* items, size_t count, const char* srcfunc, uint32_t srcline, fjt_handle_t* handles, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	ReadyItem* ready[FJDISPATCHLITE_BATCH_CHUNK];
+	for (size_t base = 0; base < count; base += FJDISPATCHLITE_BATCH_CHUNK) {
+	    size_t n = std::min(count - base, static_cast<size_t>(FJDISPATCHLITE_BATCH_CHUNK));
+	    size_t nready = 0;
+	    for (size_t i = 0; i < n; ++i) {
+		const EventItem<T>& it = items[base + i];
+		fjt_handle_t handle = 0;
+		TaskNode* node = attr.coalesce ? _coalesce_event(it.obj, it.mf, it.msg, srcfunc, srcline, attr, handle) : _event_node(it.obj, it.mf, it.msg, srcfunc, srcline, attr);
+		if (node == nullptr) {
+		    if (handles != nullptr) handles[base + i] = handle;
+		    continue;
+		}
+		if (handles != nullptr) handles[base + i] = node->handle;
+		ReadyItem* r = _enqueue(static_cast<FJUnitFrames*>(it.obj), node, true, ready, &nready);
+		if (r != nullptr) ready[nready++] = r;
+	    }
+	    _push_ready_batch(ready, nready);
+	}
+	return count;
+    }
+
+    /**
+     * @brief キューにタスクをまとめて積む
+     * @note enqueueTaskの一括版。tasksはムーブされる。
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in,out] tasks std::packaged_taskの配列
+     * @param[in] count 要素数
+     * @param[out] handles 要素ごとのハンドル(count個、不要ならnullptr)
+     * @param[in] attr 投入属性(全要素に共通)
+     * @return 投入した数
+     */
+    template <typename T>
+    size_t enqueueTaskBatch(T* obj, std::packaged_task<void()>* tasks, size_t count, fjt_handle_t* handles, const FJPostAttr& attr = FJPostAttr()) {
+	static_assert(std::is_base_of<FJUnitFrames, T>::value, "T must derive from FJUnitFrames");
+	ReadyItem* ready[FJDISPATCHLITE_BATCH_CHUNK];
+	for (size_t base = 0; base < count; base += FJDISPATCHLITE_BATCH_CHUNK) {
+	    size_t n = std::min(count - base, static_cast<size_t>(FJDISPATCHLITE_BATCH_CHUNK));
+	    size_t nready = 0;
+	    for (size_t i = 0; i < n; ++i) {
+		TaskNode* node = _new_task_node(0, nullptr, 0, attr);
+		_bind_callable(node, [t = std::move(tasks[base + i])](TaskNode*) mutable {
+		    t();
+		    return 0;
+		});
+		_assign_resultitem(node);
+		if (handles != nullptr) handles[base + i] = node->handle;
+		ReadyItem* r = _enqueue(static_cast<FJUnitFrames*>(obj), node, true, ready, &nready);
+		if (r != nullptr) ready[nready++] = r;
+	    }
+	    _push_ready_batch(ready, nready);
+	}
+	return count;
+    }
+
+    /**
+     * @brief タスクの実行結果を待つ
+     * @note ワーカースレッドから待つ間は塞がっているものとして扱う(beginBlocking()参照)。
+     * @param[in] handle 待受ハンドル
+     * @param[in] timeout_msec 最大待ち時間(msec)
+     * @paaram[out] result_out タスクの返り値
+     * @retval [true] 実行結果が取得できた
+     * @retval [false] 待受ハンドルの実行結果が見つからない
+     */
+    bool waitResult(fjt_handle_t handle, uint32_t timeout_msec, int& result_out) {
+	auto start = _get_time();
+	ResultItem& item = results_[handle & result_mask_];
+
+	item.waiters.fetch_add(1, std::memory_order_seq_cst);
+	bool found = false;
+	bool blocking = false;
+        while (true) {
+	    uint32_t seq = item.seq.load(std::memory_order_seq_cst);
+	    int state = _peek_resultitem(handle, result_out);
+	    if (state != RESULT_PENDING) {
+		// 実行完了しているか、テーブルに存在しない
+		found = (state == RESULT_READY);
+		break;
+	    }
+	    auto elapsed = _get_time() - start;
+	    if (elapsed >= timeout_msec) break;
+	    if (!blocking) {
+		beginBlocking();
+		blocking = true;
+	    }
+	    // 結果登録でseqが進むまで眠る
+	    FJFutex::wait(&item.seq, seq, timeout_msec - elapsed);
+        }
+	if (blocking) endBlocking();
+	item.waiters.fetch_sub(1, std::memory_order_seq_cst);
+	return found;
+    }
+
+    /**
+     * @brief タスクの実行結果を待たずに参照する
+     * @param[in] handle 待受ハンドル
+     * @param[out] result_out タスクの返り値(RESULT_READYのとき)
+     * @return RESULT_PENDING:未完了, RESULT_READY:取得できた, RESULT_FREE:見つからない
+     */
+    int peekResult(fjt_handle_t handle, int& result_out) {
+	return _peek_resultitem(handle, result_out);
+    }
+
+    /**
+     * @brief 結果が登録されたときに呼ぶ継続を設定する
+     * @note 結果を登録したスレッド(ワーカーまたはcancel()等の呼び出し元)からfnを1回だけ呼ぶので、fnの中で長く止まらないこと。fnから投入してもよい。
+     *       既に登録済みか、ハンドルが見つからなければ、この中で呼ぶ。
+     *       継続が1つもなければ、結果の登録は一覧を見ない。
+     * @param[in] handle 待受ハンドル
+     * @param[in] fn 継続 fn(state, result)(stateはRESULT_READYまたはRESULT_FREE、resultはRESULT_READYのときの返り値)
+     */
+    void whenResult(fjt_handle_t handle, std::function<void(int, int)> fn) {
+	pthread_mutex_lock(&result_watch_mutex_);
+	result_watches_.push_back(ResultWatch{handle, std::move(fn)});
+	result_watch_count_.fetch_add(1, std::memory_order_seq_cst);
+	pthread_mutex_unlock(&result_watch_mutex_);
+	// 一覧に載せる前に登録された結果は自分で拾う(どちらが呼んでも1回だけ)
+	int value = 0;
+	int state = _peek_resultitem(handle, value);
+	if (state != RESULT_PENDING) _fire_result_watches(handle, state, value);
+    }
+
+    /**
+     * @brief 開始前のタスクを取り消す
+     * @note 結果はすぐにFJDISPATCHLITE_RESULT_CANCELLEDで登録する。ノードはキューに残り、取り出されたときに実行せずに解放する。
+     *       実行中または完了済みのタスクは取り消せない。
+     * @param[in] handle 待受ハンドル
+     * @retval [true] 取り消した
+     * @retval [false] 既に開始しているか、ハンドルが見つからない
+     */
+    bool cancel(fjt_handle_t handle) {
+	if (handle == 0 || !_claim_resultitem(handle)) return false;
+	tasks_cancelled_.fetch_add(1, std::memory_order_relaxed);
+	_post_resultitem(handle, FJDISPATCHLITE_RESULT_CANCELLED);
+	return true;
+    }
+
+    /**
+     * @brief 複数タスクの実行結果を全て待つ
+     * @note 結果が登録されるたびに起きて未完了のハンドルだけを確認する。ワーカースレッドから待つ間は塞がっているものとして扱う。
+     * @param[in] handles 待受ハンドルの配列
+     * @param[in] count 要素数
+     * @param[in] timeout_msec 全体の最大待ち時間(msec)
+     * @param[out] results_out タスクの返り値(count個、不要ならnullptr)。falseのときは取得できた分のみ有効
+     * @retval [true] 全ての実行結果が取得できた
+     * @retval [false] タイムアウトしたか、実行結果が見つからないハンドルがあった
+     */
+    bool waitAll(const fjt_handle_t* handles, size_t count, uint32_t timeout_msec, int* results_out = nullptr) {
+	auto start = _get_time();
+	// 未取得のハンドルの添字(取得できたものは末尾と入れ替えて外す)
+	std::vector<size_t> pending(count);
+	for (size_t i = 0; i < count; ++i) pending[i] = i;
+	bool found = true;
+	bool blocking = false;
+	completion_waiters_.fetch_add(1, std::memory_order_seq_cst);
+	while (true) {
+	    uint32_t seq = completion_seq_.load(std::memory_order_seq_cst);
+	    for (size_t k = 0; k < pending.size();) {
+		size_t i = pending[k];
+		int value = 0;
+		int state = _peek_resultitem(handles[i], value);
+		if (state == RESULT_PENDING) {
+		    ++k;
+		    continue;
+		}
+		if (state != RESULT_READY) {
+		    found = false;
+		    break;
+		}
+		if (results_out != nullptr) results_out[i] = value;
+		pending[k] = pending.back();
+		pending.pop_back();
+	    }
+	    if (!found || pending.empty()) break;
+	    auto elapsed = _get_time() - start;
+	    if (elapsed >= timeout_msec) {
+		found = false;
+		break;
+	    }
+	    if (!blocking) {
+		beginBlocking();
+		blocking = true;
+	    }
+	    // いずれかの結果登録でseqが進むまで眠る
+	    FJFutex::wait(&completion_seq_, seq, timeout_msec - elapsed);
+	}
+	if (blocking) endBlocking();
+	completion_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	return found;
+    }
+
+    /**
+     * @brief 複数タスクのいずれかの実行結果を待つ
+     * @note ワーカースレッドから待つ間は塞がっているものとして扱う。
+     * @param[in] handles 待受ハンドルの配列
+     * @param[in] count 要素数
+     * @param[in] timeout_msec 最大待ち時間(msec)
+     * @param[out] which 実行結果が取得できたハンドルの添字(複数あれば最も小さい添字)
+     * @param[out] result_out タスクの返り値
+     * @retval [true] いずれかの実行結果が取得できた
+     * @retval [false] タイムアウトしたか、全てのハンドルの実行結果が見つからない
+     */
+    bool waitAny(const fjt_handle_t* handles, size_t count, uint32_t timeout_msec, size_t& which, int& result_out) {
+	auto start = _get_time();
+	bool found = false;
+	bool blocking = false;
+	completion_waiters_.fetch_add(1, std::memory_order_seq_cst);
+	while (true) {
+	    uint32_t seq = completion_seq_.load(std::memory_order_seq_cst);
+	    bool any_pending = false;
+	    for (size_t i = 0; i < count; ++i) {
+		int state = _peek_resultitem(handles[i], result_out);
+		if (state == RESULT_READY) {
+		    which = i;
+		    found = true;
+		    break;
+		}
+		if (state == RESULT_PENDING) any_pending = true;
+	    }
+	    if (found || !any_pending) break;
+	    auto elapsed = _get_time() - start;
+	    if (elapsed >= timeout_msec) break;
+	    if (!blocking) {
+		beginBlocking();
+		blocking = true;
+	    }
+	    FJFutex::wait(&completion_seq_, seq, timeout_msec - elapsed);
+	}
+	if (blocking) endBlocking();
+	completion_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	return found;
+    }
+
+    /**
+     * @brief 複数タスクの実行結果を全て待つ
+     * @param[in] handles 待受ハンドル
+     * @param[in] timeout_msec 全体の最大待ち時間(msec)
+     * @param[out] results_out タスクの返り値(handlesと同じ並び)
+     * @return waitAll(const fjt_handle_t*, size_t, uint32_t, int*)と同じ
+     */
+    bool waitAll(const std::vector<fjt_handle_t>& handles, uint32_t timeout_msec, std::vector<int>& results_out) {
+	results_out.assign(handles.size(), 0);
+	return waitAll(handles.data(), handles.size(), timeout_msec, results_out.data());
+    }
+
+    /**
+     * @brief 複数タスクのいずれかの実行結果を待つ
+     * @param[in] handles 待受ハンドル
+     * @param[in] timeout_msec 最大待ち時間(msec)
+     * @param[out] which 実行結果が取得できたハンドルの添字
+     * @param[out] result_out タスクの返り値
+     * @return waitAny(const fjt_handle_t*, size_t, uint32_t, size_t&, int&)と同じ
+     */
+    bool waitAny(const std::vector<fjt_handle_t>& handles, uint32_t timeout_msec, size_t& which, int& result_out) {
+	return waitAny(handles.data(), handles.size(), timeout_msec, which, result_out);
+    }
+
+    /**
+     * @brief スケジューラ方式の切り替え
+     * @note 動作中に切り替えてもよい。切り替え前にローカルキューへ積まれたものはそのまま処理される。
+     * @param[in] mode スケジューラ方式
+     */
+    void setSchedMode(SchedMode mode) {
+	sched_mode_.store(mode, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief スケジューラ方式の取得
+     * @return スケジューラ方式
+     */
+    SchedMode getSchedMode() const {
+	return sched_mode_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 優先度レーンの選択方式の設定
+     * @note 実行待ちキューとインスタンスのメールボックスの両方に適用される。
+     * @param[in] policy 選択方式
+     * @param[in] weights PRIO_WEIGHTEDでのレーンごとの連続処理数(FJDISPATCHLITE_PRIO_LANES個、nullptrなら変更しない)
+     */
+    void setPrioPolicy(PrioPolicy policy, const uint32_t* weights = nullptr) {
+	if (weights != nullptr) {
+	    for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+		prio_weights_[l].store(weights[l] > 0 ? weights[l] : 1, std::memory_order_relaxed);
+	    }
+	}
+	prio_policy_.store(policy, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 実行開始期限の早い順(EDF)に実行待ちを取り出すかの設定
+     * @note 有効にすると期限付きの要素は優先度レーンより先に、期限の早い順に取り出される。
+     *       無効でも期限切れの破棄・降格と統計は行う。
+     * @param[in] enable [true]:EDF順, [false]:優先度レーンのみ
+     */
+    void setEdfEnabled(bool enable) {
+	edf_enabled_.store(enable, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief ワーカーが眠る前に実行待ちを待つ最大時間の設定
+     * @note 眠ったワーカーを起こすより短い間隔で投入が続く用途で起床の遅延を減らす。
+     *       待っても来なかったワーカーは次から待つ時間を半分にし、眠ってからすぐに起こされたら最大に戻す。
+     * @param[in] usec 最大時間(usec、0なら待たずに眠る)
+     */
+    void setIdleSpin(uint32_t usec) {
+	idle_spin_usec_.store(usec, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 実行開始期限の統計の取得
+     * @param[out] stats 統計
+     */
+    void getDeadlineStats(DeadlineStats& stats) const {
+	stats.met = deadline_met_.load(std::memory_order_relaxed);
+	stats.missed = deadline_missed_.load(std::memory_order_relaxed);
+	stats.dropped = deadline_dropped_.load(std::memory_order_relaxed);
+	stats.demoted = deadline_demoted_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief インスタンスの登録を解除する
+     * @note メールボックスと管理テーブルのエントリを解放する。FJUnitFramesのデストラクタからDETACH_CANCELで自動的に呼ばれる。
+     *       DETACH_CANCELでは、メールボックスに残ったタスクと、まだ開始していないパラレル実行・遅延投入のタスクを取り消す。
+     *       どちらの方式でも、objで中断しているコルーチン(fjdispatchco.h)はこの中で破棄する。
+     *       DETACH_CANCELは実行中のタスクを止めず、完了も待たない。デストラクタからの自動解除は、
+     *       他のワーカーで実行中のobjのタスクが完了するまで待ってから戻る(自身のタスクの中でdelete thisするのはよい)。
+     *       ただし待つのは基底クラスのデストラクタなので、派生クラスのメンバに触れるタスクが並行しうるなら
+     *       派生クラスのデストラクタでDETACH_DRAINすること。
+     *       DETACH_DRAINは自身のタスクの中から呼ばないこと。解除と並行してobjに投入しないこと。
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] mode 未実行のタスクの扱い
+     * @retval [true] 登録を解除した
+     * @retval [false] 登録されていなかった(DETACH_DRAINで待つ間に他のdetach()が解除した場合を含む)
+     */
+    bool detach(FJUnitFrames* obj, DetachMode mode = DETACH_CANCEL) {
+	return _detach(obj, mode, nullptr);
+    }
+
+    /**
+     * @brief インスタンス管理の統計の取得
+     * @param[out] stats 統計
+     */
+    void getInstanceStats(InstanceStats& stats) {
+	pthread_mutex_lock(&mutex_);
+	stats.registered = instance_map_.size();
+	pthread_mutex_unlock(&mutex_);
+	stats.live = instances_live_.load(std::memory_order_relaxed);
+	stats.detached = instances_detached_.load(std::memory_order_relaxed);
+	stats.cancelled = tasks_cancelled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief キュー全体の上限を設定する
+     * @note 対象はpostQueue, postEvent, enqueueTask, post及びその一括版で受け付けてから完了するまでのタスク。
+     *       遅延投入、バリア、継続、dispatchApplyの内部タスクは数えない。
+     *       上限の確認と数え上げは分かれているので、同時に投入しているスレッド数だけ超えることがある。
+     * @param[in] limit 上限(0なら無制限)
+     * @param[in] policy 超えたときの扱い
+     */
+    void setQueueLimit(size_t limit, OverflowPolicy policy) {
+	queue_policy_.store(policy, std::memory_order_relaxed);
+	queue_limit_.store(limit, std::memory_order_relaxed);
+	_wake_producers();
+    }
+
+    /**
+     * @brief インスタンスごとの上限を設定する
+     * @note 数えるのはメールボックスに積まれている数と未完了のパラレル実行の数。
+     * @param[in] obj 対象のインスタンス(nullptrなら個別の設定がない全インスタンスの既定値)
+     * @param[in] limit 上限(0ならobjの個別の設定を外して既定値に戻す。既定値では無制限)
+     * @param[in] policy 超えたときの扱い
+     */
+    void setInstanceQueueLimit(FJUnitFrames* obj, size_t limit, OverflowPolicy policy) {
+	if (obj == nullptr) {
+	    instance_policy_.store(policy, std::memory_order_relaxed);
+	    instance_limit_.store(limit, std::memory_order_relaxed);
+	} else {
+	    InstanceInfo* info = _instance_info(obj);
+	    info->overflow_policy.store(policy, std::memory_order_relaxed);
+	    info->queue_limit.store(limit, std::memory_order_relaxed);
+	}
+	_wake_producers();
+    }
+
+    /**
+     * @brief OVERFLOW_BLOCKで投入側が空きを待つ最大時間を設定する
+     * @param[in] timeout_msec 最大待ち時間(msec、過ぎたらOVERFLOW_FAILと同じく受け付けない)
+     */
+    void setBlockTimeout(uint32_t timeout_msec) {
+	block_timeout_msec_.store(timeout_msec, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief キュー全体の未完了タスク数の高水位・低水位の通知を設定する
+     * @note highに達したらfn(true)、その後lowまで減ったらfn(false)を1回ずつ呼ぶ。
+     *       変化させたスレッド(投入側またはワーカー)から呼ぶので、fnの中で長く止まらないこと。fnから投入してもよい。
+     * @param[in] high 高水位(0なら通知しない)
+     * @param[in] low 低水位(high未満)
+     * @param[in] fn 通知先([true]:高水位に達した, [false]:低水位まで戻った)
+     */
+    void setWatermarks(size_t high, size_t low, std::function<void(bool)> fn) {
+	pthread_mutex_lock(&watermark_mutex_);
+	watermark_fn_ = std::move(fn);
+	low_watermark_.store(std::min(low, high), std::memory_order_relaxed);
+	high_watermark_.store(high, std::memory_order_relaxed);
+	pthread_mutex_unlock(&watermark_mutex_);
+    }
+
+    /**
+     * @brief 流量制御の統計の取得
+     * @param[out] stats 統計
+     */
+    void getBackpressureStats(BackpressureStats& stats) const {
+	stats.queued = queued_tasks_.load(std::memory_order_relaxed);
+	stats.rejected = tasks_rejected_.load(std::memory_order_relaxed);
+	stats.dropped = tasks_shed_.load(std::memory_order_relaxed);
+	stats.blocked = producers_blocked_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief ワーカー数の増減の統計の取得
+     * @param[out] stats 統計
+     */
+    void getScalingStats(ScalingStats& stats) {
+	pthread_mutex_lock(&mutex_);
+	stats.threads = num_of_threads_;
+	stats.peak_threads = peak_threads_;
+	stats.queue_delay_usec = scale_delay_usec_;
+	stats.utilization = scale_util_;
+	stats.blocking = blocking_workers_;
+	stats.hung = hung_workers_;
+	pthread_mutex_unlock(&mutex_);
+	stats.grown = workers_grown_.load(std::memory_order_relaxed);
+	stats.retired = workers_retired_.load(std::memory_order_relaxed);
+	stats.compensated = workers_compensated_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 呼び出し元のワーカーがこれから塞がる処理(ディスク、他の結果待ち等)に入ることを知らせる
+     * @note 実行待ちがあり眠っているワーカーがいなければ、max_threadsを超えても代わりのワーカーを足す。
+     *       足した分はendBlocking()の後、仕事がなくなった時点で自ら終了する。
+     *       ワーカースレッド以外から呼んだ場合は何もしない。入れ子にでき、最も外側だけを数える。通常はFJBlockingScopeを使う。
+     *       waitResult等の他、FJDispatchGroup::wait()とFJFutureの待ちもFJBlockingHook経由で呼ぶ。
+     */
+    static void beginBlocking() {
+	WorkerInfo* self = _tls_worker();
+	if (self != nullptr) self->owner->_begin_blocking(self);
+    }
+
+    /**
+     * @brief beginBlocking()で知らせた処理を終えたことを知らせる
+     */
+    static void endBlocking() {
+	WorkerInfo* self = _tls_worker();
+	if (self != nullptr) self->owner->_end_blocking(self);
+    }
+
+    /**
+     * @brief 開始前の同じイベントに相乗りして積まなかった累計
+     * @return 累計(FJPostAttr::withCoalesce()を指定したpostEventのみ)
+     */
+    uint64_t getCoalescedCount() const {
+	return events_coalesced_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 優先度レーンごとのキュー遅延統計の取得
+     * @param[out] stats FJDISPATCHLITE_PRIO_LANES個の統計
+     */
+    void getLaneStats(LaneStats* stats) const {
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    stats[l].count = lane_stats_[l].count.load(std::memory_order_relaxed);
+	    stats[l].total_delay_usec = lane_stats_[l].total_delay_usec.load(std::memory_order_relaxed);
+	    stats[l].max_delay_usec = lane_stats_[l].max_delay_usec.load(std::memory_order_relaxed);
+	}
+    }
+
+    /**
+     * @brief 呼び出し元・メッセージIDごとのレイテンシ統計の取得
+     * @note ワーカーごとの記録を読み出した時点で合算する。記録は止めないので、同時に実行中のタスクは一部だけ反映されることがある。
+     *       FJDISPATCHLITE_LATENCY_STATSが0なら常に空。
+     * @param[out] stats 記録のある呼び出し元ごとの統計(順不同)
+     */
+    void getLatencyStats(std::vector<LatencyStats>& stats) const {
+	stats.clear();
+#if FJDISPATCHLITE_LATENCY_STATS == 1
+	std::map<std::tuple<const char*, uint32_t, uint32_t>, size_t> index;
+	auto collect = [&](const FJLatencyTable::Entry& e) {
+	    auto it = index.emplace(std::make_tuple(e.srcfunc, e.srcline, e.msg), stats.size());
+	    if (it.second) stats.push_back(LatencyStats{e.srcfunc, e.srcline, e.msg, FJHistogram(), FJHistogram()});
+	    LatencyStats& s = stats[it.first->second];
+	    e.queue_delay.snapshot(s.queue_delay);
+	    e.exec_time.snapshot(s.exec_time);
+	};
+	size_t used = workers_used_.load(std::memory_order_acquire);
+	for (size_t i = 0; i < used; ++i) workers_[i].latency.forEach(collect);
+	latency_other_.forEach(collect);
+	stats.erase(std::remove_if(stats.begin(), stats.end(), [](const LatencyStats& s) {
+	    return s.queue_delay.count() == 0;
+	}), stats.end());
+#endif
+    }
+
+private:
+    /**
+     * @brief 実行待ちキューに積む要素
+     */
+    struct ReadyItem {
+	bool is_instance; //!< [true]:InstanceInfo, [false]:TaskNode
+	int lane; //!< 実行待ちキューの優先度レーン
+	int64_t deadline_usec; //!< EDF順で使う実行開始期限(0なら期限なし)
+    };
+
+    /**
+     * @brief 実行開始期限の遅い方を下にする比較
+     */
+    struct DeadlineLater {
+	bool operator()(const ReadyItem* a, const ReadyItem* b) const {
+	    return a->deadline_usec > b->deadline_usec;
+	}
+    };
+
+    struct InstanceInfo;
+    struct Suspension;
+    struct TaskNode;
+
+    /**
+     * @brief まとめる対象として積んだイベント
+     */
+    struct CoalesceEntry {
+	alignas(8) unsigned char mf[16]; //!< メソッド(メンバ関数ポインタのバイト列)
+	uint32_t msg; //!< メッセージID
+	fjt_handle_t handle; //!< 積んだイベントのハンドル
+	TaskNode* node; //!< 積んだイベントのノード(解放時に外すため)
+    };
+
+    /**
+     * @brief 1つのタスク
+     * @note シーケンシャル実行ではインスタンスのメールボックスに、パラレル実行では実行待ちキューに直接積まれる。
+     *       ノードはプールから確保し、呼び出し対象と小さいデータはノード内に保持する。
+     */
+    struct TaskNode : ReadyItem, FJMpscNode {
+	int (*invoke)(TaskNode*); //!< 呼び出し対象の実行
+	void (*destroy)(TaskNode*); //!< 呼び出し対象の破棄
+	alignas(16) unsigned char fn[FJDISPATCHLITE_TASK_FN_SIZE]; //!< 呼び出し対象(ラムダ等)
+	uint32_t msg; //!< メッセージID
+	char* data; //!< データ
+	uint32_t len; //!< データバイト長
+	int payload_class; //!< データの保持場所(PAYLOAD_INLINE, PAYLOAD_HEAP, またはサイズクラス番号)
+	fjt_handle_t handle; //!< 結果を登録するハンドル(0なら登録しない)
+	int64_t start_usec; //!< 投入時刻(usec)
+	int prio; //!< 優先度レーン
+	FJPostAttr::MissPolicy on_miss; //!< 実行開始期限を過ぎたときの扱い
+	int kind; //!< KIND_NORMAL, KIND_BARRIER, KIND_DEFERRED
+	uint64_t post_seq; //!< メールボックスに積んだ順番(バリアが未完了の間はこの順に取り出す)
+	FJDispatchGroup* group; //!< 所属するディスパッチグループ
+	InstanceInfo* parallel_info; //!< パラレル実行中として数えているインスタンス(完了時に減らす)
+	bool admitted; //!< キューの上限の対象として数えたか(完了時に減らす)
+	bool no_slot; //!< 結果スロットが割り当てられなかったか(受け付けない)
+	InstanceInfo* coalesce_info; //!< まとめる対象として登録しているインスタンス(解放時に外す)
+	const char* srcfunc; //!< 呼び出し関数名
+	uint32_t srcline; //!< 呼び出し行数
+	bool from_pool; //!< プールから確保したか
+	char payload[FJDISPATCHLITE_INLINE_PAYLOAD]; //!< 小さいデータの保持領域
+    };
+
+    enum {
+	KIND_NORMAL, //!< 通常のタスク
+	KIND_BARRIER, //!< バリアタスク
+	KIND_DEFERRED, //!< バリア待ちのためメールボックスを経由するパラレル実行のタスク
+    };
+
+    enum {
+	PAYLOAD_INLINE = -1, //!< ノード内
+	PAYLOAD_HEAP = -2, //!< スラブに収まらないのでnew[]
+    };
+
+    /**
+     * @brief 呼び出し対象をタスクノードに格納する
+     * @note ノード内に収まらないものはヒープに置く。
+     */
+    template <typename Fn, bool Inline = (sizeof(Fn) <= FJDISPATCHLITE_TASK_FN_SIZE && alignof(Fn) <= 16)>
+    struct CallableOps {
+	static void bind(TaskNode* node, Fn&& f) {
+	    new (node->fn) Fn(std::move(f));
+	    node->invoke = &CallableOps::invoke;
+	    node->destroy = &CallableOps::destroy;
+	}
+	static int invoke(TaskNode* node) {
+	    return (*reinterpret_cast<Fn*>(node->fn))(node);
+	}
+	static void destroy(TaskNode* node) {
+	    reinterpret_cast<Fn*>(node->fn)->~Fn();
+	}
+    };
+
+    template <typename Fn>
+    struct CallableOps<Fn, false> {
+	static void bind(TaskNode* node, Fn&& f) {
+	    *reinterpret_cast<Fn**>(node->fn) = new Fn(std::move(f));
+	    node->invoke = &CallableOps::invoke;
+	    node->destroy = &CallableOps::destroy;
+	}
+	static int invoke(TaskNode* node) {
+	    return (**reinterpret_cast<Fn**>(node->fn))(node);
+	}
+	static void destroy(TaskNode* node) {
+	    delete *reinterpret_cast<Fn**>(node->fn);
+	}
+    };
+
+    /**
+     * @brief ワーカーの動作状況
+     * @note ワーカー自身がスレッドローカルのポインタ経由で更新し、モニターはmutex_を取らずに読む。
+     */
+    struct WorkerInfo {
+        pthread_t thread;
+        std::atomic<uint64_t> last_active_ms{0}; //!< 最後にタスクを終えた時刻
+        std::atomic<uint64_t> task_start_ms{0}; //!< 実行中タスクの開始時刻
+        std::atomic<const char*> task_srcfunc{nullptr}; //!< 実行中タスクの呼び出し関数名(関数名が無ければ"(task)"、実行中でなければnullptr)
+	FJDispatchLite* owner = nullptr; //!< 所属するディスパッチャ
+	std::atomic<bool> alive{false}; //!< スレッドが動作中か
+	FJWorkDeque<ReadyItem> deque{FJDISPATCHLITE_LOCAL_QUEUE_SIZE}; //!< ローカル実行待ちキュー
+#if FJDISPATCHLITE_LATENCY_STATS == 1
+	FJLatencyTable latency; //!< このワーカーで実行したタスクのレイテンシ(書き込みはこのワーカーのみ)
+#endif
+	uint32_t spin_usec = 0; //!< 次に眠る前に待つ時間(usec、このワーカーのみが参照)
+	std::atomic<uint64_t> busy_usec{0}; //!< タスクの実行に使った時間の累計(usec、書き込みはこのワーカーのみ)
+	bool joinable = false; //!< joinしていないスレッドがあるか(mutex_)
+	std::atomic<int> blocking{0}; //!< beginBlocking()の入れ子の深さ(書き込みはこのワーカーのみ)
+    };
+
+    /**
+     * @brief 重み付きレーン選択の状態
+     */
+    struct LaneSelector {
+	int lane = C_MESSAGE_HIGH; //!< 現在のレーン
+	uint32_t left = 0; //!< 現在のレーンから続けて取り出せる残り回数
+    };
+
+    /**
+     * @brief 各FJUintFramesごとのインスタンス情報
+     * @note FJUnitFrames側にポインタをキャッシュして参照する。登録解除後は参照カウントがなくなった時点で解放する。
+     */
+    struct InstanceInfo : ReadyItem {
+	FJMpscQueue mailbox[FJDISPATCHLITE_PRIO_LANES]; //!< 優先度レーンごとのメールボックス(生産者はロックフリー、消費者はrunningを立てたワーカーのみ)
+	std::atomic<int64_t> lane_pending[FJDISPATCHLITE_PRIO_LANES]; //!< レーンごとのメールボックスに積まれているタスク数
+	std::atomic<int64_t> pending{0}; //!< メールボックスに積まれているタスク数(全レーン)
+	LaneSelector selector; //!< 重み付き選択の状態(消費者のみが参照)
+	std::atomic<int64_t> parallel_inflight{0}; //!< 未完了のパラレル実行のタスク数
+	std::atomic<int> barriers{0}; //!< 未完了のバリア数(正の間はパラレル実行をメールボックス経由にし、積んだ順に取り出す)
+	std::atomic<uint64_t> post_seq{0}; //!< メールボックスに積んだ順番の採番
+	std::atomic<bool> barrier_wait{false}; //!< パラレル実行の完了を待って止まっているか
+	TaskNode* held_barrier = nullptr; //!< 待っているバリア(消費者のみが参照)
+        std::atomic<bool> running{false}; //!< このインスタンスが実行待ちキューに積まれているか実行中か
+	std::atomic<bool> detached{false}; //!< 登録解除済み(残りのタスクは取り消す)
+	std::atomic<int> refs{1}; //!< 参照カウント(管理テーブル、running中の消費者、パラレル実行のタスク、遅延投入、DETACH_DRAIN中のdetach()が持つ)
+	std::atomic<uint32_t> drain_seq{0}; //!< DETACH_DRAINとデストラクタからの解除の待ち合わせワード(空になり得るたびに進める)
+	std::atomic<uint32_t> drain_waiters{0}; //!< drain_seqで待っているスレッド数
+	std::atomic<int> executing{0}; //!< 実行中のタスク数(シーケンシャル実行とパラレル実行)
+	std::atomic<size_t> queue_limit{0}; //!< 個別の上限(0ならディスパッチャの既定値を使う)
+	std::atomic<int> overflow_policy{OVERFLOW_BLOCK}; //!< 個別の上限を超えたときの扱い
+	pthread_mutex_t coalesce_mutex; //!< coalescedの排他
+	std::vector<CoalesceEntry> coalesced; //!< まとめる対象として積んだイベント(少数の想定なので線形に探す)
+	pthread_mutex_t suspend_mutex; //!< suspendedの排他
+	Suspension* suspended = nullptr; //!< 再開を待っているもののリスト(登録解除時に取り消す)
+	FJDispatchLite* owner = nullptr; //!< 所属するディスパッチャ
+
+	InstanceInfo() {
+	    is_instance = true;
+	    lane = C_MESSAGE_MID;
+	    deadline_usec = 0;
+	    for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) lane_pending[l].store(0, std::memory_order_relaxed);
+	    pthread_mutex_init(&coalesce_mutex, NULL);
+	    pthread_mutex_init(&suspend_mutex, NULL);
+	}
+
+	~InstanceInfo() {
+	    pthread_mutex_destroy(&coalesce_mutex);
+	    pthread_mutex_destroy(&suspend_mutex);
+	}
+    };
+
+    enum {
+	SUSPEND_WAITING, //!< 再開待ち
+	SUSPEND_CLAIMED, //!< 再開する側が取った
+	SUSPEND_CANCELLED, //!< 登録解除で取り消した
+    };
+
+    /**
+     * @brief インスタンスで中断している処理の再開待ち(コルーチン等)
+     * @note インスタンス情報のリストと再開する側が参照を持つ。
+     *       再開する側の_claim_suspension()と登録解除の_cancel_suspensions()のうち、先に状態を変えた方だけが続きを扱う。
+     */
+    struct Suspension {
+	void (*run)(void* ctx); //!< 再開(インスタンスのシーケンシャル実行として呼ぶ)
+	void (*discard)(void* ctx); //!< 再開できなくなったときの破棄
+	void* ctx; //!< run, discardに渡す引数
+	InstanceInfo* info; //!< 再開先のインスタンス情報(参照を持つ)
+	std::atomic<int> state{SUSPEND_WAITING}; //!< SUSPEND_WAITING, SUSPEND_CLAIMED, SUSPEND_CANCELLED
+	std::atomic<int> refs{2}; //!< 参照カウント(リストと再開する側)
+	bool linked = true; //!< リストにつながっているか(info->suspend_mutex)
+	Suspension* prev = nullptr; //!< リストの前(info->suspend_mutex)
+	Suspension* next = nullptr; //!< リストの次(info->suspend_mutex)
+    };
+
+    /**
+     * @brief 遅延投入
+     */
+    struct DelayedItem {
+	int64_t when_usec; //!< 実行待ちに移す時刻
+	uint64_t seq; //!< 同時刻のときの投入順
+	InstanceInfo* info; //!< インスタンス情報
+	TaskNode* node; //!< タスク
+	bool isseq; //!< シーケンシャル実行か
+
+	bool operator>(const DelayedItem& other) const {
+	    return when_usec != other.when_usec ? when_usec > other.when_usec : seq > other.seq;
+	}
+    };
+    
+    /**
+     * @brief コンストラクタ
+     * @param[in] config ワーカープールの設定
+     * @param[in] name キュー名
+     * @param[in] qos QoSクラス
+     */
+    FJDispatchLite(const Config& config, const std::string& name, QoS qos) : stop_(false), config_(_normalize_config(config)),
+		       name_(name), qos_(qos),
+		       num_of_threads_(config_.initial_threads),
+		       sched_mode_(config_.sched_mode),
+		       idle_spin_usec_(config_.idle_spin_usec),
+		       task_pool_(sizeof(TaskNode), FJDISPATCHLITE_TASK_POOL_CHUNK) {
+	size_t size = FJDISPATCHLITE_PAYLOAD_CLASS_MIN;
+	for (int c = 0; c < FJDISPATCHLITE_PAYLOAD_CLASSES; ++c, size <<= 2) {
+	    payload_pools_[c].reset(new FJSlabPool(size, FJDISPATCHLITE_PAYLOAD_CHUNK_BYTES / size, 0));
+	}
+        pthread_mutex_init(&mutex_, NULL);
+	pthread_mutexattr_t mattr;
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&watermark_mutex_, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+	pthread_mutex_init(&result_watch_mutex_, NULL);
+	// 遅延投入の時刻待ちに使うのでCLOCK_MONOTONICにする
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cv_, &cattr);
+	pthread_condattr_destroy(&cattr);
+	prio_weights_[C_MESSAGE_HIGH].store(FJDISPATCHLITE_PRIO_WEIGHT_HIGH, std::memory_order_relaxed);
+	prio_weights_[C_MESSAGE_MID].store(FJDISPATCHLITE_PRIO_WEIGHT_MID, std::memory_order_relaxed);
+	prio_weights_[C_MESSAGE_LOW].store(FJDISPATCHLITE_PRIO_WEIGHT_LOW, std::memory_order_relaxed);
+	result_mask_ = config_.max_results - 1;
+	results_.reset(new ResultItem[config_.max_results]);
+	for (size_t i = 0; i < config_.max_results; ++i) {
+	    results_[i].word.store(RESULT_FREE, std::memory_order_relaxed);
+	    results_[i].value.store(0, std::memory_order_relaxed);
+	    results_[i].seq.store(0, std::memory_order_relaxed);
+	    results_[i].waiters.store(0, std::memory_order_relaxed);
+	}
+	workers_.reset(new WorkerInfo[_slot_count()]);
+	scale_eval_usec_.store(_get_time_usec(), std::memory_order_relaxed);
+	pthread_mutex_lock(&mutex_);
+        for (size_t i = 0; i < num_of_threads_; ++i) _spawn_worker();
+	peak_threads_ = num_of_threads_;
+	pthread_mutex_unlock(&mutex_);
+        pthread_create(&monitor_thread_, NULL, &FJDispatchLite::monitorFunc, this);
+	pthread_mutex_lock(_live_mutex());
+	// 動作中の他のキューが使っていない最小のキャッシュ要素を割り当てる
+	for (int slot = 0; slot < FJUNITFRAMES_QUEUE_CACHE && cache_slot_ < 0; ++slot) {
+	    bool used = false;
+	    for (FJDispatchLite* queue : _live_queues()) used = used || (queue->cache_slot_ == slot);
+	    if (!used) cache_slot_ = slot;
+	}
+	_live_queues().push_back(this);
+	FJUnitFrames::_detach_hook().store(&FJDispatchLite::_detach_all);
+	FJBlockingHook::set(&FJDispatchLite::beginBlocking, &FJDispatchLite::endBlocking);
+	pthread_mutex_unlock(_live_mutex());
+    }
+
+    /**
+     * @brief Configure()で与えられた設定
+     */
+    static Config& _pending_config() {
+	static Config config;
+	return config;
+    }
+
+    /**
+     * @brief メインプール生成時に設定を確定する
+     * @return 設定
+     */
+    static Config _take_config() {
+	_instance_created().store(true, std::memory_order_release);
+	return _pending_config();
+    }
+
+    /**
+     * @brief std::stringで渡された呼び出し関数名を静的な寿命の文字列にする
+     * @note モニターとレイテンシ統計はポインタを保持するので、複製を解放せずに持ち続ける。
+     * @param[in] srcfunc 呼び出し関数名
+     * @return 複製した文字列(同じ名前なら同じポインタ)
+     */
+    static const char* _intern_srcfunc(const std::string& srcfunc) {
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	// プロセス終了処理の後半でも使えるよう解放しない(要素のアドレスは挿入後も変わらない)
+	static std::unordered_set<std::string>* names = new std::unordered_set<std::string>();
+	pthread_mutex_lock(&mutex);
+	const char* name = names->insert(srcfunc).first->c_str();
+	pthread_mutex_unlock(&mutex);
+	return name;
+    }
+
+    /**
+     * @brief 名前付きキューの登録テーブル
+     */
+    static std::unordered_map<std::string, std::unique_ptr<FJDispatchLite>>& _queue_registry() {
+	static std::unordered_map<std::string, std::unique_ptr<FJDispatchLite>> registry;
+	return registry;
+    }
+
+    /**
+     * @brief 動作中の全キュー(メインプールを含む)
+     * @note FJUnitFramesのデストラクタがプロセス終了処理の後半で呼ばれても使えるよう、解放しない。
+     */
+    static std::vector<FJDispatchLite*>& _live_queues() {
+	static std::vector<FJDispatchLite*>* queues = new std::vector<FJDispatchLite*>();
+	return *queues;
+    }
+
+    /**
+     * @brief 動作中の全キューの排他
+     * @note 登録解除中に取り消したタスクの後始末から別のFJUnitFramesが破棄されうるので再帰可能にする。
+     */
+    static pthread_mutex_t* _live_mutex() {
+	static pthread_mutex_t mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+	return &mutex;
+    }
+
+    /**
+     * @brief 全キューからインスタンスの登録を解除する(FJUnitFramesのデストラクタから呼ばれる)
+     * @param[in] obj FJUnitFramesのポインタ
+     */
+    static void _detach_all(FJUnitFrames* obj) {
+	std::vector<std::pair<FJDispatchLite*, InstanceInfo*>> detached;
+	pthread_mutex_lock(_live_mutex());
+	// 解除中にキューが追加されうるので添字で回す
+	for (size_t i = 0; i < _live_queues().size() && obj->dispatch_queues_.load() > 0; ++i) {
+	    FJDispatchLite* queue = _live_queues()[i];
+	    InstanceInfo* info = nullptr;
+	    if (queue->_detach(obj, DETACH_CANCEL, &info)) detached.emplace_back(queue, info);
+	}
+	pthread_mutex_unlock(_live_mutex());
+	// 他のワーカーで実行中のタスクの完了を待つ(そのタスクが他のFJUnitFramesを破棄できるよう排他の外で)
+	for (auto& d : detached) {
+	    d.first->_wait_idle(d.second);
+	    d.first->_instance_release(d.second);
+	}
+    }
+
+    /**
+     * @brief 名前付きキューの登録テーブルの排他
+     */
+    static pthread_mutex_t* _queue_mutex() {
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	return &mutex;
+    }
+
+    /**
+     * @brief QoSクラスに対応するnice値
+     */
+    static int _qos_nice(QoS qos) {
+	static const int table[] = { -10, -5, 0, 5, 10 };
+	return table[qos];
+    }
+
+    /**
+     * @brief インスタンス生成済みフラグ
+     */
+    static std::atomic<bool>& _instance_created() {
+	static std::atomic<bool> created{false};
+	return created;
+    }
+
+    /**
+     * @brief 設定値の補正
+     * @param[in] config 設定
+     * @return min <= initial <= max に補正した設定
+     */
+    static Config _normalize_config(const Config& config) {
+	Config c = config;
+	if (c.max_threads == 0) {
+	    long n = sysconf(_SC_NPROCESSORS_ONLN);
+	    c.max_threads = n > 0 ? static_cast<size_t>(n) : FJDISPATCHLITE_MAX_THREADS;
+	}
+	if (c.min_threads < 1) c.min_threads = 1;
+	if (c.max_threads < c.min_threads) c.max_threads = c.min_threads;
+	c.initial_threads = std::min(std::max(c.initial_threads, c.min_threads), c.max_threads);
+	// CPUが1つなら待っている間は投入側が動けないので眠る
+	if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) c.idle_spin_usec = 0;
+	// スロット番号はハンドルの下位ビットなので2のべき乗にする
+	size_t results = 2;
+	while (results < c.max_results) results <<= 1;
+	c.max_results = results;
+	return c;
+    }
+
+    /**
+     * @brief インスタンス情報の取得
+     * @note 初回のみmutex_で登録し、以降はFJUnitFramesのキャッシュのうちこのキューの要素を参照する。
+     *       キャッシュの要素を割り当てられなかったキューは毎回mutex_で管理テーブルを引く。
+     * @param[in] obj FJUnitFramesのポインタ
+     * @return インスタンス情報
+     */
+    InstanceInfo* _instance_info(FJUnitFrames* obj) {
+	InstanceInfo* info = nullptr;
+	if (cache_slot_ >= 0) {
+	    info = static_cast<InstanceInfo*>(obj->dispatch_info_[cache_slot_].load(std::memory_order_acquire));
+	    if (info != nullptr) return info;
+	}
+
+	pthread_mutex_lock(&mutex_);
+	auto& slot = instance_map_[obj];
+	if (slot == nullptr) {
+	    slot = new InstanceInfo();
+	    slot->owner = this;
+	    instances_live_.fetch_add(1, std::memory_order_relaxed);
+	    obj->dispatch_queues_.fetch_add(1, std::memory_order_relaxed);
+	}
+	info = slot;
+	if (cache_slot_ >= 0) {
+	    void* expected = nullptr;
+	    obj->dispatch_info_[cache_slot_].compare_exchange_strong(expected, info, std::memory_order_acq_rel);
+	}
+	pthread_mutex_unlock(&mutex_);
+	return info;
+    }
+
+    /**
+     * @brief タスクノードの確保
+     * @param[in] msg メッセージID
+     * @param[in] srcfunc 呼び出し関数名
+     * @param[in] srcline 呼び出し行数
+     * @param[in] attr 投入属性
+     * @return タスクノード
+     */
+    TaskNode* _new_task_node(uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr) {
+	void* mem = task_pool_.alloc();
+	TaskNode* node = new (mem != nullptr ? mem : ::operator new(sizeof(TaskNode))) TaskNode;
+	node->from_pool = (mem != nullptr);
+	node->is_instance = false;
+	node->invoke = nullptr;
+	node->destroy = nullptr;
+	node->msg = msg;
+	node->data = nullptr;
+	node->len = 0;
+	node->payload_class = PAYLOAD_INLINE;
+	node->handle = 0;
+	node->start_usec = _get_time_usec();
+	node->prio = std::min(std::max(attr.prio, static_cast<int>(C_MESSAGE_HIGH)), FJDISPATCHLITE_PRIO_LANES - 1);
+	node->lane = node->prio;
+	node->deadline_usec = attr.deadline_usec;
+	node->on_miss = attr.on_miss;
+	node->kind = KIND_NORMAL;
+	node->parallel_info = nullptr;
+	node->admitted = false;
+	node->no_slot = false;
+	node->coalesce_info = nullptr;
+	node->group = attr.group;
+	if (node->group != nullptr) node->group->enter();
+	node->srcfunc = srcfunc;
+	node->srcline = srcline;
+	return node;
+    }
+
+    /**
+     * @brief データをタスクノードにコピーする
+     * @note 小さいデータはノード内、大きいデータはサイズクラスごとのスラブに置く。
+     * @param[in] node タスクノード
+     * @param[in] buf データ
+     * @param[in] len データバイト長
+     */
+    void _alloc_payload(TaskNode* node, const void* buf, uint32_t len) {
+	node->len = len;
+	if (len <= FJDISPATCHLITE_INLINE_PAYLOAD) {
+	    node->data = node->payload;
+	    node->payload_class = PAYLOAD_INLINE;
+	} else {
+	    node->data = nullptr;
+	    size_t size = FJDISPATCHLITE_PAYLOAD_CLASS_MIN;
+	    for (int c = 0; c < FJDISPATCHLITE_PAYLOAD_CLASSES; ++c, size <<= 2) {
+		if (len > size) continue;
+		node->data = static_cast<char*>(payload_pools_[c]->alloc());
+		node->payload_class = c;
+		break;
+	    }
+	    if (node->data == nullptr) {
+		node->data = new char[len];
+		node->payload_class = PAYLOAD_HEAP;
+	    }
+	}
+	if (len > 0) std::memcpy(node->data, buf, len);
+    }
+
+    /**
+     * @brief 呼び出し対象をタスクノードに格納する
+     * @param[in] node タスクノード
+     * @param[in] f int(TaskNode*)の呼び出し対象
+     */
+    template <typename F>
+    static void _bind_callable(TaskNode* node, F&& f) {
+	typedef typename std::decay<F>::type Fn;
+	CallableOps<Fn>::bind(node, Fn(std::forward<F>(f)));
+    }
+
+    /**
+     * @brief タスクノードの解放
+     * @param[in] node タスクノード
+     */
+    void _free_task_node(TaskNode* node) {
+	if (node->coalesce_info != nullptr) _coalesce_remove(node);
+	InstanceInfo* parallel_info = node->parallel_info;
+	FJDispatchGroup* group = node->group;
+	bool admitted = node->admitted;
+	if (node->destroy) node->destroy(node);
+	if (node->payload_class == PAYLOAD_HEAP) {
+	    delete[] node->data;
+	} else if (node->payload_class >= 0) {
+	    payload_pools_[node->payload_class]->free(node->data);
+	}
+	bool from_pool = node->from_pool;
+	node->~TaskNode();
+	if (from_pool) {
+	    task_pool_.free(node);
+	} else {
+	    ::operator delete(node);
+	}
+	// 結果の登録後に完了を知らせる
+	if (parallel_info != nullptr) {
+	    if (_parallel_done(parallel_info)) _resume_barrier(parallel_info);
+	    _instance_release(parallel_info);
+	}
+	if (admitted) _release_admission();
+	if (group != nullptr) group->leave();
+    }
+
+    /**
+     * @brief タスクノードに結果スロットを割り当てる
+     * @note 割り当てられなかったノードは_admit()で受け付けずに解放する。
+     * @param[in,out] node タスクノード
+     */
+    void _assign_resultitem(TaskNode* node)
+    {
+	node->handle = _new_resultitem();
+	node->no_slot = (node->handle == 0);
+    }
+
+    /**
+     * @brief postQueue用のタスクノードを作る
+     * @note ノードをプールから確保してbufをコピーし、結果スロットを割り当てる。
+     * @return タスクノード
+     */
+    template <typename T>
+    TaskNode* _queue_node(T* obj, int (T::*mf)(uint32_t, void*, uint32_t), uint32_t msg, const void* buf, uint32_t len, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr) {
+	TaskNode* node = _new_task_node(msg, srcfunc, srcline, attr);
+	_alloc_payload(node, buf, len);
+	_bind_callable(node, [obj, mf](TaskNode* n) {
+	    return (obj->*mf)(n->msg, n->data, n->len);
+	});
+	_assign_resultitem(node);
+	return node;
+    }
+
+    /**
+     * @brief postEvent用のタスクノードを作る
+     * @return タスクノード
+     */
+    template <typename T>
+    TaskNode* _event_node(T* obj, int (T::*mf)(uint32_t), uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr) {
+	TaskNode* node = _new_task_node(msg, srcfunc, srcline, attr);
+	_bind_callable(node, [obj, mf](TaskNode* n) {
+	    return (obj->*mf)(n->msg);
+	});
+	_assign_resultitem(node);
+	return node;
+    }
+
+    /**
+     * @brief まとめるpostEvent用のタスクノードを作る
+     * @note 同じ(メソッド, メッセージID)のイベントが開始前ならノードを作らずにそのハンドルを返す。
+     *       開始前かどうかは結果スロットで判断するので、実行開始・取り消し・破棄の後は新たに積む。
+     *       結果スロットの確保は待つことがあるので、ノードはcoalesce_mutexの外で作って入れる前に一覧を見直す。
+     * @param[out] handle 相乗りしたハンドル(nullptrを返したとき)
+     * @return 積むタスクノード、相乗りしたならnullptr
+     */
+    template <typename T>
+    TaskNode* _coalesce_event(T* obj, int (T::*mf)(uint32_t), uint32_t msg, const char* srcfunc, uint32_t srcline, const FJPostAttr& attr, fjt_handle_t& handle) {
+	static_assert(sizeof(mf) <= sizeof(CoalesceEntry::mf), "member function pointer too large");
+	InstanceInfo* info = _instance_info(static_cast<FJUnitFrames*>(obj));
+	CoalesceEntry key;
+	memset(key.mf, 0, sizeof(key.mf));
+	memcpy(key.mf, &mf, sizeof(mf));
+	key.msg = msg;
+	pthread_mutex_lock(&info->coalesce_mutex);
+	handle = _coalesce_pending(info, key);
+	pthread_mutex_unlock(&info->coalesce_mutex);
+	if (handle != 0) {
+	    events_coalesced_.fetch_add(1, std::memory_order_relaxed);
+	    return nullptr;
+	}
+	// グループには積むと決まってから入る(余ったノードの解放でグループの完了を知らせない)
+	FJPostAttr nogroup = attr;
+	nogroup.group = nullptr;
+	TaskNode* node = _event_node(obj, mf, msg, srcfunc, srcline, nogroup);
+	pthread_mutex_lock(&info->coalesce_mutex);
+	// 作っている間に同じイベントが積まれていたらそちらに相乗りする
+	handle = _coalesce_pending(info, key);
+	if (handle == 0) {
+	    key.handle = node->handle;
+	    key.node = node;
+	    node->coalesce_info = info;
+	    info->coalesced.push_back(key);
+	}
+	pthread_mutex_unlock(&info->coalesce_mutex);
+	if (handle != 0) {
+	    _discard_resultitem(node->handle);
+	    _free_task_node(node);
+	    events_coalesced_.fetch_add(1, std::memory_order_relaxed);
+	    return nullptr;
+	}
+	node->group = attr.group;
+	if (node->group != nullptr) node->group->enter();
+	return node;
+    }
+
+    /**
+     * @brief 開始前の同じイベントを探す
+     * @note info->coalesce_mutexを取って呼ぶこと。
+     * @param[in] info インスタンス情報
+     * @param[in] key 探す(メソッド, メッセージID)
+     * @return 開始前のイベントのハンドル、なければ0
+     */
+    fjt_handle_t _coalesce_pending(InstanceInfo* info, const CoalesceEntry& key) {
+	for (const CoalesceEntry& e : info->coalesced) {
+	    if (e.msg != key.msg || memcmp(e.mf, key.mf, sizeof(key.mf)) != 0) continue;
+	    ResultItem& item = results_[e.handle & result_mask_];
+	    if (item.word.load(std::memory_order_acquire) == ((e.handle << 2) | RESULT_PENDING)) return e.handle;
+	}
+	return 0;
+    }
+
+    /**
+     * @brief 解放するノードをまとめる対象から外す
+     * @param[in] node タスクノード
+     */
+    static void _coalesce_remove(TaskNode* node) {
+	InstanceInfo* info = node->coalesce_info;
+	pthread_mutex_lock(&info->coalesce_mutex);
+	for (size_t i = 0; i < info->coalesced.size(); ++i) {
+	    if (info->coalesced[i].node != node) continue;
+	    info->coalesced[i] = info->coalesced.back();
+	    info->coalesced.pop_back();
+	    break;
+	}
+	pthread_mutex_unlock(&info->coalesce_mutex);
+    }
+
+    /**
+     * @brief タスクの実行
+     * @note 実行後に結果を登録し、ノードを解放する。
+     * @param[in] node タスクノード
+     * @param[in] info シーケンシャル実行ならそのインスタンス情報(パラレル実行ならnode->parallel_infoを使う)
+     */
+    void _execute(TaskNode* node, InstanceInfo* info = nullptr) {
+	if (!_claim_resultitem(node->handle)) {
+	    // cancel()済み
+	    _free_task_node(node);
+	    return;
+	}
+	int64_t now_usec = _get_time_usec();
+	_record_lane_delay(node->prio, now_usec - node->start_usec);
+	auto delay = static_cast<uint64_t>(now_usec / 1000);
+	WorkerInfo* self = _tls_worker();
+	if (self != nullptr) {
+	    // 開始時刻を先に書くので、モニターが関数名と古い時刻の組を見て誤検出することはない
+	    // 関数名の無いタスクも固まり検出・補充の対象にするため仮の名前を入れる
+	    self->task_start_ms.store(delay, std::memory_order_relaxed);
+	    self->task_srcfunc.store(node->srcfunc != nullptr ? node->srcfunc : "(task)", std::memory_order_release);
+	}
+#if FJDISPATCHLITE_PROFILE_DBG == 1
+	auto elapsed1 = (now_usec - node->start_usec) / 1000;
+	if (elapsed1 > FJDISPATCHLITE_PROFILE_TOO_DELAY_MSEC) {
+	    std::cerr << COLOR_RED << "[" << delay << "]:" << node->srcfunc << "(" << node->srcline << "): *WARNING* function execution is DELAYED. " << elapsed1 << " msec." << COLOR_RESET << std::endl;
+	}
+#endif
+	// デストラクタからの解除が待てるよう実行中として数える(ノードの解放前に戻す)
+	if (info == nullptr) info = node->parallel_info;
+	InstanceInfo* outer = _tls_instance();
+	if (info != nullptr) {
+	    info->executing.fetch_add(1, std::memory_order_seq_cst);
+	    _tls_instance() = info;
+	}
+	int ret = node->invoke(node);
+	if (info != nullptr) {
+	    _tls_instance() = outer;
+	    info->executing.fetch_sub(1, std::memory_order_seq_cst);
+	    _notify_drained(info);
+	}
+	int64_t end_usec = _get_time_usec();
+	bool own = self != nullptr && self->owner == this;
+	if (self != nullptr) self->task_srcfunc.store(nullptr, std::memory_order_relaxed);
+	if (own) {
+	    // 書き込みはこのワーカーのみなので読んで足して書く(終了時刻は最後にタスクを終えた時刻にも使う)
+	    uint64_t busy = self->busy_usec.load(std::memory_order_relaxed);
+	    self->busy_usec.store(busy + static_cast<uint64_t>(std::max<int64_t>(end_usec - now_usec, 0)), std::memory_order_relaxed);
+	    self->last_active_ms.store(static_cast<uint64_t>(end_usec / 1000), std::memory_order_relaxed);
+	}
+#if FJDISPATCHLITE_LATENCY_STATS == 1
+	{
+	    uint64_t queue_delay = static_cast<uint64_t>(std::max<int64_t>(now_usec - node->start_usec, 0));
+	    uint64_t exec_time = static_cast<uint64_t>(std::max<int64_t>(end_usec - now_usec, 0));
+	    // ワーカーごとの表は書き込みが競合しないので不可分な読み書きを使わない
+	    if (own) {
+		self->latency.recordLocal(node->srcfunc, node->srcline, node->msg, queue_delay, exec_time);
+	    } else {
+		latency_other_.record(node->srcfunc, node->srcline, node->msg, queue_delay, exec_time);
+	    }
+	}
+#endif
+#if FJDISPATCHLITE_PROFILE_DBG == 1
+	auto now = _get_time();
+	auto elapsed2 = now - node->start_usec / 1000;
+	if (elapsed2 > FJDISPATCHLITE_PROFILE_TOO_EXEC_MSEC) {
+	    std::cerr << COLOR_RED << "[" << now << "]" << node->srcfunc << "(" << node->srcline << "): *WARNING* function execution time is TOO LONG. " << elapsed2 << " msec." << COLOR_RESET << std::endl;
+	}
+#endif
+	// 結果の登録
+	if (node->handle != 0) _post_resultitem(node->handle, ret);
+	_free_task_node(node);
+    }
+
+    /**
+     * @brief post用のタスクノードを作る
+     * @param[in] fn 呼び出し対象
+     * @param[in] attr 投入属性
+     * @param[out] state 結果の共有状態
+     * @return タスクノード
+     */
+    template <typename F, typename R>
+    TaskNode* _future_node(F&& fn, const FJPostAttr& attr, FJFutureState<R>*& state) {
+	typedef typename std::decay<F>::type Fn;
+	state = new FJFutureState<R>(&FJDispatchLite::_schedule_continuation, this);
+	TaskNode* node = _new_task_node(0, nullptr, 0, attr);
+	_bind_callable(node, FJFutureTask<R, Fn>(state, Fn(std::forward<F>(fn))));
+	return node;
+    }
+
+    /**
+     * @brief dispatchApplyの共有状態
+     * @note 呼び出し元と手伝うタスクが参照を持ち、最後に手放した側が破棄する。
+     *       手伝うタスクが遅れて開始しても、取れる範囲がなければbodyに触れずに終わる。
+     */
+    struct ApplyState {
+	typedef void (*Body)(void* ctx, size_t b, size_t e);
+
+	ApplyState(size_t b, size_t e, Body f, void* c)
+	    : begin(b), end(e), count(e - b), body(f), ctx(c), next(b), chunk(1) {}
+
+	size_t begin; //!< 範囲の先頭
+	size_t end; //!< 範囲の末尾
+	size_t count; //!< 要素数
+	Body body; //!< 処理
+	void* ctx; //!< 処理に渡す引数(呼び出し元の関数オブジェクト)
+	std::atomic<size_t> next; //!< 次に取る位置
+	std::atomic<size_t> chunk; //!< 直近の実測で決めたチャンクの大きさ
+	std::atomic<size_t> finished{0}; //!< 処理し終えた要素数
+	std::atomic<size_t> participants{1}; //!< 参加者数(呼び出し元を含む)
+	std::atomic<uint32_t> done{0}; //!< 全要素を処理し終えたら1になるfutexワード
+	std::atomic<uint32_t> waiting{0}; //!< 完了を待っているか
+	std::atomic<int> refs{1}; //!< 参照カウント
+    };
+
+    /**
+     * @brief チャンクを1つ取って実行し、次のチャンクの大きさを決める
+     * @param[in] state 共有状態
+     * @param[in] chunk 取る要素数
+     * @retval [true] 実行した
+     * @retval [false] 取れる範囲がなかった
+     */
+    static bool _apply_chunk(ApplyState* state, size_t chunk) {
+	size_t b = state->next.fetch_add(chunk, std::memory_order_relaxed);
+	if (b >= state->end) return false;
+	size_t e = std::min(b + chunk, state->end);
+	int64_t t0 = _get_time_usec();
+	state->body(state->ctx, b, e);
+	int64_t elapsed = _get_time_usec() - t0;
+	// 実測から目標時間に収まる大きさを求め、参加者ごとに数チャンクは残るよう抑える
+	size_t n = e - b;
+	size_t next_chunk = (elapsed <= 0) ? n * 2 : static_cast<size_t>(FJDISPATCHLITE_APPLY_CHUNK_USEC * static_cast<int64_t>(n) / elapsed);
+	size_t cap = state->count / (state->participants.load(std::memory_order_relaxed) * FJDISPATCHLITE_APPLY_SPLIT);
+	next_chunk = std::max<size_t>(1, std::min(next_chunk, std::max<size_t>(1, cap)));
+	state->chunk.store(next_chunk, std::memory_order_relaxed);
+	if (state->finished.fetch_add(n, std::memory_order_seq_cst) + n == state->count) {
+	    state->done.store(1, std::memory_order_seq_cst);
+	    if (state->waiting.load(std::memory_order_seq_cst) > 0) FJFutex::wake(&state->done);
+	}
+	return true;
+    }
+
+    /**
+     * @brief 取れる範囲がなくなるまでチャンクを実行する
+     * @param[in] state 共有状態
+     */
+    static void _apply_run(ApplyState* state) {
+	while (_apply_chunk(state, state->chunk.load(std::memory_order_relaxed))) {}
+    }
+
+    /**
+     * @brief dispatchApplyの共有状態の参照を手放す
+     * @param[in] state 共有状態
+     */
+    static void _apply_release(ApplyState* state) {
+	if (state->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete state;
+    }
+
+    /**
+     * @brief 完了後に登録された継続を実行待ちキューに積む
+     * @note インスタンスに属さないパラレル実行として積む。
+     * @param[in] ctx ディスパッチャ
+     * @param[in] fn 継続
+     */
+    static void _schedule_continuation(void* ctx, std::function<void()>&& fn) {
+	FJDispatchLite* self = static_cast<FJDispatchLite*>(ctx);
+	TaskNode* node = self->_new_task_node(0, nullptr, 0, FJPostAttr());
+	_bind_callable(node, [f = std::move(fn)](TaskNode*) {
+	    f();
+	    return 0;
+	});
+	self->_push_ready(node);
+    }
+
+    /**
+     * @brief タスクを投入する
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] item タスク(所有権を移す)
+     * @param[in] isseq [true]:メールボックス経由でシーケンシャル実行, [false]:直接実行待ちキューへ
+     */
+    void _submit(FJUnitFrames* obj, TaskNode* item, bool isseq) {
+	ReadyItem* ready = _enqueue(obj, item, isseq);
+	if (ready != nullptr) _push_ready(ready);
+    }
+
+    /**
+     * @brief タスクをメールボックスに積み、実行待ちキューに積むべき要素を返す
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] item タスク(所有権を移す)
+     * @param[in] isseq [true]:メールボックス経由でシーケンシャル実行, [false]:直接実行待ちキューへ
+     * @param[in,out] ready 一括投入でまだ実行待ちキューに積んでいない要素(なければnullptr、_admit()参照)
+     * @param[in,out] nready readyの要素数
+     * @return 実行待ちキューに積む要素(インスタンスまたはタスク)、既に実行待ちか受け付けなかったならnullptr
+     */
+    ReadyItem* _enqueue(FJUnitFrames* obj, TaskNode* item, bool isseq, ReadyItem** ready = nullptr, size_t* nready = nullptr) {
+	InstanceInfo* info = _instance_info(obj);
+	if (!_admit(info, item, ready, nready)) return nullptr;
+	if (!isseq) {
+	    bool resume = false;
+	    ReadyItem* ready = _enqueue_parallel(info, item, resume);
+	    if (resume) _resume_barrier(info);
+	    return ready;
+	}
+	return _enqueue_mailbox(info, item);
+    }
+
+    /**
+     * @brief キューの上限による受け付けの判定
+     * @note 受け付けたら数え、受け付けなければ結果にFJDISPATCHLITE_RESULT_REJECTEDを登録してノードを解放する。
+     *       一括投入で先に受け付けた要素は、待つ前に実行待ちキューへ積む(積まないとワーカーが消化できず空きが出ない)。
+     * @param[in] info 投入先のインスタンス情報
+     * @param[in] item タスク
+     * @param[in,out] ready 一括投入でまだ実行待ちキューに積んでいない要素(なければnullptr)
+     * @param[in,out] nready readyの要素数(積んだら0にする)
+     * @retval [true] 受け付けた
+     * @retval [false] 受け付けなかった(ノードの所有権は手放した)
+     */
+    bool _admit(InstanceInfo* info, TaskNode* item, ReadyItem** ready = nullptr, size_t* nready = nullptr) {
+	// 結果スロットが足りなかったもの(受け付けなかった数には_new_resultitem()で加えた)
+	if (item->no_slot) {
+	    _free_task_node(item);
+	    return false;
+	}
+	size_t glimit = queue_limit_.load(std::memory_order_relaxed);
+	size_t ilimit = info->queue_limit.load(std::memory_order_relaxed);
+	int ipolicy = info->overflow_policy.load(std::memory_order_relaxed);
+	if (ilimit == 0) {
+	    ilimit = instance_limit_.load(std::memory_order_relaxed);
+	    ipolicy = instance_policy_.load(std::memory_order_relaxed);
+	}
+	if (glimit != 0 || ilimit != 0) {
+	    bool waiting = false;
+	    int64_t start = 0;
+	    while (true) {
+		uint32_t seq = admit_seq_.load(std::memory_order_seq_cst);
+		bool over_g = glimit != 0 && queued_tasks_.load(std::memory_order_seq_cst) >= static_cast<int64_t>(glimit);
+		bool over_i = ilimit != 0 && _instance_queued(info) >= static_cast<int64_t>(ilimit);
+		if (!over_g && !over_i) break;
+		int gpolicy = queue_policy_.load(std::memory_order_relaxed);
+		// 両方超えていたら受け付けない側、待たせる側の順に優先する
+		int policy = over_g ? gpolicy : ipolicy;
+		if (over_g && over_i && gpolicy != ipolicy) {
+		    policy = (gpolicy == OVERFLOW_FAIL || ipolicy == OVERFLOW_FAIL) ? OVERFLOW_FAIL : OVERFLOW_BLOCK;
+		}
+		if (policy == OVERFLOW_DROP_OLDEST) break;
+		if (policy == OVERFLOW_BLOCK && _is_own_worker()) break;
+		if (policy == OVERFLOW_BLOCK) {
+		    if (!waiting) {
+			waiting = true;
+			start = _get_time();
+			producers_blocked_.fetch_add(1, std::memory_order_relaxed);
+			admit_waiters_.fetch_add(1, std::memory_order_seq_cst);
+			if (nready != nullptr && *nready > 0) {
+			    _push_ready_batch(ready, *nready);
+			    *nready = 0;
+			}
+			continue;
+		    }
+		    int64_t elapsed = _get_time() - start;
+		    uint32_t timeout = block_timeout_msec_.load(std::memory_order_relaxed);
+		    if (elapsed < static_cast<int64_t>(timeout)) {
+			// タスクの完了でseqが進むまで眠る
+			FJFutex::wait(&admit_seq_, seq, static_cast<uint32_t>(timeout - elapsed));
+			continue;
+		    }
+		}
+		if (waiting) admit_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+		tasks_rejected_.fetch_add(1, std::memory_order_relaxed);
+		if (item->handle != 0 && _claim_resultitem(item->handle)) _post_resultitem(item->handle, FJDISPATCHLITE_RESULT_REJECTED);
+		_free_task_node(item);
+		return false;
+	    }
+	    if (waiting) admit_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	}
+	item->admitted = true;
+	int64_t queued = queued_tasks_.fetch_add(1, std::memory_order_seq_cst) + 1;
+	size_t high = high_watermark_.load(std::memory_order_relaxed);
+	if (high != 0 && queued >= static_cast<int64_t>(high) && !above_high_.exchange(true, std::memory_order_seq_cst)) {
+	    _notify_watermark();
+	}
+	return true;
+    }
+
+    /**
+     * @brief 受け付けたタスクの完了を数える
+     */
+    void _release_admission() {
+	int64_t queued = queued_tasks_.fetch_sub(1, std::memory_order_seq_cst) - 1;
+	if (above_high_.load(std::memory_order_relaxed) &&
+	    queued <= static_cast<int64_t>(low_watermark_.load(std::memory_order_relaxed)) &&
+	    above_high_.exchange(false, std::memory_order_seq_cst)) {
+	    _notify_watermark();
+	}
+	_wake_producers();
+    }
+
+    /**
+     * @brief 空きを待っている投入側を起こす
+     */
+    void _wake_producers() {
+	if (admit_waiters_.load(std::memory_order_seq_cst) > 0) {
+	    admit_seq_.fetch_add(1, std::memory_order_seq_cst);
+	    FJFutex::wake(&admit_seq_);
+	}
+    }
+
+    /**
+     * @brief 高水位・低水位の通知
+     * @note 通知の順序が入れ替わらないよう、通知済みの状態と比べて変化したときだけ呼ぶ。
+     */
+    void _notify_watermark() {
+	pthread_mutex_lock(&watermark_mutex_);
+	bool above = above_high_.load(std::memory_order_seq_cst);
+	if (above != watermark_notified_) {
+	    watermark_notified_ = above;
+	    if (watermark_fn_) watermark_fn_(above);
+	}
+	pthread_mutex_unlock(&watermark_mutex_);
+    }
+
+    /**
+     * @brief インスタンスの上限の対象として数えるタスク数
+     */
+    static int64_t _instance_queued(InstanceInfo* info) {
+	return info->pending.load(std::memory_order_seq_cst) + info->parallel_inflight.load(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief 呼び出し元が本ディスパッチャのワーカースレッドか
+     */
+    bool _is_own_worker() const {
+	WorkerInfo* self = _tls_worker();
+	return self != nullptr && self->owner == this;
+    }
+
+    /**
+     * @brief OVERFLOW_DROP_OLDESTで上限を超えている分を取り出した側で破棄する
+     * @note 取り出したタスクの後ろに上限以上のタスクが残っていれば、取り出したものが古い側なので破棄する。
+     * @param[in] node 取り出したタスク
+     * @param[in] info 投入先のインスタンス情報
+     * @retval [true] 破棄した(ノードの所有権は手放した)
+     * @retval [false] 実行してよい
+     */
+    bool _shed_overflow(TaskNode* node, InstanceInfo* info) {
+	if (!node->admitted || node->kind != KIND_NORMAL) return false;
+	bool shed = false;
+	size_t glimit = queue_limit_.load(std::memory_order_relaxed);
+	if (glimit != 0 && queue_policy_.load(std::memory_order_relaxed) == OVERFLOW_DROP_OLDEST) {
+	    shed = queued_tasks_.load(std::memory_order_seq_cst) > static_cast<int64_t>(glimit);
+	}
+	size_t ilimit = info->queue_limit.load(std::memory_order_relaxed);
+	int ipolicy = info->overflow_policy.load(std::memory_order_relaxed);
+	if (ilimit == 0) {
+	    ilimit = instance_limit_.load(std::memory_order_relaxed);
+	    ipolicy = instance_policy_.load(std::memory_order_relaxed);
+	}
+	if (!shed && ilimit != 0 && ipolicy == OVERFLOW_DROP_OLDEST) {
+	    // パラレル実行なら自身がparallel_inflightに含まれる
+	    int64_t behind = _instance_queued(info) - (node->parallel_info != nullptr ? 1 : 0);
+	    shed = behind >= static_cast<int64_t>(ilimit);
+	}
+	if (!shed) return false;
+	if (_claim_resultitem(node->handle)) {
+	    tasks_shed_.fetch_add(1, std::memory_order_relaxed);
+	    if (node->handle != 0) _post_resultitem(node->handle, FJDISPATCHLITE_RESULT_DROPPED);
+	}
+	_free_task_node(node);
+	return true;
+    }
+
+    /**
+     * @brief パラレル実行のタスクを数えて投入先を決める
+     * @note バリアが未完了ならメールボックスを経由させる。mutex_を保持したままでも呼べる。
+     * @param[in] info インスタンス情報
+     * @param[in] item タスク(所有権を移す)
+     * @param[out] resume [true]ならバリアを再開させるため呼び出し側で_resume_barrierすること
+     * @return 実行待ちキューに積む要素、なければnullptr
+     */
+    ReadyItem* _enqueue_parallel(InstanceInfo* info, TaskNode* item, bool& resume) {
+	resume = false;
+	info->parallel_inflight.fetch_add(1, std::memory_order_seq_cst);
+	if (info->barriers.load(std::memory_order_seq_cst) == 0) {
+	    _instance_retain(info);
+	    item->parallel_info = info;
+	    return item;
+	}
+	// バリアの後ろに並べる(数えた分は戻す)
+	resume = _parallel_done(info);
+	// 元の優先度のレーンに積む(バリアとの順序は積んだ順番で守る)
+	item->kind = KIND_DEFERRED;
+	return _enqueue_mailbox(info, item);
+    }
+
+    /**
+     * @brief パラレル実行のタスクの完了を数える
+     * @param[in] info インスタンス情報
+     * @retval [true] 待っていたバリアを再開させる権利を得た
+     */
+    static bool _parallel_done(InstanceInfo* info) {
+	bool last = info->parallel_inflight.fetch_sub(1, std::memory_order_seq_cst) == 1;
+	if (last) _notify_drained(info);
+	return last &&
+	    info->barrier_wait.load(std::memory_order_seq_cst) &&
+	    info->barrier_wait.exchange(false, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief DETACH_DRAINで待っているスレッドを起こす
+     * @note 待っているスレッドがいなければ何もしない。
+     * @param[in] info インスタンス情報
+     */
+    static void _notify_drained(InstanceInfo* info) {
+	if (info->drain_waiters.load(std::memory_order_seq_cst) > 0) {
+	    info->drain_seq.fetch_add(1, std::memory_order_seq_cst);
+	    FJFutex::wake(&info->drain_seq);
+	}
+    }
+
+    /**
+     * @brief インスタンスのメールボックスとパラレル実行が空になるまで待つ
+     * @note 消費者がrunningを下ろすか、最後のパラレル実行が完了したときに_notify_drained()で起こされる。
+     * @param[in] info インスタンス情報(参照を持った状態)
+     */
+    void _wait_drained(InstanceInfo* info) {
+	bool blocking = false;
+	info->drain_waiters.fetch_add(1, std::memory_order_seq_cst);
+	for (;;) {
+	    uint32_t seq = info->drain_seq.load(std::memory_order_seq_cst);
+	    if (!info->running.load(std::memory_order_seq_cst) &&
+		info->pending.load(std::memory_order_seq_cst) == 0 &&
+		info->parallel_inflight.load(std::memory_order_seq_cst) == 0) break;
+	    if (!blocking) {
+		beginBlocking();
+		blocking = true;
+	    }
+	    FJFutex::wait(&info->drain_seq, seq, -1);
+	}
+	info->drain_waiters.fetch_sub(1, std::memory_order_seq_cst);
+	if (blocking) endBlocking();
+    }
+
+    /**
+     * @brief インスタンスの登録を解除する
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] mode 未実行のタスクの扱い
+     * @param[out] retained nullptrでなければ、解除したインスタンス情報を管理テーブルの参照ごと渡す(呼び出し側で手放すこと)
+     * @retval [true] 登録を解除した
+     * @retval [false] 登録されていなかった
+     */
+    bool _detach(FJUnitFrames* obj, DetachMode mode, InstanceInfo** retained) {
+	pthread_mutex_lock(&mutex_);
+	auto it = instance_map_.find(obj);
+	if (it == instance_map_.end()) {
+	    pthread_mutex_unlock(&mutex_);
+	    return false;
+	}
+	InstanceInfo* info = it->second;
+	if (mode == DETACH_DRAIN) {
+	    // 待つ間に他のdetach()が解除しても解放されないよう参照を持つ
+	    _instance_retain(info);
+	    pthread_mutex_unlock(&mutex_);
+	    _wait_drained(info);
+	    pthread_mutex_lock(&mutex_);
+	    it = instance_map_.find(obj);
+	    // 管理テーブルの参照が残っているので、ここでは解放されない
+	    _instance_release(info);
+	    if (it == instance_map_.end() || it->second != info) {
+		// 待つ間に他のdetach()が解除した
+		pthread_mutex_unlock(&mutex_);
+		return false;
+	    }
+	}
+	instance_map_.erase(it);
+	if (cache_slot_ >= 0) {
+	    void* expected = info;
+	    obj->dispatch_info_[cache_slot_].compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+	}
+	obj->dispatch_queues_.fetch_sub(1, std::memory_order_relaxed);
+	pthread_mutex_unlock(&mutex_);
+	info->detached.store(true, std::memory_order_seq_cst);
+	_cancel_suspensions(info);
+	// 実行待ちでも実行中でもなければここで取り消す(それ以外は消費者が取り消す)
+	if (!info->running.exchange(true, std::memory_order_seq_cst)) {
+	    _instance_retain(info);
+	    _cancel_mailbox(info);
+	    _stop_instance(info);
+	}
+	instances_detached_.fetch_add(1, std::memory_order_relaxed);
+	if (retained != nullptr) {
+	    *retained = info;
+	} else {
+	    _instance_release(info);
+	}
+	return true;
+    }
+
+    /**
+     * @brief インスタンスの実行中のタスクが完了するまで待つ
+     * @note 呼び出したスレッド自身が実行中のタスク(delete this等)は待たない。
+     * @param[in] info インスタンス情報(参照を持った状態)
+     */
+    void _wait_idle(InstanceInfo* info) {
+	int self = (_tls_instance() == info) ? 1 : 0;
+	bool blocking = false;
+	info->drain_waiters.fetch_add(1, std::memory_order_seq_cst);
+	for (;;) {
+	    uint32_t seq = info->drain_seq.load(std::memory_order_seq_cst);
+	    if (info->executing.load(std::memory_order_seq_cst) <= self) break;
+	    if (!blocking) {
+		beginBlocking();
+		blocking = true;
+	    }
+	    FJFutex::wait(&info->drain_seq, seq, -1);
+	}
+	info->drain_waiters.fetch_sub(1, std::memory_order_seq_cst);
+	if (blocking) endBlocking();
+    }
+
+    /**
+     * @brief 待っていたバリアのインスタンスを実行待ちに戻す
+     * @note runningは立ったままなので、そのままC_MESSAGE_HIGHで積む。
+     * @param[in] info インスタンス情報
+     */
+    void _resume_barrier(InstanceInfo* info) {
+	info->lane = C_MESSAGE_HIGH;
+	info->deadline_usec = 0;
+	_push_ready(info);
+    }
+
+    /**
+     * @brief バリアを実行してよいか確認し、だめなら止める
+     * @note 止めた場合は最後のパラレル実行のタスクの完了時に_resume_barrierで再開する。
+     * @param[in] info インスタンス情報
+     * @param[in] node バリアタスク
+     * @retval [true] 実行してよい
+     * @retval [false] 止めた(呼び出し側は以降infoに触れずに戻ること)
+     */
+    static bool _barrier_ready(InstanceInfo* info, TaskNode* node) {
+	if (info->parallel_inflight.load(std::memory_order_seq_cst) == 0) return true;
+	info->held_barrier = node;
+	info->barrier_wait.store(true, std::memory_order_seq_cst);
+	// 止めた直後に最後の1つが完了していたら自分で再開する
+	if (info->parallel_inflight.load(std::memory_order_seq_cst) == 0 &&
+	    info->barrier_wait.exchange(false, std::memory_order_seq_cst)) {
+	    info->held_barrier = nullptr;
+	    return true;
+	}
+	return false;
+    }
+
+    /**
+     * @brief バリアタスクの実行
+     * @param[in] info インスタンス情報
+     * @param[in] node バリアタスク
+     */
+    void _run_barrier(InstanceInfo* info, TaskNode* node) {
+	_execute(node, info);
+	info->barriers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief タスクをインスタンスのメールボックスに積む
+     * @note mutex_を保持したままでも呼べる(インスタンス情報は取得済みのこと)。
+     * @param[in] info インスタンス情報
+     * @param[in] item タスク(所有権を移す)
+     * @return 実行待ちキューに積むインスタンス、既に実行待ちならnullptr
+     */
+    ReadyItem* _enqueue_mailbox(InstanceInfo* info, TaskNode* item) {
+	// push後のitemは他ワーカーが実行・解放しうるので先にレーンを取っておく
+	int prio = item->prio;
+	int64_t deadline = item->deadline_usec;
+	item->post_seq = info->post_seq.fetch_add(1, std::memory_order_relaxed);
+	info->mailbox[prio].push(item);
+	info->lane_pending[prio].fetch_add(1, std::memory_order_seq_cst);
+	info->pending.fetch_add(1, std::memory_order_seq_cst);
+	// 実行中でなければ投入したタスクのレーンで実行待ちキューに登録して実行中に
+	if (!info->running.exchange(true, std::memory_order_seq_cst)) {
+	    _instance_retain(info);
+	    info->lane = prio;
+	    info->deadline_usec = deadline;
+	    return info;
+	}
+	return nullptr;
+    }
+
+    /**
+     * @brief 遅延投入の登録
+     * @param[in] obj FJUnitFramesのポインタ
+     * @param[in] node タスク(所有権を移す)
+     * @param[in] isseq [true]:メールボックス経由でシーケンシャル実行, [false]:直接実行待ちキューへ
+     * @param[in] when_usec 実行待ちに移す時刻
+     */
+    void _post_delayed(FJUnitFrames* obj, TaskNode* node, bool isseq, int64_t when_usec) {
+	// 期限到来時はmutex_を保持して移すので、インスタンス情報はここで引いておく
+	_post_delayed(_instance_info(obj), node, isseq, when_usec);
+    }
+
+    /**
+     * @brief インスタンス情報を指定した遅延投入の登録
+     * @param[in] info インスタンス情報
+     * @note その他の引数は_post_delayed(FJUnitFrames*, ...)と同じ。
+     */
+    void _post_delayed(InstanceInfo* info, TaskNode* node, bool isseq, int64_t when_usec) {
+	_instance_retain(info);
+	pthread_mutex_lock(&mutex_);
+	bool earliest = timers_.empty() || when_usec < timers_.top().when_usec;
+	timers_.push(DelayedItem{when_usec, timer_seq_++, info, node, isseq});
+	next_timer_usec_.store(timers_.top().when_usec, std::memory_order_relaxed);
+	// 最も早くなったら眠っているワーカーに待ち時間を計算し直させる
+	if (earliest) pthread_cond_signal(&cv_);
+	pthread_mutex_unlock(&mutex_);
+    }
+
+    /**
+     * @brief 期限の来た遅延投入を実行待ちに移す
+     * @note mutex_を保持して呼ぶこと。
+     * @return 移した数
+     */
+    size_t _fire_timers_locked() {
+	if (timers_.empty()) return 0;
+	int64_t now = _get_time_usec();
+	size_t fired = 0;
+	while (!timers_.empty() && timers_.top().when_usec <= now) {
+	    DelayedItem d = timers_.top();
+	    timers_.pop();
+	    // キュー遅延は期限到来から数える
+	    d.node->start_usec = now;
+	    bool resume = false;
+	    ReadyItem* ready = d.isseq ? _enqueue_mailbox(d.info, d.node) : _enqueue_parallel(d.info, d.node, resume);
+	    if (ready != nullptr) {
+		_push_shared_locked(ready);
+		++fired;
+	    }
+	    if (resume) {
+		d.info->lane = C_MESSAGE_HIGH;
+		d.info->deadline_usec = 0;
+		_push_shared_locked(d.info);
+		++fired;
+	    }
+	    // 移した先が参照を持つので手放す(解放されうるがmutex_は取らない)
+	    _instance_release(d.info);
+	}
+	next_timer_usec_.store(timers_.empty() ? INT64_MAX : timers_.top().when_usec, std::memory_order_relaxed);
+	return fired;
+    }
+
+    /**
+     * @brief 期限の来た遅延投入があるか(ロックを取らない概算)
+     */
+    bool _timer_due() const {
+	int64_t next = next_timer_usec_.load(std::memory_order_relaxed);
+	return next != INT64_MAX && _get_time_usec() >= next;
+    }
+
+    /**
+     * @brief 次に取り出すレーンを選ぶ
+     * @param[in,out] sel 重み付き選択の状態
+     * @param[in] nonempty レーンごとに空でなければ立てたビット
+     * @return レーン、全て空なら-1
+     */
+    int _select_lane(LaneSelector& sel, unsigned nonempty) const {
+	if (nonempty == 0) return -1;
+	if (prio_policy_.load(std::memory_order_relaxed) == PRIO_STRICT) {
+	    for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+		if (nonempty & (1u << l)) return l;
+	    }
+	}
+	// 現在のレーンに残り回数があれば続け、なければ次の空でないレーンへ
+	if (sel.left > 0 && (nonempty & (1u << sel.lane))) {
+	    --sel.left;
+	    return sel.lane;
+	}
+	for (int n = 1; n <= FJDISPATCHLITE_PRIO_LANES; ++n) {
+	    int l = (sel.lane + n) % FJDISPATCHLITE_PRIO_LANES;
+	    if (nonempty & (1u << l)) {
+		sel.lane = l;
+		sel.left = prio_weights_[l].load(std::memory_order_relaxed) - 1;
+		return l;
+	    }
+	}
+	return -1;
+    }
+
+    /**
+     * @brief インスタンスのメールボックスの空でないレーン
+     * @param[in] info インスタンス情報
+     * @return レーンごとに空でなければ立てたビット
+     */
+    static unsigned _nonempty_lanes(const InstanceInfo* info) {
+	unsigned bits = 0;
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    if (info->lane_pending[l].load(std::memory_order_seq_cst) > 0) bits |= 1u << l;
+	}
+	return bits;
+    }
+
+    /**
+     * @brief メールボックスの先頭のうち最も先に積まれたもののレーン
+     * @note バリアが未完了の間に優先度によらず積んだ順に取り出すために使う(消費者のみ)。
+     * @param[in] info インスタンス情報
+     * @param[in] nonempty レーンごとに空でなければ立てたビット
+     * @return レーン、全て空なら-1
+     */
+    static int _oldest_lane(InstanceInfo* info, unsigned nonempty) {
+	int oldest = -1;
+	uint64_t seq = 0;
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    if (!(nonempty & (1u << l))) continue;
+	    const TaskNode* head = static_cast<const TaskNode*>(info->mailbox[l].peek());
+	    if (oldest < 0 || head->post_seq < seq) {
+		oldest = l;
+		seq = head->post_seq;
+	    }
+	}
+	return oldest;
+    }
+
+    /**
+     * @brief 共有実行待ちキューの空でないレーン
+     * @note mutex_を保持して呼ぶこと。
+     * @return レーンごとに空でなければ立てたビット
+     */
+    unsigned _nonempty_ready_lanes() const {
+	unsigned bits = 0;
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    if (!ready_queue_[l].empty()) bits |= 1u << l;
+	}
+	return bits;
+    }
+
+    /**
+     * @brief 共有実行待ちキューから選択方式に従って取り出す
+     * @note mutex_を保持して呼ぶこと。
+     * @return 実行待ち要素、空ならnullptr
+     */
+    ReadyItem* _pop_ready_locked() {
+	if (!edf_queue_.empty()) {
+	    ReadyItem* item = edf_queue_.top();
+	    edf_queue_.pop();
+	    urgent_ready_.fetch_sub(1, std::memory_order_relaxed);
+	    shared_ready_.fetch_sub(1, std::memory_order_relaxed);
+	    return item;
+	}
+	int l = _select_lane(ready_selector_, _nonempty_ready_lanes());
+	if (l < 0) return nullptr;
+	ReadyItem* item = ready_queue_[l].front();
+	ready_queue_[l].pop();
+	if (l == C_MESSAGE_HIGH) urgent_ready_.fetch_sub(1, std::memory_order_relaxed);
+	shared_ready_.fetch_sub(1, std::memory_order_relaxed);
+	return item;
+    }
+
+    /**
+     * @brief 共有実行待ちキューに積む
+     * @note mutex_を保持して呼ぶこと。EDF有効時、期限付きの要素は期限順のキューに積む。
+     * @param[in] item インスタンスまたはパラレル実行のタスク
+     */
+    void _push_shared_locked(ReadyItem* item) {
+	if (item->deadline_usec != 0 && edf_enabled_.load(std::memory_order_relaxed)) {
+	    edf_queue_.push(item);
+	    urgent_ready_.fetch_add(1, std::memory_order_relaxed);
+	    shared_ready_.fetch_add(1, std::memory_order_release);
+	    return;
+	}
+	ready_queue_[item->lane].push(item);
+	if (item->lane == C_MESSAGE_HIGH) urgent_ready_.fetch_add(1, std::memory_order_relaxed);
+	shared_ready_.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief ローカルキューに積まずに共有キューで順序付けるべき要素か
+     */
+    bool _is_urgent(const ReadyItem* item) const {
+	return item->lane == C_MESSAGE_HIGH || (item->deadline_usec != 0 && edf_enabled_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief 実行開始期限の確認
+     * @note 期限切れなら数え、MISS_DROPは破棄、MISS_DEMOTEはC_MESSAGE_LOWの末尾に積み直す。
+     * @param[in] node タスクノード
+     * @param[in] info 取り出したメールボックスのインスタンス情報(パラレル実行ならnullptr)
+     * @retval [true] 実行してよい
+     * @retval [false] 破棄または積み直したので実行しない(ノードの所有権は手放した)
+     */
+    bool _check_deadline(TaskNode* node, InstanceInfo* info) {
+	if (node->deadline_usec == 0) return true;
+	if (_get_time_usec() <= node->deadline_usec) {
+	    deadline_met_.fetch_add(1, std::memory_order_relaxed);
+	    return true;
+	}
+	deadline_missed_.fetch_add(1, std::memory_order_relaxed);
+	if (node->on_miss == FJPostAttr::MISS_DROP) {
+	    deadline_dropped_.fetch_add(1, std::memory_order_relaxed);
+	    if (node->handle != 0 && _claim_resultitem(node->handle)) _post_resultitem(node->handle, FJDISPATCHLITE_RESULT_DROPPED);
+	    _free_task_node(node);
+	    return false;
+	}
+	if (node->on_miss == FJPostAttr::MISS_DEMOTE) {
+	    deadline_demoted_.fetch_add(1, std::memory_order_relaxed);
+	    node->deadline_usec = 0;
+	    node->prio = C_MESSAGE_LOW;
+	    node->lane = C_MESSAGE_LOW;
+	    if (info != nullptr) {
+		// 消費者自身が積むのでrunningはそのまま、再登録は_run_instanceに任せる
+		info->mailbox[C_MESSAGE_LOW].push(node);
+		info->lane_pending[C_MESSAGE_LOW].fetch_add(1, std::memory_order_seq_cst);
+		info->pending.fetch_add(1, std::memory_order_seq_cst);
+	    } else {
+		_push_ready(node);
+	    }
+	    return false;
+	}
+	return true;
+    }
+
+    /**
+     * @brief キュー遅延を統計に加える
+     * @param[in] lane 優先度レーン
+     * @param[in] delay_usec 投入から実行開始までの遅延(usec)
+     */
+    void _record_lane_delay(int lane, int64_t delay_usec) {
+	LaneCounters& c = lane_stats_[lane];
+	uint64_t d = delay_usec > 0 ? static_cast<uint64_t>(delay_usec) : 0;
+	c.count.fetch_add(1, std::memory_order_relaxed);
+	c.total_delay_usec.fetch_add(d, std::memory_order_relaxed);
+	uint64_t cur = c.max_delay_usec.load(std::memory_order_relaxed);
+	while (d > cur && !c.max_delay_usec.compare_exchange_weak(cur, d, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * @brief 空きスロットにワーカーを起動する
+     * @note mutex_を保持して呼ぶこと。ローカルキューはスロットごとに使い回すのでスティール中に解放されることはない。
+     */
+    void _spawn_worker() {
+	for (size_t i = 0; i < _slot_count(); ++i) {
+	    WorkerInfo& info = workers_[i];
+	    if (info.alive) continue;
+	    // 自ら終了したワーカーのスレッドを回収してからスロットを使い回す
+	    if (info.joinable) pthread_join(info.thread, nullptr);
+	    info.owner = this;
+	    info.alive.store(true, std::memory_order_release);
+	    info.last_active_ms.store(_get_time(), std::memory_order_relaxed);
+	    info.task_start_ms.store(0, std::memory_order_relaxed);
+	    info.task_srcfunc.store(nullptr, std::memory_order_relaxed);
+	    info.spin_usec = idle_spin_usec_.load(std::memory_order_relaxed);
+	    _create_worker_thread(info, i);
+	    info.joinable = true;
+	    if (i >= workers_used_.load(std::memory_order_relaxed)) {
+		workers_used_.store(i + 1, std::memory_order_release);
+	    }
+	    return;
+	}
+    }
+
+    /**
+     * @brief 設定のアフィニティとスケジューリングポリシーでワーカースレッドを作る
+     * @note ポリシーの設定が権限不足等で失敗した場合は既定の属性で作り直す。
+     * @param[in] info ワーカー情報
+     * @param[in] slot スロット番号
+     */
+    void _create_worker_thread(WorkerInfo& info, size_t slot) {
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (!config_.affinity.empty()) {
+	    const cpu_set_t& set = config_.affinity[slot % config_.affinity.size()];
+	    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+	}
+	if (config_.sched_policy != SCHED_OTHER) {
+	    struct sched_param param;
+	    param.sched_priority = config_.sched_priority;
+	    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	    pthread_attr_setschedpolicy(&attr, config_.sched_policy);
+	    pthread_attr_setschedparam(&attr, &param);
+	}
+	int ret = pthread_create(&info.thread, &attr, &FJDispatchLite::workerFunc, &info);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+	    std::cerr << COLOR_RED << "*WARNING* worker thread attributes rejected (" << ret << "), using defaults" << COLOR_RESET << std::endl;
+	    pthread_create(&info.thread, NULL, &FJDispatchLite::workerFunc, &info);
+	}
+    }
+
+    /**
+     * @brief 実行待ちの溜まり具合に応じてワーカーを増やす
+     * @note mutex_を保持して呼ぶこと。実行待ちがワーカー数を超えたら足りない分をすぐに足し、
+     *       加えてFJDISPATCHLITE_SCALE_IVAL_MSECごとに直近のキュー遅延と稼働率から必要な数を見積もる。
+     */
     void _adjust_workers() {
-        if (ready_instances_.size() > num_of_threads_ && num_of_threads_ < FJDISPATCHLITE_MAX_THREADS) {
-            _spawn_worker();
-            ++num_of_threads_;
+	size_t threads = num_of_threads_;
+	size_t limit = _thread_limit_locked();
+	if (threads >= limit) return;
+	size_t ready = _ready_count();
+	// 塞がっているワーカーは実行待ちを取りに来ないので、その分を足して比べる
+	size_t blocked = blocking_workers_ + hung_workers_;
+	size_t want = std::max(ready + blocked, threads);
+	if (blocked > 0 && ready > 0 && parked_workers_.load(std::memory_order_relaxed) == 0) {
+	    want = std::max(want, threads + 1);
+	}
+	int64_t now_usec = _get_time_usec();
+	if (now_usec - scale_eval_usec_.load(std::memory_order_relaxed) >= FJDISPATCHLITE_SCALE_IVAL_MSEC * 1000) {
+	    want = std::max(want, _predict_workers(now_usec, ready));
+	}
+	want = std::min(want, limit);
+	for (; threads < want; ++threads) {
+	    _spawn_worker();
+	    ++num_of_threads_;
+	    workers_grown_.fetch_add(1, std::memory_order_relaxed);
+	    if (num_of_threads_ > config_.max_threads) workers_compensated_.fetch_add(1, std::memory_order_relaxed);
 #if FJDISPATCHLITE_DBG != 0
 	    std::cerr << COLOR_RED << "*WARNING* worker threads++ (" << num_of_threads_ << ")" << COLOR_RESET << std::endl;
 #endif
-        }
+	}
+	peak_threads_ = std::max(peak_threads_, num_of_threads_);
     }
-    
-    void _shrink_workers() {
-        auto now = _get_time();
-        for (auto it = workers_.begin(); it != workers_.end();) {
-            if (workers_.size() <= FJDISPATCHLITE_MIN_THREADS) break;
-            if (now - it->last_active_ms >= FJDISPATCHLITE_IDLE_TIMEOUT_MSEC) {
-                pthread_cancel(it->thread);
-                pthread_join(it->thread, nullptr);
-                it = workers_.erase(it);
-                --num_of_threads_;
-            } else {
-                ++it;
-            }
-        }
+
+    /**
+     * @brief ワーカースロット数
+     */
+    size_t _slot_count() const {
+	return config_.max_threads + config_.max_spare_threads;
+    }
+
+    /**
+     * @brief 現在のワーカー数の上限
+     * @note mutex_を保持して呼ぶこと。塞がっているワーカーの分だけmax_spare_threadsまでmax_threadsを超えられる。
+     */
+    size_t _thread_limit_locked() const {
+	return config_.max_threads + std::min(blocking_workers_ + hung_workers_, config_.max_spare_threads);
+    }
+
+    /**
+     * @brief 塞がる処理に入ったワーカーを数え、必要なら代わりを足す
+     * @param[in] self 自ワーカー
+     */
+    void _begin_blocking(WorkerInfo* self) {
+	int depth = self->blocking.load(std::memory_order_relaxed);
+	self->blocking.store(depth + 1, std::memory_order_relaxed);
+	if (depth != 0) return;
+	pthread_mutex_lock(&mutex_);
+	++blocking_workers_;
+	if (!stop_) _adjust_workers();
+	pthread_mutex_unlock(&mutex_);
+    }
+
+    /**
+     * @brief 塞がる処理を終えたワーカーを数から外す
+     * @param[in] self 自ワーカー
+     */
+    void _end_blocking(WorkerInfo* self) {
+	int depth = self->blocking.load(std::memory_order_relaxed);
+	if (depth <= 0) return;
+	self->blocking.store(depth - 1, std::memory_order_relaxed);
+	if (depth != 1) return;
+	pthread_mutex_lock(&mutex_);
+	--blocking_workers_;
+	_release_spare_locked();
+	pthread_mutex_unlock(&mutex_);
+    }
+
+    /**
+     * @brief 上限を超えているワーカーに終了を促す
+     * @note mutex_を保持して呼ぶこと。超えた分は眠る前に自ら終了するので、眠っているワーカーを起こして判断させる。
+     */
+    void _release_spare_locked() {
+	size_t limit = _thread_limit_locked();
+	if (num_of_threads_ > limit) _wake_workers(num_of_threads_ - limit);
+    }
+
+    /**
+     * @brief モニターが固まっていると判定したワーカー数を反映する
+     * @note 申告なしに塞がっているワーカーも、増えたら代わりを足し、減ったら足した分に終了を促す。
+     * @param[in] hung ワーカー数
+     */
+    void _update_hung(size_t hung) {
+	pthread_mutex_lock(&mutex_);
+	if (hung != hung_workers_ && !stop_) {
+	    bool more = hung > hung_workers_;
+	    hung_workers_ = hung;
+	    if (more) {
+		_adjust_workers();
+	    } else {
+		_release_spare_locked();
+	    }
+	}
+	pthread_mutex_unlock(&mutex_);
+    }
+
+    /**
+     * @brief 前回の見直しからのキュー遅延と稼働率で必要なワーカー数を見積もる
+     * @note mutex_を保持して呼ぶこと。眠っているワーカーがいるか、平均キュー遅延が閾値以下なら今の数を返す。
+     *       増やす場合は実行に使った時間を稼働率FJDISPATCHLITE_SCALE_TARGET_UTILでまかなえる数にし、少なくとも1つ足す。
+     * @param[in] now_usec 現在時刻(usec)
+     * @param[in] ready 実行待ち要素の数
+     * @return 必要なワーカー数
+     */
+    size_t _predict_workers(int64_t now_usec, size_t ready) {
+	uint64_t count = 0;
+	uint64_t delay = 0;
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    count += lane_stats_[l].count.load(std::memory_order_relaxed);
+	    delay += lane_stats_[l].total_delay_usec.load(std::memory_order_relaxed);
+	}
+	uint64_t busy = 0;
+	size_t used = workers_used_.load(std::memory_order_acquire);
+	for (size_t i = 0; i < used; ++i) busy += workers_[i].busy_usec.load(std::memory_order_relaxed);
+	uint64_t elapsed = static_cast<uint64_t>(std::max<int64_t>(now_usec - scale_eval_usec_.load(std::memory_order_relaxed), 1));
+	uint64_t d_count = count - scale_count_;
+	uint64_t d_busy = busy - scale_busy_;
+	scale_delay_usec_ = d_count > 0 ? (delay - scale_delay_total_) / d_count : 0;
+	scale_util_ = static_cast<uint32_t>(std::min<uint64_t>(d_busy * 100 / (elapsed * num_of_threads_), 100));
+	scale_eval_usec_.store(now_usec, std::memory_order_relaxed);
+	scale_count_ = count;
+	scale_delay_total_ = delay;
+	scale_busy_ = busy;
+
+	size_t threads = num_of_threads_;
+	if (ready == 0 || parked_workers_.load(std::memory_order_relaxed) > 0) return threads;
+	// 1つも開始できていなければ全ワーカーが塞がっているので増やす
+	if (d_count > 0 && scale_delay_usec_ <= config_.scale_up_delay_usec) return threads;
+	uint64_t target = elapsed * FJDISPATCHLITE_SCALE_TARGET_UTIL;
+	size_t need = static_cast<size_t>((d_busy * 100 + target - 1) / target);
+	return std::max(need, threads + 1);
+    }
+
+    /**
+     * @brief 仕事のなかったワーカーを終了させる
+     * @note mutex_を保持して、ローカルキューが空のワーカー自身が呼ぶこと。
+     *       スレッドのjoinはスロットを使い回すときかデストラクタで行う。
+     * @param[in] self 自ワーカー
+     */
+    void _retire_worker_locked(WorkerInfo* self) {
+	--num_of_threads_;
+	workers_retired_.fetch_add(1, std::memory_order_relaxed);
+	self->alive.store(false, std::memory_order_release);
+#if FJDISPATCHLITE_DBG != 0
+	std::cerr << COLOR_RED << "*WARNING* worker threads-- (" << num_of_threads_ << ")" << COLOR_RESET << std::endl;
+#endif
+    }
+
+    /**
+     * @brief 実行待ちの要素を積む
+     * @note ワークスティーリング時、ワーカー自身からの投入はロックを取らずにローカルキューに積む。
+     *       ただしC_MESSAGE_HIGHはローカルキューの後ろに埋もれないよう常に共有キューに積む。
+     * @param[in] item インスタンスまたはパラレル実行のタスク(item->laneのレーンに積む)
+     */
+    void _push_ready(ReadyItem* item) {
+	_push_ready_batch(&item, 1);
+    }
+
+    /**
+     * @brief 実行待ちの要素をまとめて積む
+     * @note 共有キューへは1回のロックで積み、起床とワーカー拡張の判断も1回にまとめる。
+     * @param[in,out] items インスタンスまたはパラレル実行のタスク(ローカルキューに積んだ要素はnullptrにする)
+     * @param[in] count 要素数
+     */
+    void _push_ready_batch(ReadyItem** items, size_t count) {
+	if (count == 0) return;
+	WorkerInfo* self = _tls_worker();
+	size_t local = 0;
+	if (sched_mode_.load(std::memory_order_relaxed) == SCHEDMODE_WORKSTEAL && self != nullptr && self->owner == this) {
+	    for (size_t i = 0; i < count; ++i) {
+		if (!_is_urgent(items[i]) && self->deque.push(items[i])) {
+		    items[i] = nullptr;
+		    ++local;
+		}
+	    }
+	    if (local > 0) ready_epoch_.fetch_add(1, std::memory_order_seq_cst);
+	}
+	if (local == count) {
+	    // スティールさせるため寝ているワーカーがいれば起こす(待っているワーカーはepochの変化で気付く)
+	    if (parked_workers_.load(std::memory_order_seq_cst) > 0) {
+		pthread_mutex_lock(&mutex_);
+		_wake_workers(local);
+		pthread_mutex_unlock(&mutex_);
+	    } else if (_get_time_usec() - scale_eval_usec_.load(std::memory_order_relaxed) >= FJDISPATCHLITE_SCALE_IVAL_MSEC * 1000) {
+		// 全ワーカーが動いているなら見直しの時期にワーカー数を見直す
+		pthread_mutex_lock(&mutex_);
+		_adjust_workers();
+		pthread_mutex_unlock(&mutex_);
+	    }
+	    return;
+	}
+	pthread_mutex_lock(&mutex_);
+	for (size_t i = 0; i < count; ++i) {
+	    ReadyItem* item = items[i];
+	    if (item == nullptr) continue;
+	    _push_shared_locked(item);
+	}
+	_wake_workers(count);
+	// ワーカースレッドを必要に応じて拡張
+	_adjust_workers();
+	pthread_mutex_unlock(&mutex_);
+    }
+
+    /**
+     * @brief 実行待ちの数に応じてワーカーを起こす
+     * @note mutex_を保持して呼ぶこと。
+     * @note 眠っているワーカーがいなければ何もしない(実行中か待っているワーカーが取りに来る)。
+     * @param[in] count 新たに積んだ要素数
+     */
+    void _wake_workers(size_t count) {
+	// 眠っているワーカーの数はmutex_の中で増減するので正確
+	size_t parked = static_cast<size_t>(parked_workers_.load(std::memory_order_relaxed));
+	if (parked == 0) return;
+	if (count >= parked) {
+	    pthread_cond_broadcast(&cv_);
+	} else {
+	    for (size_t i = 0; i < count; ++i) pthread_cond_signal(&cv_);
+	}
+    }
+
+    /**
+     * @brief 実行待ち要素のおおよその数
+     */
+    size_t _ready_count() const {
+	size_t count = edf_queue_.size();
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) count += ready_queue_[l].size();
+	size_t used = workers_used_.load(std::memory_order_acquire);
+	for (size_t i = 0; i < used; ++i) count += workers_[i].deque.size();
+	return count;
+    }
+
+    /**
+     * @brief 他ワーカーのローカルキューから盗む
+     * @param[in] self 自ワーカー
+     * @return 実行待ち要素、なければnullptr
+     */
+    ReadyItem* _steal(WorkerInfo* self) {
+	size_t used = workers_used_.load(std::memory_order_acquire);
+	if (used == 0) return nullptr;
+	size_t start = static_cast<size_t>(self - workers_.get());
+	for (size_t n = 1; n <= used; ++n) {
+	    WorkerInfo& victim = workers_[(start + n) % used];
+	    if (&victim == self) continue;
+	    ReadyItem* item = victim.deque.steal();
+	    if (item) return item;
+	}
+	return nullptr;
+    }
+
+    /**
+     * @brief 自スレッドのワーカー情報
+     * @return ワーカー情報、ワーカースレッドでなければnullptr
+     */
+    static WorkerInfo*& _tls_worker() {
+	static thread_local WorkerInfo* worker = nullptr;
+	return worker;
+    }
+
+    /**
+     * @brief 呼び出したスレッドがタスクを実行中のインスタンス
+     * @return インスタンス情報、実行中でなければnullptr
+     */
+    static InstanceInfo*& _tls_instance() {
+	static thread_local InstanceInfo* instance = nullptr;
+	return instance;
     }
 
    /**
@@ -459,107 +3352,594 @@ private:
      * @return 新しいハンドル
      */
     fjt_handle_t getHandle() {
-	pthread_mutex_lock(&mutex_);
-	fjt_handle_t handle = ++handle_counter_;
-	if (handle >= INT64_MAX) handle_counter_ = 1;
-	pthread_mutex_unlock(&mutex_);
-	return handle;
+	// 結果スロットではハンドルを2bit左シフトして保持する(2^62で一周するが事実上到達しない)
+	return handle_counter_.fetch_add(1, std::memory_order_relaxed) + 1;
     }
 
     static void* workerFunc(void* arg) {
-        static_cast<FJDispatchLite*>(arg)->workerThread();
+	WorkerInfo* info = static_cast<WorkerInfo*>(arg);
+	_tls_worker() = info;
+	FJDispatchLite* self = info->owner;
+	// スレッド名はキュー名(15文字まで)
+	pthread_setname_np(pthread_self(), self->name_.substr(0, 15).c_str());
+	if (self->config_.nice != 0 && self->config_.sched_policy == SCHED_OTHER) {
+	    // 権限がなく下げられない場合はそのまま
+	    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), self->config_.nice);
+	}
+        info->owner->workerThread(info);
         return nullptr;
     }
 
     static void* monitorFunc(void* arg) {
         FJDispatchLite* self = static_cast<FJDispatchLite*>(arg);
         while (!self->stop_) {
-            pthread_mutex_lock(&self->mutex_);
-            auto now = _get_time();
-            for (const auto& w : self->workers_) {
-                if (!w.task_srcfunc.empty() && (now - w.task_start_ms >= FJDISPATCHLITE_HUNG_TIMEOUT_MSEC)) {
-                    std::cerr << COLOR_YELLOW << "[MONITOR] Hung task: " << w.task_srcfunc << " (" << (now - w.task_start_ms) << "ms)" << COLOR_RESET << std::endl;
+            uint64_t now = _get_time();
+	    size_t used = self->workers_used_.load(std::memory_order_acquire);
+	    size_t hung = 0;
+            for (size_t i = 0; i < used; ++i) {
+		const auto& w = self->workers_[i];
+		if (!w.alive.load(std::memory_order_acquire)) continue;
+		const char* srcfunc = w.task_srcfunc.load(std::memory_order_acquire);
+		uint64_t start = w.task_start_ms.load(std::memory_order_relaxed);
+                if (srcfunc != nullptr && now > start && (now - start >= FJDISPATCHLITE_HUNG_TIMEOUT_MSEC)) {
+		    bool blocking = w.blocking.load(std::memory_order_relaxed) > 0;
+                    std::cerr << COLOR_YELLOW << "[MONITOR] Hung task: " << srcfunc << " (" << (now - start) << "ms)" << (blocking ? " blocking" : "") << COLOR_RESET << std::endl;
+		    // 申告済みのものは既に数えている
+		    if (!blocking) ++hung;
                 }
             }
-            pthread_mutex_unlock(&self->mutex_);
-	    usleep(FJDISPATCHLITE_PROFILE_MONITOR_IVAL_MSEC * 1000);
+	    self->_update_hung(hung);
+	    FJFutex::wait(&self->monitor_wake_, 0, FJDISPATCHLITE_PROFILE_MONITOR_IVAL_MSEC);
         }
         return nullptr;
     }
 
     /**
-     * @brief ワーカースレッドの実装
+     * @brief 眠る前に実行待ちが来るのを少し待つ
+     * @note mutex_を持たずに、共有キューの要素数、ローカルキューへの投入、終了宣言、遅延投入の期限だけを見る。
+     * @param[in] self 自ワーカー
+     * @param[in] epoch 盗む前に見たready_epoch_
+     * @retval [true] 実行待ちが来た(取りに行くこと)
+     * @retval [false] 来なかった(眠ってよい)
      */
-    void workerThread() {
-        while (true) {
-            FJUnitFrames* inst = nullptr;
-	    std::unique_ptr<std::packaged_task<void()>> task;
+    bool _spin_for_work(WorkerInfo* self, uint64_t epoch) {
+	uint32_t max_spin = idle_spin_usec_.load(std::memory_order_relaxed);
+	uint32_t budget = std::min(self->spin_usec, max_spin);
+	if (budget == 0) return false;
+	int64_t end_usec = _get_time_usec() + budget;
+	for (uint32_t n = 1; ; ++n) {
+	    if (shared_ready_.load(std::memory_order_acquire) > 0 ||
+		ready_epoch_.load(std::memory_order_acquire) != epoch ||
+		stop_.load(std::memory_order_relaxed)) {
+		self->spin_usec = max_spin;
+		return true;
+	    }
+	    _cpu_relax();
+	    // 時刻は間引いて見る
+	    if ((n & 63) == 0) {
+		if (_timer_due()) return true;
+		if (_get_time_usec() >= end_usec) break;
+	    }
+	}
+	self->spin_usec = budget / 2;
+	return false;
+    }
+
+    /**
+     * @brief スピン待ち中のCPUへのヒント
+     */
+    static inline void _cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+    }
+
+    /**
+     * @brief 次の実行待ち要素を取り出す
+     * @note 共有キューの期限付き・高優先度の要素、ローカルキュー、共有キュー、スティールの順に探し、なければ眠る。
+     * @param[in] self 自ワーカー
+     * @return 実行待ち要素、終了宣言済みならnullptr
+     */
+    ReadyItem* _next_ready(WorkerInfo* self) {
+	ReadyItem* item = nullptr;
+	if (urgent_ready_.load(std::memory_order_relaxed) == 0 && !_timer_due()) {
+	    item = self->deque.pop();
+	    if (item != nullptr) return item;
+	}
 
+	pthread_mutex_lock(&mutex_);
+	while (item == nullptr) {
+	    // 終了宣言済みか、または、実行待ちがあるとき抜ける
+	    if (stop_) break;
+	    // 期限の来た遅延投入を移し、自分が取る分以外は他のワーカーに任せる
+	    size_t fired = _fire_timers_locked();
+	    if (fired > 1) _wake_workers(fired - 1);
+	    item = _pop_ready_locked();
+	    if (item != nullptr) break;
+	    // 期限付き・高優先度を見に来た場合はローカルキューに戻る
+	    item = self->deque.pop();
+	    if (item != nullptr) break;
+	    // 共有キューが空なら排他範囲外で他ワーカーから盗み、なければ少し待つ
+	    uint64_t epoch = ready_epoch_.load(std::memory_order_seq_cst);
+	    pthread_mutex_unlock(&mutex_);
+	    item = _steal(self);
+	    if (item == nullptr && _spin_for_work(self, epoch)) {
+		pthread_mutex_lock(&mutex_);
+		continue;
+	    }
 	    pthread_mutex_lock(&mutex_);
-	    // 終了宣言済みか、または、実行待ちタスクがあるとき抜ける
-	    while (!stop_ && ready_instances_.empty()) pthread_cond_wait(&cv_, &mutex_);
-	    if (stop_) {
-		pthread_mutex_unlock(&mutex_);
+	    // 先に眠る側として数えてからepochを確認する(ローカルキューへの投入側はepochを進めてから数を見る)
+	    parked_workers_.fetch_add(1, std::memory_order_seq_cst);
+	    if (item == nullptr && !stop_ && _nonempty_ready_lanes() == 0 && edf_queue_.empty() &&
+		epoch == ready_epoch_.load(std::memory_order_seq_cst)) {
+		int64_t park_usec = _get_time_usec();
+		int64_t wake_usec = timers_.empty() ? 0 : timers_.top().when_usec;
+		if (num_of_threads_ > config_.min_threads) {
+		    // 最小数を超えている間は、仕事のないまま一定時間経ったワーカーと上限を超えた分が自ら終了する
+		    int64_t retire_usec = static_cast<int64_t>(self->last_active_ms.load(std::memory_order_relaxed) + config_.idle_timeout_msec) * 1000;
+		    if (park_usec >= retire_usec || num_of_threads_ > _thread_limit_locked()) {
+			parked_workers_.fetch_sub(1, std::memory_order_seq_cst);
+			_retire_worker_locked(self);
+			break;
+		    }
+		    if (wake_usec == 0 || retire_usec < wake_usec) wake_usec = retire_usec;
+		}
+		if (wake_usec == 0) {
+		    pthread_cond_wait(&cv_, &mutex_);
+		} else {
+		    // 最も早い遅延投入の時刻か終了を判断する時刻まで眠る
+		    struct timespec ts;
+		    clock_gettime(CLOCK_MONOTONIC, &ts);
+		    int64_t wait_usec = std::max<int64_t>(wake_usec - _get_time_usec(), 0);
+		    int64_t nsec = ts.tv_nsec + (wait_usec % 1000000) * 1000;
+		    ts.tv_sec += wait_usec / 1000000 + nsec / 1000000000;
+		    ts.tv_nsec = nsec % 1000000000;
+		    pthread_cond_timedwait(&cv_, &mutex_, &ts);
+		}
+		// 待っていれば間に合う間隔で起こされたなら次は最大まで待つ
+		uint32_t max_spin = idle_spin_usec_.load(std::memory_order_relaxed);
+		if (_get_time_usec() - park_usec <= static_cast<int64_t>(max_spin)) self->spin_usec = max_spin;
+	    }
+	    parked_workers_.fetch_sub(1, std::memory_order_seq_cst);
+	}
+	pthread_mutex_unlock(&mutex_);
+	return item;
+    }
+
+    /**
+     * @brief インスタンスのメールボックスを処理する
+     * @note runningを立てたワーカーだけがメールボックスの消費者になる。
+     * @param[in] info インスタンス情報
+     */
+    void _run_instance(InstanceInfo* info) {
+	if (info->held_barrier != nullptr) {
+	    // パラレル実行の完了を待っていたバリアから再開
+	    TaskNode* barrier = info->held_barrier;
+	    info->held_barrier = nullptr;
+	    if (info->detached.load(std::memory_order_acquire)) {
+		info->barriers.fetch_sub(1, std::memory_order_seq_cst);
+		_cancel_task(barrier);
+	    } else {
+		_run_barrier(info, barrier);
+	    }
+	}
+	for (int n = 0; n < FJDISPATCHLITE_MAILBOX_BATCH; ++n) {
+	    if (info->detached.load(std::memory_order_acquire)) {
+		// 登録解除済みなら残りは取り消す
+		_cancel_mailbox(info);
 		break;
 	    }
-	    // インスタンスをpop
-	    inst = ready_instances_.front();
-	    ready_instances_.pop();
-	    auto& inst_info = instance_map_[inst];
-	    if (inst_info.task_queue.empty()) {
-		// インスタンスのタスクキューが空ならば止める
-		inst_info.running = false;
-		pthread_mutex_unlock(&mutex_);
+	    // lane_pendingはpush後に増やすので、正ならそのレーンから必ず取り出せる
+	    // (バリアはbarriersを増やしてから積むので、レーンを見た後に確認する)
+	    unsigned nonempty = _nonempty_lanes(info);
+	    int l = info->barriers.load(std::memory_order_seq_cst) > 0 ? _oldest_lane(info, nonempty) : _select_lane(info->selector, nonempty);
+	    if (l < 0) break;
+	    TaskNode* item = static_cast<TaskNode*>(info->mailbox[l].pop());
+	    info->lane_pending[l].fetch_sub(1, std::memory_order_seq_cst);
+	    info->pending.fetch_sub(1, std::memory_order_seq_cst);
+	    if (item->kind == KIND_DEFERRED) {
+		// バリアを越えたパラレル実行のタスクは実行待ちキューへ
+		item->kind = KIND_NORMAL;
+		info->parallel_inflight.fetch_add(1, std::memory_order_seq_cst);
+		_instance_retain(info);
+		item->parallel_info = info;
+		_push_ready(item);
 		continue;
 	    }
-	    // タスクの所有権をタスクキューからこのコンテキストに移動
-	    task = std::move(inst_info.task_queue.front());
-	    inst_info.task_queue.pop();
-	    pthread_mutex_unlock(&mutex_);
+	    if (item->kind == KIND_BARRIER) {
+		if (!_barrier_ready(info, item)) return;
+		_run_barrier(info, item);
+		continue;
+	    }
+	    if (_shed_overflow(item, info)) continue;
+	    if (!_check_deadline(item, info)) continue;
+	    // タスク実行(排他範囲外にしておくこと)
+	    _execute(item, info);
+	}
+	if (info->pending.load(std::memory_order_seq_cst) > 0) {
+	    // まだメールボックスが空でなかったら最も高い空でないレーンで実行待ちに再登録
+	    _requeue_instance(info);
+	    return;
+	}
+	_stop_instance(info);
+    }
 
-            // タスク実行(排他範囲外にしておくこと)
-            (*task)();
+    /**
+     * @brief 処理するものがなくなったインスタンスを止める
+     * @note runningを下ろし、消費者として持っていた参照を手放す。
+     * @param[in] info インスタンス情報(runningを立てた状態)
+     */
+    void _stop_instance(InstanceInfo* info) {
+	info->running.store(false, std::memory_order_seq_cst);
+	_notify_drained(info);
+	// 止めた直後に積まれたものを取りこぼさない
+	if (info->pending.load(std::memory_order_seq_cst) > 0 &&
+	    !info->running.exchange(true, std::memory_order_seq_cst)) {
+	    _requeue_instance(info);
+	    return;
+	}
+	_instance_release(info);
+    }
 
-	    pthread_mutex_lock(&mutex_);
+    /**
+     * @brief メールボックスに残ったタスクを全て取り消す
+     * @param[in] info インスタンス情報(runningを立てた状態)
+     */
+    void _cancel_mailbox(InstanceInfo* info) {
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    while (info->lane_pending[l].load(std::memory_order_seq_cst) > 0) {
+		TaskNode* item = static_cast<TaskNode*>(info->mailbox[l].pop());
+		info->lane_pending[l].fetch_sub(1, std::memory_order_seq_cst);
+		info->pending.fetch_sub(1, std::memory_order_seq_cst);
+		if (item->kind == KIND_BARRIER) info->barriers.fetch_sub(1, std::memory_order_seq_cst);
+		_cancel_task(item);
+	    }
+	}
+    }
 
-	    for (auto& w : workers_) {
-		if (pthread_self() == w.thread) {
-		    w.last_active_ms = _get_time();
-		    w.task_srcfunc.clear();
-		    break;
-		}
+    /**
+     * @brief タスクを実行せずに取り消す
+     * @param[in] node タスクノード(所有権を移す)
+     */
+    void _cancel_task(TaskNode* node) {
+	// cancel()済みなら数えて登録済み
+	if (_claim_resultitem(node->handle)) {
+	    tasks_cancelled_.fetch_add(1, std::memory_order_relaxed);
+	    if (node->handle != 0) _post_resultitem(node->handle, FJDISPATCHLITE_RESULT_CANCELLED);
+	}
+	_free_task_node(node);
+    }
+
+    /**
+     * @brief インスタンス情報の参照を増やす
+     */
+    static void _instance_retain(InstanceInfo* info) {
+	info->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief インスタンス情報の参照を減らし、なくなったら解放する
+     * @note 解放時にロックは取らないので、mutex_を保持したままでも呼べる。
+     */
+    void _instance_release(InstanceInfo* info) {
+	if (info->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	instances_live_.fetch_sub(1, std::memory_order_relaxed);
+	delete info;
+    }
+
+    /**
+     * @brief インスタンスで中断する処理の再開待ちを登録する
+     * @note インスタンスの実行中(中断する直前)に呼ぶこと。以降の再開はobjではなくインスタンス情報を介して積む。
+     *       再開する側は_claim_suspension()が成功したら_resume_suspension()で積み、失敗したらそれ以上触れないこと。
+     * @param[in] obj 再開先のインスタンス
+     * @param[in] run 再開
+     * @param[in] discard 再開できなくなったときの破棄(登録解除したスレッド、または取り消されたタスクの破棄で呼ぶ)
+     * @param[in] ctx run, discardに渡す引数
+     * @return 再開待ち(再開する側の参照を1つ持つ)
+     */
+    Suspension* _suspend(FJUnitFrames* obj, void (*run)(void*), void (*discard)(void*), void* ctx) {
+	InstanceInfo* info = _instance_info(obj);
+	_instance_retain(info);
+	Suspension* s = new Suspension();
+	s->run = run;
+	s->discard = discard;
+	s->ctx = ctx;
+	s->info = info;
+	// 登録解除後につないだものは取り消されないが、再開時に積んだタスクが取り消されて破棄する
+	pthread_mutex_lock(&info->suspend_mutex);
+	s->next = info->suspended;
+	if (s->next != nullptr) s->next->prev = s;
+	info->suspended = s;
+	pthread_mutex_unlock(&info->suspend_mutex);
+	return s;
+    }
+
+    /**
+     * @brief 再開する権利を取る
+     * @note 失敗したら登録解除で破棄済みなので、再開する側の参照を手放す。
+     * @param[in] s 再開待ち
+     * @retval [true] 取った(_resume_suspension()で積むこと)
+     * @retval [false] 取り消されていた
+     */
+    static bool _claim_suspension(Suspension* s) {
+	int expected = SUSPEND_WAITING;
+	if (!s->state.compare_exchange_strong(expected, SUSPEND_CLAIMED, std::memory_order_acq_rel)) {
+	    _release_suspension(s);
+	    return false;
+	}
+	InstanceInfo* info = s->info;
+	pthread_mutex_lock(&info->suspend_mutex);
+	bool linked = s->linked;
+	if (linked) {
+	    if (s->prev != nullptr) s->prev->next = s->next;
+	    else info->suspended = s->next;
+	    if (s->next != nullptr) s->next->prev = s->prev;
+	    s->linked = false;
+	}
+	pthread_mutex_unlock(&info->suspend_mutex);
+	// リストから外した側がリストの参照を手放す
+	if (linked) _release_suspension(s);
+	return true;
+    }
+
+    /**
+     * @brief 再開待ちの参照を手放す
+     * @param[in] s 再開待ち
+     */
+    static void _release_suspension(Suspension* s) {
+	if (s->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	InstanceInfo* info = s->info;
+	delete s;
+	info->owner->_instance_release(info);
+    }
+
+    /**
+     * @brief 再開をインスタンスのシーケンシャル実行として積む
+     * @note キューの上限の対象にはしない。取り消されたら(登録解除後に積んだ場合を含む)discardを呼ぶ。
+     * @param[in] s 再開待ち(再開する側の参照を引き取る)
+     * @param[in] delay_msec 再開までの遅延(msec)
+     * @param[in] claimed [true]:_claim_suspension()済み, [false]:実行時に取り、登録解除で取り消されていれば何もしない
+     */
+    static void _resume_suspension(Suspension* s, uint32_t delay_msec, bool claimed) {
+	FJDispatchLite* self = s->info->owner;
+	InstanceInfo* info = s->info;
+	TaskNode* node = self->_new_task_node(0, nullptr, 0, FJPostAttr());
+	_bind_callable(node, SuspensionTask(s, claimed));
+	if (delay_msec > 0) {
+	    self->_post_delayed(info, node, true, _get_time_usec() + static_cast<int64_t>(delay_msec) * 1000);
+	    return;
+	}
+	ReadyItem* ready = self->_enqueue_mailbox(info, node);
+	if (ready != nullptr) self->_push_ready(ready);
+    }
+
+    /**
+     * @brief 再開待ちを再開するタスク
+     * @note 実行されずに破棄されたら(取り消し等)discardを呼ぶ。
+     */
+    class SuspensionTask {
+    public:
+	SuspensionTask(Suspension* s, bool claimed) : s_(s), claimed_(claimed) {}
+	SuspensionTask(SuspensionTask&& other) : s_(other.s_), claimed_(other.claimed_) {
+	    other.s_ = nullptr;
+	}
+
+	~SuspensionTask() {
+	    if (s_ != nullptr && (claimed_ || _claim_suspension(s_))) {
+		s_->discard(s_->ctx);
+		_release_suspension(s_);
 	    }
-	    if (!inst_info.task_queue.empty()) {
-		// まだタスクキューが空でなかったら実行待ちタスクに登録
-		ready_instances_.push(inst);
-		pthread_cond_signal(&cv_);
-	    } else {
-		// このインスタンスで処理するものがなかったら止める
-		inst_info.running = false;
+	}
+
+	int operator()(TaskNode*) {
+	    Suspension* s = s_;
+	    s_ = nullptr;
+	    if (claimed_ || _claim_suspension(s)) {
+		s->run(s->ctx);
+		_release_suspension(s);
 	    }
+	    return 0;
+	}
 
-	    pthread_mutex_unlock(&mutex_);
+	SuspensionTask(const SuspensionTask&) = delete;
+	SuspensionTask& operator=(const SuspensionTask&) = delete;
+
+    private:
+	Suspension* s_; //!< 再開待ち(再開する側の参照を持つ、実行または破棄でnullptr)
+	bool claimed_; //!< 再開する権利を取ってあるか
+    };
+
+    /**
+     * @brief 登録解除したインスタンスの再開待ちを全て取り消す
+     * @note 再開する側より先に取り消したものはここでdiscardを呼ぶ。
+     * @param[in] info インスタンス情報(detachedを立てた状態)
+     */
+    static void _cancel_suspensions(InstanceInfo* info) {
+	pthread_mutex_lock(&info->suspend_mutex);
+	Suspension* list = info->suspended;
+	info->suspended = nullptr;
+	for (Suspension* s = list; s != nullptr; s = s->next) s->linked = false;
+	pthread_mutex_unlock(&info->suspend_mutex);
+	while (list != nullptr) {
+	    Suspension* s = list;
+	    list = s->next;
+	    int expected = SUSPEND_WAITING;
+	    if (s->state.compare_exchange_strong(expected, SUSPEND_CANCELLED, std::memory_order_acq_rel)) s->discard(s->ctx);
+	    _release_suspension(s);
+	}
+    }
+
+    /**
+     * @brief 実行中のインスタンスを実行待ちキューに積み直す
+     * @note レーンはメールボックスの最も高い空でないレーンに、期限は各レーン先頭の最も早い期限にする。
+     * @param[in] info インスタンス情報(runningを立てた状態)
+     */
+    void _requeue_instance(InstanceInfo* info) {
+	unsigned bits = _nonempty_lanes(info);
+	int lane = -1;
+	int64_t deadline = 0;
+	for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	    if (!(bits & (1u << l))) continue;
+	    if (lane < 0) lane = l;
+	    FJMpscNode* head = info->mailbox[l].peek();
+	    if (head == nullptr) continue;
+	    int64_t d = static_cast<TaskNode*>(head)->deadline_usec;
+	    if (d != 0 && (deadline == 0 || d < deadline)) deadline = d;
+	}
+	info->lane = lane < 0 ? C_MESSAGE_LOW : lane;
+	info->deadline_usec = deadline;
+	_push_ready(info);
+    }
+
+    /**
+     * @brief ワーカースレッドの実装
+     * @param[in] self 自ワーカー
+     */
+    void workerThread(WorkerInfo* self) {
+        while (true) {
+	    ReadyItem* item = _next_ready(self);
+	    if (item == nullptr) break;
+
+	    if (item->is_instance) {
+		_run_instance(static_cast<InstanceInfo*>(item));
+	    } else {
+		TaskNode* node = static_cast<TaskNode*>(item);
+		if (node->parallel_info != nullptr && node->parallel_info->detached.load(std::memory_order_acquire)) {
+		    // 登録解除済みのインスタンスのパラレル実行は取り消す
+		    _cancel_task(node);
+		} else if (node->parallel_info != nullptr && _shed_overflow(node, node->parallel_info)) {
+		    // 上限を超えた古いパラレル実行は破棄した
+		} else if (_check_deadline(node, nullptr)) {
+		    _execute(node);
+		}
+	    }
+	    // last_active_msは_execute()が終了時刻で更新する
 	}
     }
 
 private:
     pthread_mutex_t mutex_; //!< 排他
     pthread_cond_t cv_; //!< 状態変数
-    bool stop_; //!< 終了宣言変数
-    std::vector<WorkerInfo> workers_; //!< ワーカースレッド
+    std::atomic<bool> stop_; //!< 終了宣言変数(モニターはmutex_外で参照する)
+    const Config config_; //!< ワーカープールの設定(生成後は変更しない)
+    const std::string name_; //!< キュー名
+    const QoS qos_; //!< QoSクラス
+    std::unique_ptr<WorkerInfo[]> workers_; //!< ワーカースレッド(config_.max_threadsスロット)
+    std::atomic<size_t> workers_used_{0}; //!< 使用したことのあるスロット数
     size_t num_of_threads_ = FJDISPATCHLITE_DEFAULT_THREADS; //!< ワーカースレッドの数
+    std::atomic<SchedMode> sched_mode_; //!< スケジューラ方式
+    size_t peak_threads_ = 0; //!< ワーカー数の最大(mutex_)
+    std::atomic<uint64_t> workers_grown_{0}; //!< 増やしたワーカーの累計
+    std::atomic<uint64_t> workers_retired_{0}; //!< 自ら終了したワーカーの累計
+    std::atomic<uint64_t> workers_compensated_{0}; //!< max_threadsを超えて足したワーカーの累計
+    size_t blocking_workers_ = 0; //!< beginBlocking()中のワーカー数(mutex_)
+    size_t hung_workers_ = 0; //!< 申告なしに固まっているワーカー数(モニターが更新、mutex_)
+    std::atomic<int64_t> scale_eval_usec_{0}; //!< ワーカー数を前回見直した時刻(書き込みはmutex_の中)
+    uint64_t scale_count_ = 0; //!< 前回の見直し時の開始したタスク数の累計(mutex_)
+    uint64_t scale_delay_total_ = 0; //!< 前回の見直し時のキュー遅延の合計(mutex_)
+    uint64_t scale_busy_ = 0; //!< 前回の見直し時のワーカーの実行時間の合計(mutex_)
+    uint64_t scale_delay_usec_ = 0; //!< 直近の見直し時の平均キュー遅延(mutex_)
+    uint32_t scale_util_ = 0; //!< 直近の見直し時のワーカー稼働率(%、mutex_)
+    std::atomic<int> parked_workers_{0}; //!< 眠っているワーカーの数(mutex_の中で増減する)
+    std::atomic<size_t> shared_ready_{0}; //!< 共有キュー(優先度レーンとEDF)の要素数(ロック外での確認用)
+    std::atomic<uint32_t> idle_spin_usec_; //!< ワーカーが眠る前に実行待ちを待つ最大時間(usec)
+    std::atomic<uint64_t> ready_epoch_{0}; //!< ローカルキューへ積むたびに進むカウンタ
 
-    std::unordered_map<FJUnitFrames*, InstanceInfo> instance_map_; //!< インスタンス管理テーブル
-    std::queue<FJUnitFrames*> ready_instances_; //!< 実行待ちタスク
+    std::unordered_map<FJUnitFrames*, InstanceInfo*> instance_map_; //!< インスタンス管理テーブル(登録・解除時のみmutex_で参照、参照を1つ持つ)
+    int cache_slot_ = -1; //!< FJUnitFrames::dispatch_info_のうちこのキューが使う要素(-1なら使わず毎回管理テーブルを引く)
+    std::atomic<size_t> instances_live_{0}; //!< 確保中のインスタンス情報の数
+    std::atomic<uint64_t> instances_detached_{0}; //!< 登録解除した累計
+    std::atomic<uint64_t> tasks_cancelled_{0}; //!< 登録解除またはcancel()で取り消したタスクの累計
+    std::atomic<uint64_t> events_coalesced_{0}; //!< 開始前の同じイベントに相乗りした累計
+    std::atomic<int64_t> queued_tasks_{0}; //!< 上限の対象として数えている未完了のタスク数
+    std::atomic<size_t> queue_limit_{0}; //!< キュー全体の上限(0なら無制限)
+    std::atomic<int> queue_policy_{OVERFLOW_BLOCK}; //!< キュー全体の上限を超えたときの扱い
+    std::atomic<size_t> instance_limit_{0}; //!< インスタンスごとの上限の既定値(0なら無制限)
+    std::atomic<int> instance_policy_{OVERFLOW_BLOCK}; //!< インスタンスごとの上限を超えたときの扱いの既定値
+    std::atomic<uint32_t> block_timeout_msec_{FJDISPATCHLITE_BLOCK_TIMEOUT_MSEC}; //!< OVERFLOW_BLOCKの最大待ち時間
+    std::atomic<uint32_t> admit_seq_{0}; //!< 上限の対象のタスクが完了するたびに進むfutexワード
+    std::atomic<uint32_t> admit_waiters_{0}; //!< 空きを待っている投入側の数
+    std::atomic<uint64_t> tasks_rejected_{0}; //!< 受け付けなかった累計
+    std::atomic<uint64_t> tasks_shed_{0}; //!< 上限を超えて古いものから破棄した累計
+    std::atomic<uint64_t> producers_blocked_{0}; //!< 投入側を待たせた累計
+    std::atomic<size_t> high_watermark_{0}; //!< 高水位(0なら通知しない)
+    std::atomic<size_t> low_watermark_{0}; //!< 低水位
+    std::atomic<bool> above_high_{false}; //!< 高水位に達してから低水位まで戻っていないか
+    pthread_mutex_t watermark_mutex_; //!< 水位通知の排他(通知の中からの投入で再入するので再帰ロック)
+    std::function<void(bool)> watermark_fn_; //!< 水位の通知先(watermark_mutex_で保護)
+    bool watermark_notified_ = false; //!< 最後に通知した状態(watermark_mutex_で保護)
+    std::queue<ReadyItem*> ready_queue_[FJDISPATCHLITE_PRIO_LANES]; //!< 優先度レーンごとの実行待ちキュー(インスタンスまたはパラレル実行のタスク)
+    LaneSelector ready_selector_; //!< 実行待ちキューの重み付き選択の状態(mutex_で保護)
+    std::priority_queue<ReadyItem*, std::vector<ReadyItem*>, DeadlineLater> edf_queue_; //!< EDF順の実行待ちキュー(mutex_で保護)
+    std::priority_queue<DelayedItem, std::vector<DelayedItem>, std::greater<DelayedItem>> timers_; //!< 遅延投入(時刻順、mutex_で保護)
+    uint64_t timer_seq_ = 0; //!< 遅延投入の通し番号(mutex_で保護)
+    std::atomic<int64_t> next_timer_usec_{INT64_MAX}; //!< 最も早い遅延投入の時刻(なければINT64_MAX)
+    std::atomic<size_t> urgent_ready_{0}; //!< 共有キューのEDF順とC_MESSAGE_HIGHレーンの要素数(ロック外での確認用)
+    std::atomic<bool> edf_enabled_{false}; //!< 期限付きの要素をEDF順で取り出すか
+    std::atomic<uint64_t> deadline_met_{0}; //!< 期限内に実行を開始した数
+    std::atomic<uint64_t> deadline_missed_{0}; //!< 期限を過ぎていた数
+    std::atomic<uint64_t> deadline_dropped_{0}; //!< 期限切れで破棄した数
+    std::atomic<uint64_t> deadline_demoted_{0}; //!< 期限切れで降格した数
+    std::atomic<PrioPolicy> prio_policy_{PRIO_STRICT}; //!< 優先度レーンの選択方式
+    std::atomic<uint32_t> prio_weights_[FJDISPATCHLITE_PRIO_LANES]; //!< 重み付き方式でのレーンごとの連続処理数
 
-    pthread_mutex_t result_mutex_; //!< リザルト排他
-    pthread_cond_t result_cv_; //!< リザルト状態変数
-    std::unordered_map<fjt_handle_t, std::shared_ptr<ResultItem>> results_; //!< リザルトテーブル
-    std::deque<fjt_handle_t> result_order_;  //! 順序付きでリザルト保存
-    fjt_handle_t handle_counter_ = 0; //!< ハンドルカウンタ
+    /**
+     * @brief レーンごとの統計カウンタ
+     */
+    struct LaneCounters {
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> total_delay_usec{0};
+	std::atomic<uint64_t> max_delay_usec{0};
+    };
+    LaneCounters lane_stats_[FJDISPATCHLITE_PRIO_LANES]; //!< レーンごとのキュー遅延統計
+#if FJDISPATCHLITE_LATENCY_STATS == 1
+    FJLatencyTable latency_other_; //!< ワーカー以外のスレッドで実行したタスクのレイテンシ(複数スレッドが書き込む)
+#endif
+
+    FJSlabPool task_pool_; //!< タスクノードのプール
+    std::unique_ptr<FJSlabPool> payload_pools_[FJDISPATCHLITE_PAYLOAD_CLASSES]; //!< 大きいデータのサイズクラス別スラブ
+
+    std::unique_ptr<ResultItem[]> results_; //!< リザルトスロット(Config::max_results個)
+    size_t result_mask_ = 0; //!< スロット番号を取り出すマスク(Config::max_results - 1)
+    std::atomic<fjt_handle_t> handle_counter_{0}; //!< ハンドルカウンタ
+    char completion_pad_[FJDISPATCHLITE_CACHE_LINE]; //!< 投入側が書くメンバと結果登録で書くメンバの詰め物(C++14のnewは64バイト境界を保証しない)
+    std::atomic<uint32_t> completion_seq_{0}; //!< waitAll/waitAny中の結果登録で進むfutexワード
+    std::atomic<uint32_t> result_free_seq_{0}; //!< 結果スロットの空きを待つ投入側がいるとき結果登録で進むfutexワード
+    std::atomic<uint32_t> result_waiters_{0}; //!< 結果スロットの空きを待っている投入側の数
+    std::atomic<uint32_t> completion_waiters_{0}; //!< waitAll/waitAny中のスレッド数
+    pthread_mutex_t result_watch_mutex_; //!< result_watches_の排他
+    std::vector<ResultWatch> result_watches_; //!< whenResult()の継続(少数の想定なので線形に探す)
+    std::atomic<uint32_t> result_watch_count_{0}; //!< result_watches_の要素数(0なら結果の登録で一覧を見ない)
 
     pthread_t monitor_thread_; //!< モニタースレッド
+    std::atomic<uint32_t> monitor_wake_{0}; //!< モニターの待機を打ち切るfutexワード(終了時に1)
 };
 
-#endif //__FJDISPATCHLITE_H__
+/**
+ * @brief ワーカーを塞ぐ処理の範囲を示すスコープガード
+ * @note ハンドラ内でディスクI/Oや他の結果待ちなどで長く塞がる前に置くと、その間だけ代わりのワーカーが足される。
+ *       ワーカースレッド以外で使った場合は何もしない。
+ * @code
+ *     {
+ *         FJBlockingScope blocking;
+ *         read(fd, buf, len);
+ *     }
+ * @endcode
+ */
+class FJBlockingScope {
+public:
+    FJBlockingScope() {
+	FJDispatchLite::beginBlocking();
+    }
+
+    ~FJBlockingScope() {
+	FJDispatchLite::endBlocking();
+    }
+
+    FJBlockingScope(const FJBlockingScope&) = delete;
+    FJBlockingScope& operator=(const FJBlockingScope&) = delete;
+};
 
+#endif //__FJDISPATCHLITE_H__
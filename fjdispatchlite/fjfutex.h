@@ -0,0 +1,117 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjfutex.h
+ * @author FJD
+ * @brief プロセス内用futexの薄いラッパ
+ * @date 2026.10.16
+ */
+#ifndef __FJFUTEX_H__
+#define __FJFUTEX_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/**
+ * @brief 32bitワード単位の待ち合わせ
+ * @note 待つ側は「値がexpectedのままなら眠る」、起こす側は値を変えてからwake()する。
+ */
+class FJFutex {
+public:
+    /**
+     * @brief 値がexpectedの間眠る
+     * @param[in] word 待ち合わせワード
+     * @param[in] expected 期待値
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @note 値の変化、wake()、タイムアウト、シグナルのいずれでも戻るので、呼び出し側で条件を再確認すること。
+     */
+    static void wait(std::atomic<uint32_t>* word, uint32_t expected, int64_t timeout_msec) {
+	struct timespec ts;
+	struct timespec* pts = nullptr;
+	if (timeout_msec >= 0) {
+	    ts.tv_sec = timeout_msec / 1000;
+	    ts.tv_nsec = (timeout_msec % 1000) * 1000000L;
+	    pts = &ts;
+	}
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+    }
+
+    /**
+     * @brief 眠っているスレッドを起こす
+     * @param[in] word 待ち合わせワード
+     * @param[in] count 起こす最大数(既定は全員)
+     */
+    static void wake(std::atomic<uint32_t>* word, int count = INT_MAX) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+};
+
+/**
+ * @brief 呼び出し元のスレッドが塞がることを知らせる先
+ * @note fjdispatchlite.hがワーカーの代わりを足す関数(FJDispatchLite::beginBlocking()等)を登録する。
+ *       fjdispatchlite.hを参照できない待ち合わせ(FJDispatchGroup, FJFuture)が眠る前後に呼ぶ。未登録なら何もしない。
+ */
+class FJBlockingHook {
+public:
+    typedef void (*Fn)(); //!< 通知先
+
+    /**
+     * @brief 塞がる処理に入る
+     */
+    static void begin() {
+	Fn fn = _begin().load(std::memory_order_acquire);
+	if (fn != nullptr) fn();
+    }
+
+    /**
+     * @brief 塞がる処理を終える
+     */
+    static void end() {
+	Fn fn = _end().load(std::memory_order_acquire);
+	if (fn != nullptr) fn();
+    }
+
+    /**
+     * @brief 通知先を登録する
+     * @param[in] begin 塞がる処理に入るときに呼ぶ関数
+     * @param[in] end 塞がる処理を終えたときに呼ぶ関数
+     */
+    static void set(Fn begin, Fn end) {
+	_begin().store(begin, std::memory_order_release);
+	_end().store(end, std::memory_order_release);
+    }
+
+private:
+    static std::atomic<Fn>& _begin() {
+	static std::atomic<Fn> fn(nullptr);
+	return fn;
+    }
+
+    static std::atomic<Fn>& _end() {
+	static std::atomic<Fn> fn(nullptr);
+	return fn;
+    }
+};
+
+#endif //__FJFUTEX_H__
@@ -0,0 +1,464 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjfuture.h
+ * @author FJD
+ * @brief 型付きの実行結果と継続
+ * @date 2026.10.16
+ */
+#ifndef __FJFUTURE_H__
+#define __FJFUTURE_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#endif
+
+#include "fjtypes.h"
+#include "fjfutex.h"
+
+/**
+ * @brief 結果の格納領域
+ */
+template <typename R>
+class FJFutureStorage {
+public:
+    ~FJFutureStorage() {
+	if (has_) value().~R();
+    }
+
+    /**
+     * @brief 値の格納(完了前に一度だけ)
+     */
+    void setValue(R&& v) {
+	new (buf_) R(std::move(v));
+	has_ = true;
+    }
+
+    /**
+     * @brief 格納した値
+     */
+    R& value() {
+	return *reinterpret_cast<R*>(buf_);
+    }
+
+private:
+    alignas(R) unsigned char buf_[sizeof(R)]; //!< 値
+    bool has_ = false; //!< 値を格納したか
+};
+
+/**
+ * @brief 結果の格納領域(void)
+ */
+template <>
+class FJFutureStorage<void> {
+};
+
+/**
+ * @brief 結果の共有状態
+ * @note 参照カウントで、FJFutureと実行するタスク(または継続)が1つずつ参照を持つ。
+ *       継続は完了前に登録されれば完了したスレッドでそのまま、完了後に登録されればscheduleで投げ直して実行する。
+ */
+template <typename R>
+class FJFutureState : public FJFutureStorage<R> {
+public:
+    typedef void (*Schedule)(void* ctx, std::function<void()>&& fn); //!< 継続を実行待ちに積む関数
+    typedef std::function<void(FJFutureState*)> Continuation; //!< 継続(完了した状態を受け取る)
+
+    /**
+     * @brief コンストラクタ
+     * @note 参照カウントは2(FJFutureと実行する側)で始まる。
+     * @param[in] schedule 完了後に登録された継続を積む関数
+     * @param[in] ctx scheduleに渡す引数
+     */
+    FJFutureState(Schedule schedule, void* ctx)
+	: refs_(2), ready_(0), waiters_(0), stage_(STAGE_EMPTY), ok_(false), schedule_(schedule), ctx_(ctx) {}
+
+    /**
+     * @brief 参照を増やす
+     */
+    void retain() {
+	refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 参照を減らし、なくなったら破棄する
+     */
+    void release() {
+	if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    /**
+     * @brief 完了させる
+     * @note 値はsetValue()で先に格納しておくこと。
+     * @param[in] ok [true]:値あり, [false]:実行されずに破棄された
+     */
+    void complete(bool ok) {
+	ok_ = ok;
+	ready_.store(1, std::memory_order_seq_cst);
+	if (waiters_.load(std::memory_order_seq_cst) > 0) FJFutex::wake(&ready_);
+	if (stage_.exchange(STAGE_DONE, std::memory_order_acq_rel) == STAGE_CONT) {
+	    // 先に登録された継続はこのスレッドで実行する
+	    Continuation cont = std::move(cont_);
+	    cont(this);
+	}
+    }
+
+    /**
+     * @brief 継続を登録する(一度だけ)
+     * @param[in] cont 継続
+     */
+    void setContinuation(Continuation&& cont) {
+	cont_ = std::move(cont);
+	if (stage_.exchange(STAGE_CONT, std::memory_order_acq_rel) == STAGE_DONE) {
+	    // 既に完了していたので実行待ちに積む
+	    stage_.store(STAGE_DONE, std::memory_order_relaxed);
+	    retain();
+	    FJFutureState* self = this;
+	    Continuation c = std::move(cont_);
+	    schedule_(ctx_, [self, c]() {
+		c(self);
+		self->release();
+	    });
+	}
+    }
+
+    /**
+     * @brief 完了を待つ
+     * @note ワーカースレッドから待つ間は塞がっているものとして扱う(FJBlockingHook参照)。
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @retval [true] 完了した
+     * @retval [false] タイムアウト
+     */
+    bool wait(int64_t timeout_msec) {
+	if (ready_.load(std::memory_order_acquire) != 0) return true;
+	int64_t start = _get_time();
+	waiters_.fetch_add(1, std::memory_order_seq_cst);
+	bool done = false;
+	bool blocking = false;
+	while (true) {
+	    if (ready_.load(std::memory_order_seq_cst) != 0) {
+		done = true;
+		break;
+	    }
+	    int64_t remain = -1;
+	    if (timeout_msec >= 0) {
+		remain = timeout_msec - (_get_time() - start);
+		if (remain <= 0) break;
+	    }
+	    if (!blocking) {
+		FJBlockingHook::begin();
+		blocking = true;
+	    }
+	    FJFutex::wait(&ready_, 0, remain);
+	}
+	if (blocking) FJBlockingHook::end();
+	waiters_.fetch_sub(1, std::memory_order_seq_cst);
+	return done;
+    }
+
+    /**
+     * @brief 完了したか
+     */
+    bool ready() const {
+	return ready_.load(std::memory_order_acquire) != 0;
+    }
+
+    /**
+     * @brief 値があるか(完了後に参照すること)
+     */
+    bool ok() const {
+	return ok_;
+    }
+
+    Schedule schedule() const {
+	return schedule_;
+    }
+
+    void* context() const {
+	return ctx_;
+    }
+
+private:
+    enum {
+	STAGE_EMPTY, //!< 未完了、継続なし
+	STAGE_CONT, //!< 未完了、継続あり
+	STAGE_DONE, //!< 完了
+    };
+
+    std::atomic<int> refs_; //!< 参照カウント
+    std::atomic<uint32_t> ready_; //!< 完了したら1になるfutexワード
+    std::atomic<uint32_t> waiters_; //!< wait()中のスレッド数
+    std::atomic<int> stage_; //!< 継続の登録と完了の競合解決
+    bool ok_; //!< 値があるか(ready_で公開)
+    Continuation cont_; //!< 継続
+    Schedule schedule_; //!< 完了後に登録された継続を積む関数
+    void* ctx_; //!< scheduleに渡す引数
+};
+
+/**
+ * @brief 呼び出し結果を共有状態に格納して完了させる
+ */
+template <typename R>
+struct FJFutureSetter {
+    template <typename F>
+    static void run(FJFutureState<R>* state, F&& f) {
+	state->setValue(f());
+	state->complete(true);
+    }
+};
+
+template <>
+struct FJFutureSetter<void> {
+    template <typename F>
+    static void run(FJFutureState<void>* state, F&& f) {
+	f();
+	state->complete(true);
+    }
+};
+
+/**
+ * @brief 継続に前段の値を渡して呼び出す
+ */
+template <typename R, typename F>
+struct FJFutureApply {
+    typedef decltype(std::declval<F&>()(std::declval<R>())) type; //!< 継続の返り値型
+
+    static type call(F& f, FJFutureState<R>* state) {
+	return f(std::move(state->value()));
+    }
+};
+
+template <typename F>
+struct FJFutureApply<void, F> {
+    typedef decltype(std::declval<F&>()()) type; //!< 継続の返り値型
+
+    static type call(F& f, FJFutureState<void>*) {
+	return f();
+    }
+};
+
+/**
+ * @brief ディスパッチャで実行するタスク本体
+ * @note 実行されずに破棄されたとき(実行開始期限切れ等)は値なしで完了させる。
+ */
+template <typename R, typename F>
+class FJFutureTask {
+public:
+    FJFutureTask(FJFutureState<R>* state, F&& f) : state_(state), f_(std::move(f)) {}
+
+    FJFutureTask(FJFutureTask&& other) : state_(other.state_), f_(std::move(other.f_)) {
+	other.state_ = nullptr;
+    }
+
+    ~FJFutureTask() {
+	if (state_ != nullptr) {
+	    state_->complete(false);
+	    state_->release();
+	}
+    }
+
+    template <typename Node>
+    int operator()(Node*) {
+	FJFutureState<R>* state = state_;
+	state_ = nullptr;
+	FJFutureSetter<R>::run(state, f_);
+	state->release();
+	return 0;
+    }
+
+    FJFutureTask(const FJFutureTask&) = delete;
+    FJFutureTask& operator=(const FJFutureTask&) = delete;
+
+private:
+    FJFutureState<R>* state_; //!< 共有状態(実行または破棄で手放す)
+    F f_; //!< 呼び出し対象
+};
+
+/**
+ * @brief 値の取り出し
+ */
+template <typename R, typename Derived>
+class FJFutureValue {
+public:
+    /**
+     * @brief 完了を待って値を取り出す
+     * @note 取り出した後の値は未規定(ムーブ済み)。
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @param[out] out 値
+     * @retval [true] 値が取得できた
+     * @retval [false] タイムアウトしたか、タスクが実行されずに破棄された
+     */
+    bool get(int64_t timeout_msec, R& out) {
+	FJFutureState<R>* state = static_cast<Derived*>(this)->state_;
+	if (state == nullptr || !state->wait(timeout_msec) || !state->ok()) return false;
+	out = std::move(state->value());
+	return true;
+    }
+
+    /**
+     * @brief 完了を待って値をfnにムーブして渡す
+     * @note Rが既定構築できない型でも取り出せる。
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @param[in] fn 処理 fn(R&&)
+     * @retval [true] 値を渡した
+     * @retval [false] タイムアウトしたか、タスクが実行されずに破棄された
+     */
+    template <typename F>
+    bool take(int64_t timeout_msec, F&& fn) {
+	FJFutureState<R>* state = static_cast<Derived*>(this)->state_;
+	if (state == nullptr || !state->wait(timeout_msec) || !state->ok()) return false;
+	fn(std::move(state->value()));
+	return true;
+    }
+};
+
+template <typename Derived>
+class FJFutureValue<void, Derived> {
+public:
+    /**
+     * @brief 完了を待つ
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @retval [true] 実行された
+     * @retval [false] タイムアウトしたか、タスクが実行されずに破棄された
+     */
+    bool get(int64_t timeout_msec) {
+	FJFutureState<void>* state = static_cast<Derived*>(this)->state_;
+	return state != nullptr && state->wait(timeout_msec) && state->ok();
+    }
+};
+
+/**
+ * @brief ディスパッチしたタスクの型付きの結果
+ * @note ムーブのみ可能。then()を呼ぶと値は継続に渡り、このFJFutureは無効になる。
+ */
+template <typename R>
+class FJFuture : public FJFutureValue<R, FJFuture<R>> {
+    friend class FJFutureValue<R, FJFuture<R>>;
+
+public:
+    FJFuture() : state_(nullptr) {}
+
+    /**
+     * @brief 共有状態から作る(参照を1つ引き取る)
+     */
+    explicit FJFuture(FJFutureState<R>* state) : state_(state) {}
+
+    FJFuture(FJFuture&& other) : state_(other.state_) {
+	other.state_ = nullptr;
+    }
+
+    FJFuture& operator=(FJFuture&& other) {
+	if (this != &other) {
+	    if (state_ != nullptr) state_->release();
+	    state_ = other.state_;
+	    other.state_ = nullptr;
+	}
+	return *this;
+    }
+
+    ~FJFuture() {
+	if (state_ != nullptr) state_->release();
+    }
+
+    /**
+     * @brief 有効か
+     */
+    bool valid() const {
+	return state_ != nullptr;
+    }
+
+    /**
+     * @brief 完了したか
+     */
+    bool ready() const {
+	return state_ != nullptr && state_->ready();
+    }
+
+    /**
+     * @brief 完了を待つ
+     * @param[in] timeout_msec 最大待ち時間(msec)、負値なら無期限
+     * @retval [true] 完了した(値なしで完了した場合も含む)
+     * @retval [false] タイムアウトか無効
+     */
+    bool wait(int64_t timeout_msec = -1) {
+	return state_ != nullptr && state_->wait(timeout_msec);
+    }
+
+    /**
+     * @brief 継続を登録する
+     * @note 完了前に登録すれば完了したワーカーでそのまま、完了後ならディスパッチャに積んで実行する。
+     *       前段が値なしで完了したときは継続を呼ばず、返すFJFutureも値なしで完了する。
+     *       継続は前段の値(voidなら引数なし)を受け取り、その返り値が次段の値になる。
+     * @param[in] fn 継続(コピー可能であること)
+     * @return 継続の結果、このFJFutureが無効なら無効なFJFuture
+     */
+    template <typename F>
+    FJFuture<typename FJFutureApply<R, typename std::decay<F>::type>::type> then(F&& fn) {
+	typedef typename std::decay<F>::type Fn;
+	typedef typename FJFutureApply<R, Fn>::type R2;
+	if (state_ == nullptr) return FJFuture<R2>();
+	FJFutureState<R>* state = state_;
+	state_ = nullptr;
+	FJFutureState<R2>* next = new FJFutureState<R2>(state->schedule(), state->context());
+	state->setContinuation([next, fn = Fn(std::forward<F>(fn))](FJFutureState<R>* prev) mutable {
+	    if (prev->ok()) {
+		FJFutureSetter<R2>::run(next, [&]() { return FJFutureApply<R, Fn>::call(fn, prev); });
+	    } else {
+		next->complete(false);
+	    }
+	    next->release();
+	});
+	state->release();
+	return FJFuture<R2>(next);
+    }
+
+    /**
+     * @brief 完了時の処理を登録する
+     * @note then()と異なり値なしで完了したときも呼ばれる。fnは完了済みのFJFutureを受け取る。
+     *       実行するスレッドはthen()と同じ。登録後、このFJFutureは無効になる。
+     *       このFJFutureが無効ならその場で無効なFJFutureを渡して呼ぶ。
+     * @param[in] fn 処理(コピー可能であること)
+     */
+    template <typename F>
+    void whenReady(F&& fn) {
+	typedef typename std::decay<F>::type Fn;
+	if (state_ == nullptr) {
+	    fn(FJFuture<R>());
+	    return;
+	}
+	FJFutureState<R>* state = state_;
+	state_ = nullptr;
+	state->setContinuation([fn = Fn(std::forward<F>(fn))](FJFutureState<R>* done) mutable {
+	    done->retain();
+	    fn(FJFuture<R>(done));
+	});
+	state->release();
+    }
+
+    FJFuture(const FJFuture&) = delete;
+    FJFuture& operator=(const FJFuture&) = delete;
+
+private:
+    FJFutureState<R>* state_; //!< 共有状態
+};
+
+#endif //__FJFUTURE_H__
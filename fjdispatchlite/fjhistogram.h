@@ -0,0 +1,283 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjhistogram.h
+ * @author FJD
+ * @brief 対数線形バケットのレイテンシヒストグラム
+ * @date 2026.10.16
+ */
+#ifndef __FJHISTOGRAM_H__
+#define __FJHISTOGRAM_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#endif
+
+#define FJHISTOGRAM_SUB_BITS (3) //!< 2のべき乗区間あたりのバケット数のbit数(相対誤差は1/2^SUB_BITS以下)
+#define FJHISTOGRAM_MAX_BITS (36) //!< 記録できる値のbit数(超えた値は最大値に丸める)
+#define FJHISTOGRAM_SITES (256) //!< 呼び出し元テーブル1つあたりのエントリ数(2のべき乗)
+
+/**
+ * @brief 対数線形バケットの配置
+ * @note 2^SUB_BITS未満はそのまま、以降は2のべき乗区間ごとに2^SUB_BITS等分する(HDR Histogramと同じ考え方)。
+ */
+struct FJHistogramBuckets {
+    static const int SUB = 1 << FJHISTOGRAM_SUB_BITS; //!< 区間あたりのバケット数
+    static const int COUNT = (FJHISTOGRAM_MAX_BITS - FJHISTOGRAM_SUB_BITS + 1) * SUB; //!< バケット数
+    static const uint64_t MAX_VALUE = (static_cast<uint64_t>(1) << FJHISTOGRAM_MAX_BITS) - 1; //!< 記録できる最大値
+
+    /**
+     * @brief 値のバケット番号
+     */
+    static int index(uint64_t v) {
+	if (v > MAX_VALUE) v = MAX_VALUE;
+	if (v < static_cast<uint64_t>(SUB)) return static_cast<int>(v);
+	int e = 63 - __builtin_clzll(v);
+	int shift = e - FJHISTOGRAM_SUB_BITS;
+	return (shift + 1) * SUB + static_cast<int>((v >> shift) & (SUB - 1));
+    }
+
+    /**
+     * @brief バケットに入る最大値
+     */
+    static uint64_t upper(int i) {
+	if (i < SUB) return static_cast<uint64_t>(i);
+	int shift = i / SUB - 1;
+	uint64_t lower = static_cast<uint64_t>(SUB + i % SUB) << shift;
+	return lower + (static_cast<uint64_t>(1) << shift) - 1;
+    }
+};
+
+/**
+ * @brief ヒストグラム(読み出し・集計用)
+ * @note スレッドセーフではない。記録はFJAtomicHistogramで行い、snapshot()でこちらに写す。
+ */
+class FJHistogram {
+public:
+    FJHistogram() : buckets_(FJHistogramBuckets::COUNT, 0), count_(0), total_(0), max_(0) {}
+
+    /**
+     * @brief 値を加える
+     */
+    void add(uint64_t v) {
+	++buckets_[FJHistogramBuckets::index(v)];
+	++count_;
+	total_ += v;
+	if (v > max_) max_ = v;
+    }
+
+    /**
+     * @brief 別のヒストグラムを合算する
+     */
+    void merge(const FJHistogram& other) {
+	for (int i = 0; i < FJHistogramBuckets::COUNT; ++i) buckets_[i] += other.buckets_[i];
+	count_ += other.count_;
+	total_ += other.total_;
+	if (other.max_ > max_) max_ = other.max_;
+    }
+
+    /**
+     * @brief パーセンタイル値
+     * @param[in] p パーセント(0〜100)
+     * @return 該当バケットの上限値(最大値を超えない)、空なら0
+     */
+    uint64_t percentile(double p) const {
+	if (count_ == 0) return 0;
+	uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count_) + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > count_) rank = count_;
+	uint64_t seen = 0;
+	for (int i = 0; i < FJHistogramBuckets::COUNT; ++i) {
+	    seen += buckets_[i];
+	    if (seen >= rank) return std::min(FJHistogramBuckets::upper(i), max_);
+	}
+	return max_;
+    }
+
+    uint64_t count() const { return count_; } //!< 記録数
+    uint64_t total() const { return total_; } //!< 合計
+    uint64_t max() const { return max_; } //!< 最大値
+    double mean() const { return count_ == 0 ? 0.0 : static_cast<double>(total_) / static_cast<double>(count_); } //!< 平均
+    const std::vector<uint64_t>& buckets() const { return buckets_; } //!< バケットごとの記録数
+
+private:
+    friend class FJAtomicHistogram;
+
+    std::vector<uint64_t> buckets_; //!< バケットごとの記録数
+    uint64_t count_; //!< 記録数
+    uint64_t total_; //!< 合計
+    uint64_t max_; //!< 最大値
+};
+
+/**
+ * @brief 記録用のヒストグラム
+ * @note record()は任意のスレッドから呼べる。書き込むスレッドが1つだけならrecordLocal()を使うと、
+ *       不可分な読み書き(fetch_add, CAS)を使わずに済む。
+ *       読み出しはrelaxedなので、記録中のものは一部だけ反映されることがある。
+ */
+class FJAtomicHistogram {
+public:
+    FJAtomicHistogram() {
+	for (int i = 0; i < FJHistogramBuckets::COUNT; ++i) buckets_[i].store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 値を記録する
+     */
+    void record(uint64_t v) {
+	buckets_[FJHistogramBuckets::index(v)].fetch_add(1, std::memory_order_relaxed);
+	total_.fetch_add(v, std::memory_order_relaxed);
+	uint64_t cur = max_.load(std::memory_order_relaxed);
+	while (v > cur && !max_.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * @brief 値を記録する(書き込むスレッドが1つだけの場合)
+     * @note 読み出し側とはrelaxedの読み書きで共有するので、snapshot()は他スレッドから呼んでよい。
+     */
+    void recordLocal(uint64_t v) {
+	std::atomic<uint64_t>& bucket = buckets_[FJHistogramBuckets::index(v)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	total_.store(total_.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+	if (v > max_.load(std::memory_order_relaxed)) max_.store(v, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 現在の内容をヒストグラムに合算する
+     * @param[in,out] out 合算先
+     */
+    void snapshot(FJHistogram& out) const {
+	uint64_t count = 0;
+	for (int i = 0; i < FJHistogramBuckets::COUNT; ++i) {
+	    uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+	    out.buckets_[i] += n;
+	    count += n;
+	}
+	// 件数はバケットの合計なので、読み出し中に記録されても分布と矛盾しない
+	out.count_ += count;
+	out.total_ += total_.load(std::memory_order_relaxed);
+	uint64_t m = max_.load(std::memory_order_relaxed);
+	if (m > out.max_) out.max_ = m;
+    }
+
+    FJAtomicHistogram(const FJAtomicHistogram&) = delete;
+    FJAtomicHistogram& operator=(const FJAtomicHistogram&) = delete;
+
+private:
+    std::atomic<uint64_t> buckets_[FJHistogramBuckets::COUNT]; //!< バケットごとの記録数
+    std::atomic<uint64_t> total_{0}; //!< 合計
+    std::atomic<uint64_t> max_{0}; //!< 最大値
+};
+
+/**
+ * @brief 呼び出し元ごとのキュー遅延・実行時間のヒストグラム表
+ * @note 呼び出し元(srcfunc, srcline)とメッセージIDの組で引く。エントリは初回の記録時に確保して以降は解放しない。
+ *       表があふれたら「その他」(srcfunc=nullptr, srcline=0, msg=UINT32_MAX)にまとめる。
+ */
+class FJLatencyTable {
+public:
+    /**
+     * @brief 1つの呼び出し元
+     */
+    struct Entry {
+	Entry(const char* f, uint32_t l, uint32_t m) : srcfunc(f), srcline(l), msg(m) {}
+	const char* const srcfunc; //!< 呼び出し関数名
+	const uint32_t srcline; //!< 呼び出し行数
+	const uint32_t msg; //!< メッセージID
+	FJAtomicHistogram queue_delay; //!< 投入から実行開始までの遅延(usec)
+	FJAtomicHistogram exec_time; //!< 実行時間(usec)
+    };
+
+    FJLatencyTable() : other_(nullptr, 0, UINT32_MAX) {
+	for (size_t i = 0; i < FJHISTOGRAM_SITES; ++i) entries_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~FJLatencyTable() {
+	for (size_t i = 0; i < FJHISTOGRAM_SITES; ++i) delete entries_[i].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 1回分を記録する
+     * @param[in] srcfunc 呼び出し関数名(静的な寿命を持つこと)
+     * @param[in] srcline 呼び出し行数
+     * @param[in] msg メッセージID
+     * @param[in] queue_delay_usec キュー遅延(usec)
+     * @param[in] exec_usec 実行時間(usec)
+     */
+    void record(const char* srcfunc, uint32_t srcline, uint32_t msg, uint64_t queue_delay_usec, uint64_t exec_usec) {
+	Entry* e = _find(srcfunc, srcline, msg);
+	e->queue_delay.record(queue_delay_usec);
+	e->exec_time.record(exec_usec);
+    }
+
+    /**
+     * @brief 1回分を記録する(この表に書き込むスレッドが1つだけの場合)
+     * @note 引数はrecord()と同じ。
+     */
+    void recordLocal(const char* srcfunc, uint32_t srcline, uint32_t msg, uint64_t queue_delay_usec, uint64_t exec_usec) {
+	Entry* e = _find(srcfunc, srcline, msg);
+	e->queue_delay.recordLocal(queue_delay_usec);
+	e->exec_time.recordLocal(exec_usec);
+    }
+
+    /**
+     * @brief 記録のあるエントリを列挙する
+     * @param[in] fn 各エントリについて呼ぶ関数(const Entry&)
+     */
+    template <typename F>
+    void forEach(F&& fn) const {
+	for (size_t i = 0; i < FJHISTOGRAM_SITES; ++i) {
+	    const Entry* e = entries_[i].load(std::memory_order_acquire);
+	    if (e != nullptr) fn(*e);
+	}
+	fn(other_);
+    }
+
+    FJLatencyTable(const FJLatencyTable&) = delete;
+    FJLatencyTable& operator=(const FJLatencyTable&) = delete;
+
+private:
+    /**
+     * @brief エントリを探し、なければ作る
+     */
+    Entry* _find(const char* srcfunc, uint32_t srcline, uint32_t msg) {
+	uint64_t h = reinterpret_cast<uintptr_t>(srcfunc) ^ (static_cast<uint64_t>(srcline) << 32 | msg);
+	h *= 0x9e3779b97f4a7c15ULL;
+	size_t start = static_cast<size_t>(h >> 32);
+	for (size_t n = 0; n < FJHISTOGRAM_SITES; ++n) {
+	    std::atomic<Entry*>& slot = entries_[(start + n) & (FJHISTOGRAM_SITES - 1)];
+	    Entry* e = slot.load(std::memory_order_acquire);
+	    if (e == nullptr) {
+		// 空きに確保して入れる(他スレッドに先を越されたらそれを使う)
+		Entry* created = new Entry(srcfunc, srcline, msg);
+		if (slot.compare_exchange_strong(e, created, std::memory_order_acq_rel)) return created;
+		delete created;
+	    }
+	    if (e->srcfunc == srcfunc && e->srcline == srcline && e->msg == msg) return e;
+	}
+	return &other_;
+    }
+
+    std::atomic<Entry*> entries_[FJHISTOGRAM_SITES]; //!< エントリ(開番地法)
+    Entry other_; //!< あふれた分
+};
+
+#endif //__FJHISTOGRAM_H__
@@ -0,0 +1,139 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjmpscqueue.h
+ * @author FJD
+ * @brief 侵入型のロックフリー多生産者・単一消費者キュー
+ * @date 2026.10.16
+ */
+#ifndef __FJMPSCQUEUE_H__
+#define __FJMPSCQUEUE_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <atomic>
+#include <sched.h>
+#endif
+
+#define FJMPSCQUEUE_SPIN_COUNT (64) //!< 生産者の連結待ちでyieldするまでのスピン回数
+#define FJMPSCQUEUE_CACHE_LINE (64) //!< 生産者側と消費者側を分ける間隔(キャッシュラインのバイト数)
+
+/**
+ * @brief キューに積む要素の基底
+ * @note 要素は同時に一つのキューにしか積めない。
+ */
+struct FJMpscNode {
+    std::atomic<FJMpscNode*> next_{nullptr}; //!< 次の要素
+};
+
+/**
+ * @brief 侵入型MPSCキュー(Vyukov方式)
+ * @note push()は任意のスレッド、pop()は同時に一つのスレッドのみが呼び出せる。
+ *       push()はxchg一回のwait-freeで、pop()は生産者が連結途中のときだけ短く待つ。
+ */
+class FJMpscQueue {
+public:
+    /**
+     * @brief コンストラクタ
+     */
+    FJMpscQueue() : tail_(&stub_), head_(&stub_) {}
+
+    /**
+     * @brief 末尾に積む(任意のスレッド)
+     * @param[in] node 要素
+     */
+    void push(FJMpscNode* node) {
+	node->next_.store(nullptr, std::memory_order_relaxed);
+	FJMpscNode* prev = tail_.exchange(node, std::memory_order_acq_rel);
+	prev->next_.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief 先頭から取り出す(消費者スレッドのみ)
+     * @return 要素、空ならnullptr
+     */
+    FJMpscNode* pop() {
+	FJMpscNode* head = head_;
+	FJMpscNode* next = head->next_.load(std::memory_order_acquire);
+	if (head == &stub_) {
+	    if (next == nullptr) {
+		if (tail_.load(std::memory_order_acquire) == &stub_) return nullptr;
+		next = _wait_next(head);
+	    }
+	    head_ = next;
+	    head = next;
+	    next = head->next_.load(std::memory_order_acquire);
+	}
+	if (next != nullptr) {
+	    head_ = next;
+	    return head;
+	}
+	if (tail_.load(std::memory_order_acquire) == head) {
+	    // 最後の1要素: stubを積んでから切り離す
+	    push(&stub_);
+	}
+	head_ = _wait_next(head);
+	return head;
+    }
+
+    /**
+     * @brief 次に取り出す要素を覗く(消費者スレッドのみ)
+     * @return 要素、空または生産者が連結途中ならnullptr
+     */
+    FJMpscNode* peek() const {
+	FJMpscNode* head = head_;
+	if (head == &stub_) return head->next_.load(std::memory_order_acquire);
+	return head;
+    }
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJMpscQueue(const FJMpscQueue&) = delete;
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJMpscQueue& operator=(const FJMpscQueue&) = delete;
+
+private:
+    /**
+     * @brief 生産者がnextを連結し終えるのを待つ
+     * @param[in] node 連結待ちの要素
+     * @return 次の要素
+     */
+    static FJMpscNode* _wait_next(FJMpscNode* node) {
+	FJMpscNode* next;
+	int spin = 0;
+	while ((next = node->next_.load(std::memory_order_acquire)) == nullptr) {
+	    if (++spin >= FJMPSCQUEUE_SPIN_COUNT) {
+		sched_yield();
+		spin = 0;
+	    }
+	}
+	return next;
+    }
+
+    // C++14のnewは64バイト境界を保証しないので、alignasではなく詰め物で別のキャッシュラインに分ける
+    char pad0_[FJMPSCQUEUE_CACHE_LINE]; //!< 前のメンバとの詰め物
+    std::atomic<FJMpscNode*> tail_; //!< 生産者側(最後に積まれた要素)
+    char pad1_[FJMPSCQUEUE_CACHE_LINE - sizeof(std::atomic<FJMpscNode*>)]; //!< 生産者側と消費者側の詰め物
+    FJMpscNode* head_; //!< 消費者側(次に取り出す要素)
+    FJMpscNode stub_; //!< 番兵
+    char pad2_[FJMPSCQUEUE_CACHE_LINE - sizeof(FJMpscNode*) - sizeof(FJMpscNode)]; //!< 後ろのメンバとの詰め物
+};
+
+#endif //__FJMPSCQUEUE_H__
@@ -0,0 +1,200 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjslabpool.h
+ * @author FJD
+ * @brief 固定サイズブロックのロックフリーなプールアロケータ
+ * @date 2026.10.16
+ */
+#ifndef __FJSLABPOOL_H__
+#define __FJSLABPOOL_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
+#include <pthread.h>
+#endif
+
+#define FJSLABPOOL_MAX_CHUNKS (256) //!< 1つのプールが確保するチャンク数の上限
+#define FJSLABPOOL_ALIGN (16) //!< ブロックのアライメント
+#define FJSLABPOOL_CACHE_LINE (64) //!< 空きリスト先頭を他のメンバから分ける間隔(キャッシュラインのバイト数)
+
+/**
+ * @brief 固定サイズブロックのプール
+ * @note 空きリストはタグ付きインデックスのTreiberスタックで、alloc()/free()はロックを取らない。
+ *       空きが尽きたときだけチャンクを追加確保する(チャンクはデストラクタまで解放しない)。
+ */
+class FJSlabPool {
+public:
+    /**
+     * @brief コンストラクタ
+     * @param[in] block_size ブロックのバイト数
+     * @param[in] blocks_per_chunk 1チャンクあたりのブロック数
+     * @param[in] prealloc_chunks 事前に確保するチャンク数
+     * @param[in] max_chunks チャンク数の上限
+     */
+    FJSlabPool(size_t block_size, size_t blocks_per_chunk, size_t prealloc_chunks = 1, size_t max_chunks = FJSLABPOOL_MAX_CHUNKS)
+	: block_size_(block_size), blocks_per_chunk_(blocks_per_chunk),
+	  max_chunks_(max_chunks > FJSLABPOOL_MAX_CHUNKS ? FJSLABPOOL_MAX_CHUNKS : max_chunks),
+	  free_head_(0), num_chunks_(0) {
+	stride_ = (sizeof(Header) + block_size_ + FJSLABPOOL_ALIGN - 1) & ~static_cast<size_t>(FJSLABPOOL_ALIGN - 1);
+	for (size_t i = 0; i < FJSLABPOOL_MAX_CHUNKS; ++i) chunks_[i].store(nullptr, std::memory_order_relaxed);
+	pthread_mutex_init(&grow_mutex_, NULL);
+	for (size_t i = 0; i < prealloc_chunks; ++i) _grow();
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FJSlabPool() {
+	for (size_t i = 0; i < FJSLABPOOL_MAX_CHUNKS; ++i) {
+	    delete[] chunks_[i].load(std::memory_order_relaxed);
+	}
+	pthread_mutex_destroy(&grow_mutex_);
+    }
+
+    /**
+     * @brief ブロックの確保
+     * @return ブロック、上限まで確保済みで空きがなければnullptr
+     */
+    void* alloc() {
+	uint64_t head = free_head_.load(std::memory_order_acquire);
+	while (true) {
+	    uint32_t index1 = static_cast<uint32_t>(head);
+	    if (index1 == 0) {
+		// 空きがなければチャンクを追加
+		if (!_grow()) return nullptr;
+		head = free_head_.load(std::memory_order_acquire);
+		continue;
+	    }
+	    Header* hdr = _header(index1 - 1);
+	    uint64_t next = ((head >> 32) + 1) << 32 | hdr->next.load(std::memory_order_relaxed);
+	    if (free_head_.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+		return reinterpret_cast<char*>(hdr) + sizeof(Header);
+	    }
+	}
+    }
+
+    /**
+     * @brief ブロックの解放
+     * @param[in] ptr alloc()で得たブロック
+     */
+    void free(void* ptr) {
+	Header* hdr = reinterpret_cast<Header*>(static_cast<char*>(ptr) - sizeof(Header));
+	_push(hdr, hdr);
+    }
+
+    /**
+     * @brief ブロックのバイト数
+     */
+    size_t blockSize() const {
+	return block_size_;
+    }
+
+    /**
+     * @brief 確保済みのチャンク数
+     */
+    size_t numChunks() const {
+	return num_chunks_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJSlabPool(const FJSlabPool&) = delete;
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJSlabPool& operator=(const FJSlabPool&) = delete;
+
+private:
+    /**
+     * @brief ブロックヘッダ
+     */
+    struct alignas(FJSLABPOOL_ALIGN) Header {
+	uint32_t index; //!< ブロック番号
+	std::atomic<uint32_t> next; //!< 空きリストの次(ブロック番号+1、0は終端)
+    };
+
+    /**
+     * @brief ブロック番号からヘッダを得る
+     */
+    Header* _header(uint32_t index) const {
+	char* chunk = chunks_[index / blocks_per_chunk_].load(std::memory_order_acquire);
+	return reinterpret_cast<Header*>(chunk + (index % blocks_per_chunk_) * stride_);
+    }
+
+    /**
+     * @brief first〜lastの連結済みブロック列を空きリストに積む
+     */
+    void _push(Header* first, Header* last) {
+	uint64_t head = free_head_.load(std::memory_order_acquire);
+	uint64_t next;
+	do {
+	    last->next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+	    next = ((head >> 32) + 1) << 32 | (first->index + 1);
+	} while (!free_head_.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire));
+    }
+
+    /**
+     * @brief チャンクを1つ追加する
+     * @retval [true] 追加したか、他スレッドの追加で空きができた
+     * @retval [false] 上限に達した
+     */
+    bool _grow() {
+	pthread_mutex_lock(&grow_mutex_);
+	if (static_cast<uint32_t>(free_head_.load(std::memory_order_acquire)) != 0) {
+	    pthread_mutex_unlock(&grow_mutex_);
+	    return true;
+	}
+	size_t n = num_chunks_.load(std::memory_order_relaxed);
+	if (n >= max_chunks_) {
+	    pthread_mutex_unlock(&grow_mutex_);
+	    return false;
+	}
+	char* chunk = new char[stride_ * blocks_per_chunk_];
+	chunks_[n].store(chunk, std::memory_order_release);
+	num_chunks_.store(n + 1, std::memory_order_release);
+	// チャンク内のブロックを連結してまとめて積む
+	uint32_t base = static_cast<uint32_t>(n * blocks_per_chunk_);
+	for (size_t i = 0; i < blocks_per_chunk_; ++i) {
+	    Header* hdr = new (chunk + i * stride_) Header();
+	    hdr->index = base + static_cast<uint32_t>(i);
+	    hdr->next.store(base + static_cast<uint32_t>(i) + 2, std::memory_order_relaxed);
+	}
+	_push(_header(base), _header(base + static_cast<uint32_t>(blocks_per_chunk_) - 1));
+	pthread_mutex_unlock(&grow_mutex_);
+	return true;
+    }
+
+    size_t block_size_; //!< ブロックのバイト数
+    size_t blocks_per_chunk_; //!< 1チャンクあたりのブロック数
+    size_t max_chunks_; //!< チャンク数の上限
+    size_t stride_; //!< ヘッダ込みのブロック間隔
+    // C++14のnewは64バイト境界を保証しないので、alignasではなく詰め物で別のキャッシュラインに分ける
+    char pad0_[FJSLABPOOL_CACHE_LINE]; //!< 前のメンバとの詰め物
+    std::atomic<uint64_t> free_head_; //!< 空きリスト先頭(上位32bit:ABAタグ, 下位32bit:ブロック番号+1)
+    char pad1_[FJSLABPOOL_CACHE_LINE - sizeof(std::atomic<uint64_t>)]; //!< 後ろのメンバとの詰め物
+    std::atomic<size_t> num_chunks_; //!< 確保済みチャンク数
+    std::atomic<char*> chunks_[FJSLABPOOL_MAX_CHUNKS]; //!< チャンク
+    pthread_mutex_t grow_mutex_; //!< チャンク追加の排他
+};
+
+#endif //__FJSLABPOOL_H__
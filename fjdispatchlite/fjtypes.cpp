@@ -11,6 +11,15 @@ int64_t _get_time() {
     return timeMs;
 }
 
+/**
+ * @brief epoch time (usec)
+ */
+int64_t _get_time_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + ((int64_t)ts.tv_nsec / 1000);
+}
+
 /**
  * @brief convert to timespec
  */
@@ -44,6 +44,11 @@ typedef uint32_t fjt_msg_t; //!< メッセージID型
  */
 int64_t _get_time();
 
+/**
+ * @brief epoch time (usec)
+ */
+int64_t _get_time_usec();
+
 /**
  * @brief convert to timespec
  */
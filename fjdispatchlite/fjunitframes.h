@@ -16,9 +16,15 @@
 #ifndef __FJUNITFRAMES_H__
 #define __FJUNITFRAMES_H__
 
+#ifndef DOXYGEN_SKIP_THIS
+#include <atomic>
+#endif
+
 class FJDispatchLite;
 class FJTimerLite;
 
+#define FJUNITFRAMES_QUEUE_CACHE (4) //!< インスタンス情報をキャッシュするキューの数(これを超えたキューは管理テーブルを引く)
+
 #ifndef MAP_MESSAGES
 #define BEGIN_MAP_MESSAGES(x)
 #define MAP_MESSAGES(mid, func) static constexpr auto g_funcptr_##mid = &func;
@@ -31,14 +37,14 @@ class FJTimerLite;
 #define END_MAP_EVENTS()
 #endif //MAP_EVENTS
 
-#define SendEvtSelf_S(mid) FJDispatchLite::GetInstance()->postEvent(this, g_funcptr_##mid, mid, __PRETTY_FUNCTION__, __LINE__)
-#define SendMsgSelf_S(mid, prio, buf, size) FJDispatchLite::GetInstance()->postQueue(this, g_funcptr_##mid, mid, buf, size, true, __PRETTY_FUNCTION__, __LINE__)
-#define SendMsgSelf_P(mid, prio, buf, size) FJDispatchLite::GetInstance()->postQueue(this, g_funcptr_##mid, mid, buf, size, false, __PRETTY_FUNCTION__, __LINE__)
+#define SendEvtSelf_S(mid) FJDispatchLite::GetQueueFor(this)->postEvent(this, g_funcptr_##mid, mid, __PRETTY_FUNCTION__, __LINE__)
+#define SendMsgSelf_S(mid, prio, buf, size) FJDispatchLite::GetQueueFor(this)->postQueue(this, g_funcptr_##mid, mid, buf, size, true, __PRETTY_FUNCTION__, __LINE__, prio)
+#define SendMsgSelf_P(mid, prio, buf, size) FJDispatchLite::GetQueueFor(this)->postQueue(this, g_funcptr_##mid, mid, buf, size, false, __PRETTY_FUNCTION__, __LINE__, prio)
 #define CreateTimer(mf, msec) FJTimerLite::GetInstance()->createTimer(this, mf, msec, __PRETTY_FUNCTION__, __LINE__)
 
 /**
  * @enum 実行優先度
- * @note 現状は未使用。
+ * @note 値がそのまま優先度レーン番号になる(小さいほど優先)。
  */
 typedef enum {
     C_MESSAGE_HIGH,
@@ -51,8 +57,46 @@ typedef enum {
  */
 class FJUnitFrames {
 public:
-    FJUnitFrames() {};
-    virtual ~FJUnitFrames() {};
+    friend class FJDispatchLite;
+
+    typedef void (*DetachHook)(FJUnitFrames* obj); //!< 登録解除処理
+
+    FJUnitFrames() : dispatch_queue_(nullptr), dispatch_queues_(0) { for (auto& info : dispatch_info_) info.store(nullptr); };
+    FJUnitFrames(const FJUnitFrames& other) : dispatch_queue_(other.dispatch_queue_.load()), dispatch_queues_(0) { for (auto& info : dispatch_info_) info.store(nullptr); }; // メールボックスは引き継がない
+    FJUnitFrames& operator=(const FJUnitFrames&) { return *this; };
+    virtual ~FJUnitFrames() {
+	// ディスパッチャに登録されていれば未実行のタスクを取り消して登録を解除する
+	if (dispatch_queues_.load() > 0) {
+	    DetachHook hook = _detach_hook().load();
+	    if (hook != nullptr) hook(this);
+	}
+    };
+
+    /**
+     * @brief SendMsgSelf_S等の投入先キューを設定する
+     * @note 切り替え前に投入したタスクとの順序は保証しない。
+     * @param[in] queue FJDispatchLite::CreateQueue()で作ったキュー、nullptrならメインプール
+     */
+    void setDispatchQueue(FJDispatchLite* queue) { dispatch_queue_.store(queue); }
+
+    /**
+     * @brief 投入先キューの取得
+     * @return 設定したキュー、未設定ならnullptr(メインプール)
+     */
+    FJDispatchLite* getDispatchQueue() const { return dispatch_queue_.load(); }
+
+private:
+    /**
+     * @brief デストラクタから呼ぶ登録解除処理(FJDispatchLiteが設定する)
+     */
+    static std::atomic<DetachHook>& _detach_hook() {
+	static std::atomic<DetachHook> hook(nullptr);
+	return hook;
+    }
+
+    std::atomic<void*> dispatch_info_[FJUNITFRAMES_QUEUE_CACHE]; //!< キューごとのインスタンス情報キャッシュ(添字はFJDispatchLiteごとに割り当てる)
+    std::atomic<FJDispatchLite*> dispatch_queue_; //!< 投入先キュー(nullptrならメインプール)
+    std::atomic<int> dispatch_queues_; //!< 登録されているキューの数
 };
 
 #endif
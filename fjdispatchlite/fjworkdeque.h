@@ -0,0 +1,151 @@
+/**
+ * Copyright 2025 FJD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file fjworkdeque.h
+ * @author FJD
+ * @brief ワークスティーリング用の固定長Chase-Levデック
+ * @date 2026.10.16
+ */
+#ifndef __FJWORKDEQUE_H__
+#define __FJWORKDEQUE_H__
+
+#ifndef DOXYGEN_SKIP_THIS
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#endif
+
+#define FJWORKDEQUE_DEFAULT_CAPACITY (1024) //!< デック容量初期値(2のべき乗)
+#define FJWORKDEQUE_CACHE_LINE (64) //!< スティール側と所有者側を分ける間隔(キャッシュラインのバイト数)
+
+/**
+ * @brief 固定長Chase-Levデック
+ * @note push()/pop()は所有スレッドのみ、steal()は任意のスレッドから呼び出せる。
+ *       容量を超えるとpush()は失敗するので、呼び出し側で共有キューへ退避すること。
+ */
+template <typename T>
+class FJWorkDeque {
+public:
+    /**
+     * @brief コンストラクタ
+     * @param[in] capacity 容量(2のべき乗に切り上げる)
+     */
+    explicit FJWorkDeque(size_t capacity = FJWORKDEQUE_DEFAULT_CAPACITY)
+	: top_(0), bottom_(0), capacity_(1) {
+	while (capacity_ < capacity) capacity_ <<= 1;
+	mask_ = capacity_ - 1;
+	buffer_.reset(new std::atomic<T*>[capacity_]);
+	for (size_t i = 0; i < capacity_; ++i) buffer_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 末尾に積む(所有スレッド専用)
+     * @param[in] item 要素
+     * @retval [true] 成功
+     * @retval [false] デックがいっぱい
+     */
+    bool push(T* item) {
+	int64_t b = bottom_.load(std::memory_order_relaxed);
+	int64_t t = top_.load(std::memory_order_acquire);
+	if (b - t >= static_cast<int64_t>(capacity_)) return false;
+	buffer_[b & mask_].store(item, std::memory_order_relaxed);
+	// 要素とその指す先をスティール側のacquireに公開する
+	bottom_.store(b + 1, std::memory_order_release);
+	return true;
+    }
+
+    /**
+     * @brief 末尾から取り出す(所有スレッド専用)
+     * @return 要素、空ならnullptr
+     */
+    T* pop() {
+	int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+	bottom_.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top_.load(std::memory_order_relaxed);
+	if (t > b) {
+	    // 空
+	    bottom_.store(b + 1, std::memory_order_relaxed);
+	    return nullptr;
+	}
+	T* item = buffer_[b & mask_].load(std::memory_order_relaxed);
+	if (t == b) {
+	    // 最後の1要素はスティールと競合するのでCASで確定させる
+	    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		item = nullptr;
+	    }
+	    bottom_.store(b + 1, std::memory_order_relaxed);
+	}
+	return item;
+    }
+
+    /**
+     * @brief 先頭から盗む(任意のスレッド)
+     * @return 要素、空または競合に負けたらnullptr
+     */
+    T* steal() {
+	int64_t t = top_.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom_.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+	T* item = buffer_[t & mask_].load(std::memory_order_relaxed);
+	if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+	    return nullptr;
+	}
+	return item;
+    }
+
+    /**
+     * @brief おおよその要素数
+     * @note 他スレッドから呼ぶと瞬間値になる。
+     */
+    size_t size() const {
+	int64_t b = bottom_.load(std::memory_order_relaxed);
+	int64_t t = top_.load(std::memory_order_relaxed);
+	return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    /**
+     * @brief 空か(瞬間値)
+     */
+    bool empty() const {
+	return size() == 0;
+    }
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJWorkDeque(const FJWorkDeque&) = delete;
+
+    /**
+     * @brief コピー禁止コンストラクタ
+     */
+    FJWorkDeque& operator=(const FJWorkDeque&) = delete;
+
+private:
+    // C++14のnewは64バイト境界を保証しないので、alignasではなく詰め物で別のキャッシュラインに分ける
+    char pad0_[FJWORKDEQUE_CACHE_LINE]; //!< 前のメンバとの詰め物
+    std::atomic<int64_t> top_; //!< スティール側インデックス
+    char pad1_[FJWORKDEQUE_CACHE_LINE - sizeof(std::atomic<int64_t>)]; //!< スティール側と所有者側の詰め物
+    std::atomic<int64_t> bottom_; //!< 所有者側インデックス
+    size_t capacity_; //!< 容量
+    size_t mask_; //!< インデックスマスク
+    std::unique_ptr<std::atomic<T*>[]> buffer_; //!< リングバッファ
+};
+
+#endif //__FJWORKDEQUE_H__
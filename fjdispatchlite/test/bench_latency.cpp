@@ -0,0 +1,100 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define ROUNDS (20000)
+#define WARMUP (1000)
+
+static int64_t now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class FJBenchEcho : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_ECHO,
+    };
+
+    virtual int onEcho(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJBenchEcho )
+    MAP_MESSAGES( MID_ON_ECHO, FJBenchEcho::onEcho )
+    END_MAP_MESSAGES()
+};
+
+int FJBenchEcho::onEcho(uint32_t msg, void* buf, uint32_t len)
+{
+    return static_cast<int>(len);
+}
+
+static void report(const char* name, std::vector<int64_t>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    std::cout << name
+	      << ": min=" << samples[0] / 1000.0
+	      << "us p50=" << samples[n / 2] / 1000.0
+	      << "us p99=" << samples[n * 99 / 100] / 1000.0
+	      << "us max=" << samples[n - 1] / 1000.0 << "us" << std::endl;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJBenchEcho echo;
+    char buf[64] = {0};
+    std::vector<int64_t> samples;
+    samples.reserve(ROUNDS);
+
+    ////// post→waitResult の往復 /////
+    for (int i = 0; i < WARMUP + ROUNDS; ++i) {
+	int64_t t0 = now_nsec();
+	fjt_handle_t h = dispatch->postQueue(&echo, &FJBenchEcho::onEcho, FJBenchEcho::MID_ON_ECHO, buf, sizeof(buf), true, __FUNCTION__, __LINE__);
+	int result = -1;
+	if (!dispatch->waitResult(h, 1000, result) || result != sizeof(buf)) {
+	    std::cout << "NG: handle " << h << " result " << result << std::endl;
+	    return 1;
+	}
+	if (i >= WARMUP) samples.push_back(now_nsec() - t0);
+    }
+    report("post->result", samples);
+
+    ////// まとめて投入してから回収 /////
+    std::vector<fjt_handle_t> handles(ROUNDS);
+    int64_t t0 = now_nsec();
+    for (int i = 0; i < ROUNDS; ++i) {
+	handles[i] = dispatch->postQueue(&echo, &FJBenchEcho::onEcho, FJBenchEcho::MID_ON_ECHO, buf, sizeof(buf), true, __FUNCTION__, __LINE__);
+    }
+    for (int i = 0; i < ROUNDS; ++i) {
+	int result = -1;
+	dispatch->waitResult(handles[i], 1000, result);
+    }
+    int64_t total = now_nsec() - t0;
+    std::cout << "throughput: " << ROUNDS << " msgs in " << total / 1000000.0 << "ms ("
+	      << (total / ROUNDS) / 1000.0 << "us/msg)" << std::endl;
+
+    ////// 一括投入してから回収 /////
+    FJBenchEcho echoes[4];
+    std::vector<FJDispatchLite::QueueItem<FJBenchEcho>> items(ROUNDS);
+    for (int i = 0; i < ROUNDS; ++i) {
+	items[i] = { &echoes[i % 4], &FJBenchEcho::onEcho, FJBenchEcho::MID_ON_ECHO, buf, sizeof(buf) };
+    }
+    t0 = now_nsec();
+    dispatch->postQueueBatch(items.data(), items.size(), true, __FUNCTION__, __LINE__, handles.data());
+    for (int i = 0; i < ROUNDS; ++i) {
+	int result = -1;
+	if (!dispatch->waitResult(handles[i], 1000, result) || result != sizeof(buf)) {
+	    std::cout << "NG: batch handle " << handles[i] << " result " << result << std::endl;
+	    return 1;
+	}
+    }
+    total = now_nsec() - t0;
+    std::cout << "batch throughput: " << ROUNDS << " msgs in " << total / 1000000.0 << "ms ("
+	      << (total / ROUNDS) / 1000.0 << "us/msg)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define SMALL_COUNT (1000000)
+#define SLOW_COUNT (200)
+#define SLOW_USEC (1000)
+
+class FJTestApply : public FJUnitFrames {
+};
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+
+    ////// 軽い要素を大量に /////
+    std::vector<uint8_t> visited(SMALL_COUNT, 0);
+    std::atomic<uint64_t> sum(0);
+    std::atomic<int> chunks(0);
+    int64_t t0 = _get_time_usec();
+    dispatch->dispatchApplyRange(0, SMALL_COUNT, [&](size_t b, size_t e) {
+	uint64_t local = 0;
+	for (size_t i = b; i < e; ++i) {
+	    ++visited[i];
+	    local += i;
+	}
+	sum += local;
+	++chunks;
+    });
+    int64_t t1 = _get_time_usec();
+    size_t bad = 0;
+    for (size_t i = 0; i < SMALL_COUNT; ++i) {
+	if (visited[i] != 1) ++bad;
+    }
+    uint64_t expect = static_cast<uint64_t>(SMALL_COUNT) * (SMALL_COUNT - 1) / 2;
+    std::cout << "small: bad=" << bad << " sum=" << (sum == expect) << " chunks=" << chunks << " in " << (t1 - t0) << "us" << std::endl;
+    if (bad != 0 || sum != expect) ok = false;
+
+    ////// 重い要素 /////
+    std::atomic<int> slow(0);
+    t0 = _get_time_usec();
+    dispatch->dispatchApply(SLOW_COUNT, [&](size_t) {
+	usleep(SLOW_USEC);
+	++slow;
+    });
+    t1 = _get_time_usec();
+    std::cout << "slow: " << slow << "/" << SLOW_COUNT << " in " << (t1 - t0) << "us (serial " << SLOW_COUNT * SLOW_USEC << "us)" << std::endl;
+    if (slow != SLOW_COUNT || t1 - t0 >= SLOW_COUNT * SLOW_USEC) ok = false;
+
+    ////// ワーカーからの入れ子 /////
+    FJTestApply unit;
+    std::atomic<int> nested(0);
+    FJFuture<int> f = dispatch->post(&unit, [&]() {
+	dispatch->dispatchApply(100, [&](size_t) {
+	    dispatch->dispatchApply(100, [&](size_t) { ++nested; });
+	});
+	return nested.load();
+    });
+    int value = 0;
+    if (!f.get(5000, value) || value != 100 * 100) ok = false;
+    std::cout << "nested: " << value << std::endl;
+
+    ////// 空と1要素 /////
+    std::atomic<int> few(0);
+    dispatch->dispatchApply(0, [&](size_t) { ++few; });
+    dispatch->dispatchApply(1, [&](size_t) { ++few; });
+    if (few != 1) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
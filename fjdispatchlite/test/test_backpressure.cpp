@@ -0,0 +1,217 @@
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define LIMIT (10)
+
+static std::atomic<bool> g_blocking(false);
+static std::atomic<bool> g_release(false);
+
+class FJTestBackpressure : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WORK,
+	MID_ON_BLOCK,
+    };
+
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBlock(uint32_t msg);
+
+    BEGIN_MAP_MESSAGES( FJTestBackpressure )
+    MAP_MESSAGES( MID_ON_WORK, FJTestBackpressure::onWork )
+    END_MAP_MESSAGES()
+
+    BEGIN_MAP_EVENTS( FJTestBackpressure )
+    MAP_EVENTS( MID_ON_BLOCK, FJTestBackpressure::onBlock )
+    END_MAP_EVENTS()
+};
+
+int FJTestBackpressure::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    return static_cast<int>(msg);
+}
+
+int FJTestBackpressure::onBlock(uint32_t msg)
+{
+    g_blocking = true;
+    while (!g_release) usleep(1000);
+    return 0;
+}
+
+static void block(FJDispatchLite* dispatch, FJTestBackpressure* unit)
+{
+    g_blocking = false;
+    g_release = false;
+    dispatch->postEvent(unit, &FJTestBackpressure::onBlock, FJTestBackpressure::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+
+    ////// インスタンスの上限: 受け付けない /////
+    {
+	FJTestBackpressure unit;
+	dispatch->setInstanceQueueLimit(&unit, LIMIT, FJDispatchLite::OVERFLOW_FAIL);
+	block(dispatch, &unit);
+	std::vector<fjt_handle_t> handles;
+	int rejected = 0;
+	for (int i = 0; i < LIMIT * 2; ++i) {
+	    handles.push_back(dispatch->postQueue(&unit, &FJTestBackpressure::onWork, i, nullptr, 0, true, __FUNCTION__, __LINE__));
+	    int result = 0;
+	    if (dispatch->peekResult(handles.back(), result) == FJDispatchLite::RESULT_READY && result == FJDISPATCHLITE_RESULT_REJECTED) ++rejected;
+	}
+	g_release = true;
+	int ran = 0;
+	for (int i = 0; i < LIMIT * 2; ++i) {
+	    int result = 0;
+	    if (dispatch->waitResult(handles[i], 1000, result) && result == i) ++ran;
+	}
+	std::cout << "fail: rejected=" << rejected << " ran=" << ran << std::endl;
+	if (rejected != LIMIT || ran != LIMIT) ok = false;
+	dispatch->detach(&unit);
+    }
+
+    ////// インスタンスの上限: 古いものから破棄 /////
+    {
+	FJTestBackpressure unit;
+	dispatch->setInstanceQueueLimit(&unit, LIMIT, FJDispatchLite::OVERFLOW_DROP_OLDEST);
+	block(dispatch, &unit);
+	std::vector<fjt_handle_t> handles;
+	for (int i = 0; i < LIMIT * 3; ++i) {
+	    handles.push_back(dispatch->postQueue(&unit, &FJTestBackpressure::onWork, i, nullptr, 0, true, __FUNCTION__, __LINE__));
+	}
+	g_release = true;
+	int dropped = 0;
+	int newest = 0;
+	for (int i = 0; i < LIMIT * 3; ++i) {
+	    int result = 0;
+	    dispatch->waitResult(handles[i], 1000, result);
+	    if (result == FJDISPATCHLITE_RESULT_DROPPED) ++dropped;
+	    else if (result == i && i >= LIMIT * 2) ++newest;
+	}
+	std::cout << "drop oldest: dropped=" << dropped << " newest=" << newest << std::endl;
+	if (dropped != LIMIT * 2 || newest != LIMIT) ok = false;
+	dispatch->detach(&unit);
+    }
+
+    ////// 全体の上限: 待たせる、水位通知 /////
+    {
+	FJTestBackpressure unit;
+	std::mutex m;
+	std::vector<bool> marks;
+	dispatch->setWatermarks(4, 1, [&](bool high) {
+	    std::lock_guard<std::mutex> lock(m);
+	    marks.push_back(high);
+	});
+	dispatch->setQueueLimit(5, FJDispatchLite::OVERFLOW_BLOCK);
+	dispatch->setBlockTimeout(5000);
+	block(dispatch, &unit);
+	std::atomic<int> posted(0);
+	std::vector<fjt_handle_t> handles(LIMIT);
+	std::thread producer([&]() {
+	    for (int i = 0; i < LIMIT; ++i) {
+		handles[i] = dispatch->postQueue(&unit, &FJTestBackpressure::onWork, i, nullptr, 0, true, __FUNCTION__, __LINE__);
+		++posted;
+	    }
+	});
+	usleep(100000);
+	int stalled = posted;
+	FJDispatchLite::BackpressureStats stats;
+	dispatch->getBackpressureStats(stats);
+	g_release = true;
+	producer.join();
+	int ran = 0;
+	for (int i = 0; i < LIMIT; ++i) {
+	    int result = 0;
+	    if (dispatch->waitResult(handles[i], 1000, result) && result == i) ++ran;
+	}
+	usleep(10000);
+	std::cout << "block: stalled at " << stalled << " queued=" << stats.queued << " blocked=" << stats.blocked << " ran=" << ran << std::endl;
+	if (stalled != 4 || stats.queued != 5 || stats.blocked < 1 || ran != LIMIT) ok = false;
+	{
+	    std::lock_guard<std::mutex> lock(m);
+	    std::cout << "watermarks:";
+	    for (bool b : marks) std::cout << " " << (b ? "high" : "low");
+	    std::cout << std::endl;
+	    if (marks.size() < 2 || !marks.front() || marks.back()) ok = false;
+	}
+	dispatch->setWatermarks(0, 0, nullptr);
+
+	////// 待ち時間切れ /////
+	dispatch->setBlockTimeout(50);
+	block(dispatch, &unit);
+	for (int i = 0; i < 4; ++i) dispatch->postQueue(&unit, &FJTestBackpressure::onWork, i, nullptr, 0, true, __FUNCTION__, __LINE__);
+	int64_t t0 = _get_time();
+	fjt_handle_t late = dispatch->postQueue(&unit, &FJTestBackpressure::onWork, 0, nullptr, 0, true, __FUNCTION__, __LINE__);
+	int64_t waited = _get_time() - t0;
+	int result = 0;
+	dispatch->waitResult(late, 0, result);
+	g_release = true;
+	std::cout << "block timeout: waited=" << waited << "ms rejected=" << (result == FJDISPATCHLITE_RESULT_REJECTED) << std::endl;
+	if (waited < 40 || result != FJDISPATCHLITE_RESULT_REJECTED) ok = false;
+
+	////// 上限をまたぐ一括投入は先に受け付けた分を消化させながら待つ /////
+	dispatch->setQueueLimit(LIMIT, FJDispatchLite::OVERFLOW_BLOCK);
+	dispatch->setBlockTimeout(200);
+	FJDispatchLite::QueueItem<FJTestBackpressure> items[LIMIT * 2];
+	for (int i = 0; i < LIMIT * 2; ++i) items[i] = { &unit, &FJTestBackpressure::onWork, static_cast<uint32_t>(i), nullptr, 0 };
+	fjt_handle_t batch[LIMIT * 2];
+	t0 = _get_time();
+	dispatch->postQueueBatch(items, LIMIT * 2, true, __FUNCTION__, __LINE__, batch);
+	waited = _get_time() - t0;
+	ran = 0;
+	for (int i = 0; i < LIMIT * 2; ++i) {
+	    if (dispatch->waitResult(batch[i], 1000, result) && result == i) ++ran;
+	}
+	std::cout << "block batch: waited=" << waited << "ms ran=" << ran << std::endl;
+	if (waited >= 200 || ran != LIMIT * 2) ok = false;
+	dispatch->setQueueLimit(0, FJDispatchLite::OVERFLOW_BLOCK);
+	dispatch->detach(&unit, FJDispatchLite::DETACH_DRAIN);
+    }
+
+    ////// 結果スロットが埋まったら待ち時間切れで受け付けない /////
+    {
+	FJTestBackpressure unit;
+	dispatch->setBlockTimeout(50);
+	block(dispatch, &unit);
+	FJDispatchLite::BackpressureStats before;
+	dispatch->getBackpressureStats(before);
+	int64_t t0 = _get_time();
+	std::vector<fjt_handle_t> handles;
+	int refused = 0;
+	for (int i = 0; i < static_cast<int>(dispatch->getConfig().max_results) + LIMIT; ++i) {
+	    fjt_handle_t h = dispatch->postQueue(&unit, &FJTestBackpressure::onWork, 0, nullptr, 0, true, __FUNCTION__, __LINE__);
+	    if (h == 0) ++refused;
+	    else handles.push_back(h);
+	}
+	int64_t elapsed = _get_time() - t0;
+	FJDispatchLite::BackpressureStats after;
+	dispatch->getBackpressureStats(after);
+	g_release = true;
+	bool all = dispatch->waitAll(handles.data(), handles.size(), 10000);
+	std::cout << "results full: refused=" << refused << " rejected+=" << (after.rejected - before.rejected) << " in " << elapsed << "ms accepted ran=" << all << std::endl;
+	if (refused < LIMIT || after.rejected - before.rejected != static_cast<uint64_t>(refused) || !all) ok = false;
+	dispatch->setBlockTimeout(FJDISPATCHLITE_BLOCK_TIMEOUT_MSEC);
+	dispatch->detach(&unit, FJDispatchLite::DETACH_DRAIN);
+    }
+
+    // 最後のタスクの解放を待つ
+    FJDispatchLite::BackpressureStats stats;
+    for (int i = 0; i < 100; ++i) {
+	dispatch->getBackpressureStats(stats);
+	if (stats.queued == 0) break;
+	usleep(1000);
+    }
+    std::cout << "final: queued=" << stats.queued << " rejected=" << stats.rejected << " dropped=" << stats.dropped << std::endl;
+    if (stats.queued != 0) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
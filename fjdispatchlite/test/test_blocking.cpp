@@ -0,0 +1,148 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define MAX_THREADS (2)
+
+static std::atomic<int> g_blocked(0);
+static std::atomic<bool> g_release(false);
+
+class FJTestBlocking : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_BLOCK,
+	MID_ON_WORK,
+	MID_ON_WAIT,
+	MID_ON_GROUP,
+	MID_ON_FUTURE,
+    };
+
+    virtual int onBlock(uint32_t msg, void* buf, uint32_t len);
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+    virtual int onWait(uint32_t msg, void* buf, uint32_t len);
+    virtual int onGroup(uint32_t msg, void* buf, uint32_t len);
+    virtual int onFuture(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestBlocking )
+    MAP_MESSAGES( MID_ON_BLOCK, FJTestBlocking::onBlock )
+    MAP_MESSAGES( MID_ON_WORK, FJTestBlocking::onWork )
+    MAP_MESSAGES( MID_ON_WAIT, FJTestBlocking::onWait )
+    MAP_MESSAGES( MID_ON_GROUP, FJTestBlocking::onGroup )
+    MAP_MESSAGES( MID_ON_FUTURE, FJTestBlocking::onFuture )
+    END_MAP_MESSAGES()
+};
+
+int FJTestBlocking::onBlock(uint32_t msg, void* buf, uint32_t len)
+{
+    FJBlockingScope blocking;
+    ++g_blocked;
+    while (!g_release) usleep(1000);
+    return 0;
+}
+
+int FJTestBlocking::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    return static_cast<int>(msg);
+}
+
+int FJTestBlocking::onWait(uint32_t msg, void* buf, uint32_t len)
+{
+    // 別のインスタンスの結果をワーカーから待つ
+    FJTestBlocking* other = *static_cast<FJTestBlocking**>(buf);
+    fjt_handle_t h = FJDispatchLite::GetInstance()->postQueue(other, &FJTestBlocking::onWork, MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__);
+    int result = -1;
+    FJDispatchLite::GetInstance()->waitResult(h, 1000, result);
+    return result;
+}
+
+int FJTestBlocking::onGroup(uint32_t msg, void* buf, uint32_t len)
+{
+    // 別のインスタンスに積んだタスクの完了をグループで待つ
+    FJTestBlocking* other = *static_cast<FJTestBlocking**>(buf);
+    FJDispatchGroup group;
+    FJDispatchLite::GetInstance()->postQueue(other, &FJTestBlocking::onWork, MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__, FJPostAttr().withGroup(&group));
+    return group.wait(1000) ? static_cast<int>(MID_ON_GROUP) : -1;
+}
+
+int FJTestBlocking::onFuture(uint32_t msg, void* buf, uint32_t len)
+{
+    // 別のインスタンスに積んだ関数の結果をFJFutureで待つ
+    FJTestBlocking* other = *static_cast<FJTestBlocking**>(buf);
+    FJFuture<int> f = FJDispatchLite::GetInstance()->post(other, []() { return static_cast<int>(MID_ON_FUTURE); });
+    int value = -1;
+    f.get(1000, value);
+    return value;
+}
+
+/**
+ * @brief ワーカーを全て塞ぐ待ち合わせを投入し、全て結果が得られることを確かめる
+ */
+static void nested(FJDispatchLite* dispatch, FJTestBlocking* target, const char* name, int (FJTestBlocking::*mf)(uint32_t, void*, uint32_t), uint32_t msg, int expected, bool& ok)
+{
+    FJTestBlocking waiters[MAX_THREADS];
+    std::vector<fjt_handle_t> handles;
+    for (auto& w : waiters) {
+	handles.push_back(dispatch->postQueue(&w, mf, msg, &target, sizeof(target), true, __FUNCTION__, __LINE__));
+    }
+    std::vector<int> results;
+    bool done = dispatch->waitAll(handles, 2000, results);
+    std::cout << name << ": done=" << done;
+    for (int r : results) std::cout << " " << r;
+    std::cout << std::endl;
+    for (int r : results) if (r != expected) done = false;
+    if (!done) ok = false;
+    for (auto& w : waiters) dispatch->detach(&w);
+}
+
+/**
+ * @brief 代わりに足したワーカーが終了するのを待つ
+ */
+static void settle(FJDispatchLite* dispatch, bool& ok)
+{
+    FJDispatchLite::ScalingStats stats;
+    for (int i = 0; i < 100; ++i) {
+	dispatch->getScalingStats(stats);
+	if (stats.threads <= MAX_THREADS && stats.blocking == 0) break;
+	usleep(1000);
+    }
+    std::cout << "after: threads=" << stats.threads << " blocking=" << stats.blocking << " retired=" << stats.retired << std::endl;
+    if (stats.threads > MAX_THREADS || stats.blocking != 0) ok = false;
+}
+
+int main() {
+    FJDispatchLite::Config config;
+    config.min_threads = 1;
+    config.initial_threads = MAX_THREADS;
+    config.max_threads = MAX_THREADS;
+    bool ok = FJDispatchLite::Configure(config);
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+
+    ////// 全ワーカーが塞がっても他のインスタンスは進む /////
+    FJTestBlocking blockers[MAX_THREADS];
+    for (auto& b : blockers) dispatch->postQueue(&b, &FJTestBlocking::onBlock, FJTestBlocking::MID_ON_BLOCK, nullptr, 0, true, __FUNCTION__, __LINE__);
+    while (g_blocked < MAX_THREADS) usleep(1000);
+    FJTestBlocking unit;
+    fjt_handle_t h = dispatch->postQueue(&unit, &FJTestBlocking::onWork, 7, nullptr, 0, true, __FUNCTION__, __LINE__);
+    int result = 0;
+    bool done = dispatch->waitResult(h, 1000, result) && result == 7;
+    FJDispatchLite::ScalingStats stats;
+    dispatch->getScalingStats(stats);
+    std::cout << "blocked: done=" << done << " threads=" << stats.threads << " blocking=" << stats.blocking << " compensated=" << stats.compensated << std::endl;
+    if (!done || stats.blocking != MAX_THREADS || stats.compensated < 1) ok = false;
+    g_release = true;
+    settle(dispatch, ok);
+
+    ////// ワーカーから結果・グループ・FJFutureを待っても詰まらない /////
+    nested(dispatch, &unit, "nested wait", &FJTestBlocking::onWait, FJTestBlocking::MID_ON_WAIT, FJTestBlocking::MID_ON_WORK, ok);
+    settle(dispatch, ok);
+    nested(dispatch, &unit, "nested group", &FJTestBlocking::onGroup, FJTestBlocking::MID_ON_GROUP, FJTestBlocking::MID_ON_GROUP, ok);
+    settle(dispatch, ok);
+    nested(dispatch, &unit, "nested future", &FJTestBlocking::onFuture, FJTestBlocking::MID_ON_FUTURE, FJTestBlocking::MID_ON_FUTURE, ok);
+    settle(dispatch, ok);
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define QUEUED (1000)
+
+static std::atomic<int> g_called(0);
+static std::atomic<bool> g_blocking(false);
+static std::atomic<bool> g_release(false);
+
+class FJTestCancel : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WORK,
+	MID_ON_BLOCK,
+    };
+
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBlock(uint32_t msg);
+
+    BEGIN_MAP_MESSAGES( FJTestCancel )
+    MAP_MESSAGES( MID_ON_WORK, FJTestCancel::onWork )
+    END_MAP_MESSAGES()
+
+    BEGIN_MAP_EVENTS( FJTestCancel )
+    MAP_EVENTS( MID_ON_BLOCK, FJTestCancel::onBlock )
+    END_MAP_EVENTS()
+};
+
+int FJTestCancel::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    ++g_called;
+    return static_cast<int>(msg);
+}
+
+int FJTestCancel::onBlock(uint32_t msg)
+{
+    g_blocking = true;
+    while (!g_release) usleep(1000);
+    return 0;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestCancel unit;
+    bool ok = true;
+
+    ////// 詰まったインスタンスの半分を取り消す /////
+    fjt_handle_t blocker = dispatch->postEvent(&unit, &FJTestCancel::onBlock, FJTestCancel::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+    std::vector<fjt_handle_t> handles(QUEUED);
+    for (int i = 0; i < QUEUED; ++i) {
+	handles[i] = dispatch->postQueue(&unit, &FJTestCancel::onWork, i, nullptr, 0, true, __FUNCTION__, __LINE__);
+    }
+    int cancelled = 0;
+    for (int i = 0; i < QUEUED; i += 2) {
+	if (dispatch->cancel(handles[i])) ++cancelled;
+    }
+    // 取り消した結果は待たずに取れる
+    int result = 0;
+    bool got = dispatch->waitResult(handles[0], 0, result);
+    std::cout << "cancel: " << cancelled << "/" << QUEUED / 2 << " immediate=" << got << " result=" << result << std::endl;
+    if (cancelled != QUEUED / 2 || !got || result != FJDISPATCHLITE_RESULT_CANCELLED) ok = false;
+    g_release = true;
+
+    int ran = 0;
+    for (int i = 0; i < QUEUED; ++i) {
+	result = 0;
+	if (!dispatch->waitResult(handles[i], 1000, result)) {
+	    ok = false;
+	    continue;
+	}
+	if (i % 2 == 0) {
+	    if (result != FJDISPATCHLITE_RESULT_CANCELLED) ok = false;
+	} else {
+	    if (result != i) ok = false;
+	    ++ran;
+	}
+    }
+    std::cout << "run: " << ran << "/" << QUEUED / 2 << " called=" << g_called << std::endl;
+    if (ran != QUEUED / 2 || g_called != QUEUED / 2) ok = false;
+
+    ////// 完了済み・開始済みは取り消せない /////
+    bool again = dispatch->cancel(handles[1]);
+    bool done = dispatch->cancel(blocker);
+    std::cout << "finished: cancel=" << again << "," << done << std::endl;
+    if (again || done) ok = false;
+
+    ////// 遅延投入とパラレル実行 /////
+    g_called = 0;
+    fjt_handle_t delayed = dispatch->postQueueAfter(50, &unit, &FJTestCancel::onWork, 1, nullptr, 0, true, __FUNCTION__, __LINE__);
+    g_blocking = false;
+    g_release = false;
+    dispatch->postEvent(&unit, &FJTestCancel::onBlock, FJTestCancel::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+    // バリアの後ろで待っているパラレル実行を取り消す
+    dispatch->postBarrier(&unit, &FJTestCancel::onWork, 3, nullptr, 0, __FUNCTION__, __LINE__);
+    fjt_handle_t parallel = dispatch->postQueue(&unit, &FJTestCancel::onWork, 2, nullptr, 0, false, __FUNCTION__, __LINE__);
+    bool c1 = dispatch->cancel(delayed);
+    bool c2 = dispatch->cancel(parallel);
+    g_release = true;
+    usleep(100000);
+    int r1 = 0;
+    int r2 = 0;
+    dispatch->waitResult(delayed, 1000, r1);
+    dispatch->waitResult(parallel, 1000, r2);
+    std::cout << "delayed/parallel: cancel=" << c1 << "," << c2 << " called=" << g_called << std::endl;
+    if (!c1 || !c2 || r1 != FJDISPATCHLITE_RESULT_CANCELLED || r2 != FJDISPATCHLITE_RESULT_CANCELLED || g_called != 1) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
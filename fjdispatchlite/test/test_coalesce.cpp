@@ -0,0 +1,137 @@
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+#include "fjdispatchgroup.h"
+
+#define POSTS (1000)
+
+static std::atomic<bool> g_blocking(false);
+static std::atomic<bool> g_release(false);
+
+class FJTestCoalesce : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_CHANGED,
+	MID_ON_OTHER,
+	MID_ON_BLOCK,
+    };
+
+    std::atomic<int> changed{0};
+    std::atomic<int> other{0};
+
+    virtual int onChanged(uint32_t msg);
+    virtual int onBlock(uint32_t msg);
+
+    BEGIN_MAP_EVENTS( FJTestCoalesce )
+    MAP_EVENTS( MID_ON_CHANGED, FJTestCoalesce::onChanged )
+    MAP_EVENTS( MID_ON_OTHER, FJTestCoalesce::onChanged )
+    MAP_EVENTS( MID_ON_BLOCK, FJTestCoalesce::onBlock )
+    END_MAP_EVENTS()
+};
+
+int FJTestCoalesce::onChanged(uint32_t msg)
+{
+    if (msg == MID_ON_CHANGED) ++changed;
+    else ++other;
+    return 0;
+}
+
+int FJTestCoalesce::onBlock(uint32_t msg)
+{
+    g_blocking = true;
+    while (!g_release) usleep(1000);
+    return 0;
+}
+
+static void block(FJDispatchLite* dispatch, FJTestCoalesce* unit)
+{
+    g_blocking = false;
+    g_release = false;
+    dispatch->postEvent(unit, &FJTestCoalesce::onBlock, FJTestCoalesce::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestCoalesce unit;
+    FJPostAttr coalesce = FJPostAttr().withCoalesce();
+    bool ok = true;
+
+    ////// 詰まっている間に複数スレッドから同じイベントを投入 /////
+    block(dispatch, &unit);
+    std::vector<fjt_handle_t> handles(POSTS * 2);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 2; ++t) {
+	producers.emplace_back([&, t]() {
+	    for (int i = 0; i < POSTS; ++i) {
+		handles[t * POSTS + i] = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED, __FUNCTION__, __LINE__, coalesce);
+	    }
+	});
+    }
+    for (auto& p : producers) p.join();
+    // メッセージIDが違えば別、指定がなければまとめない
+    fjt_handle_t other = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_OTHER, __FUNCTION__, __LINE__, coalesce);
+    fjt_handle_t plain = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_OTHER, __FUNCTION__, __LINE__);
+    bool same = true;
+    for (fjt_handle_t h : handles) same = same && (h == handles[0]);
+    std::cout << "pending: same handle=" << same << " other=" << (other != handles[0]) << " plain=" << (plain != other) << " coalesced=" << dispatch->getCoalescedCount() << std::endl;
+    if (!same || other == handles[0] || plain == other || dispatch->getCoalescedCount() != POSTS * 2 - 1) ok = false;
+    g_release = true;
+    int result = -1;
+    if (!dispatch->waitResult(handles[0], 1000, result) || result != 0) ok = false;
+    dispatch->waitResult(plain, 1000, result);
+    std::cout << "run: changed=" << unit.changed << " other=" << unit.other << std::endl;
+    if (unit.changed != 1 || unit.other != 2) ok = false;
+
+    ////// 完了後の投入は新たに積む /////
+    fjt_handle_t next = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED, __FUNCTION__, __LINE__, coalesce);
+    dispatch->waitResult(next, 1000, result);
+    std::cout << "after run: new handle=" << (next != handles[0]) << " changed=" << unit.changed << std::endl;
+    if (next == handles[0] || unit.changed != 2) ok = false;
+
+    ////// 取り消されたものには相乗りしない /////
+    block(dispatch, &unit);
+    fjt_handle_t first = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED, __FUNCTION__, __LINE__, coalesce);
+    dispatch->cancel(first);
+    fjt_handle_t second = dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED, __FUNCTION__, __LINE__, coalesce);
+    // 一括投入でも相乗りする
+    FJDispatchLite::EventItem<FJTestCoalesce> items[4];
+    for (auto& it : items) it = { &unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED };
+    fjt_handle_t batch[4];
+    dispatch->postEventBatch(items, 4, __FUNCTION__, __LINE__, batch, coalesce);
+    g_release = true;
+    dispatch->waitResult(second, 1000, result);
+    bool batched = true;
+    for (fjt_handle_t h : batch) batched = batched && (h == second);
+    std::cout << "after cancel: new handle=" << (second != first) << " batch=" << batched << " changed=" << unit.changed << std::endl;
+    if (second == first || !batched || unit.changed != 3) ok = false;
+
+    ////// グループに数えるのは積んだものだけ /////
+    block(dispatch, &unit);
+    FJDispatchGroup group;
+    std::atomic<int> notified{0};
+    FJPostAttr grouped = FJPostAttr().withCoalesce().withGroup(&group);
+    producers.clear();
+    for (int t = 0; t < 2; ++t) {
+	producers.emplace_back([&]() {
+	    for (int i = 0; i < POSTS; ++i) {
+		dispatch->postEvent(&unit, &FJTestCoalesce::onChanged, FJTestCoalesce::MID_ON_CHANGED, __FUNCTION__, __LINE__, grouped);
+	    }
+	});
+    }
+    for (auto& p : producers) p.join();
+    group.notify([&]() { ++notified; });
+    // 実行前に完了を知らせない
+    bool early = notified != 0 || group.wait(0);
+    g_release = true;
+    bool done = group.wait(1000);
+    std::cout << "group: early=" << early << " done=" << done << " notified=" << notified << " changed=" << unit.changed << std::endl;
+    if (early || !done || notified != 1 || unit.changed != 4) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
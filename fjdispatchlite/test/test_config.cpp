@@ -0,0 +1,56 @@
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+class FJTestAffinity : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_CHECK,
+    };
+
+    virtual int onCheck(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestAffinity )
+    MAP_MESSAGES( MID_ON_CHECK, FJTestAffinity::onCheck )
+    END_MAP_MESSAGES()
+};
+
+int FJTestAffinity::onCheck(uint32_t msg, void* buf, uint32_t len)
+{
+    // ワーカーが許可されたCPUの数を返す
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    return CPU_ISSET(0, &set) ? CPU_COUNT(&set) : -1;
+}
+
+int main() {
+    FJDispatchLite::Config config;
+    config.min_threads = 1;
+    config.initial_threads = 1;
+    config.max_threads = 0; // オンラインのCPU数
+    config.idle_timeout_msec = 10000;
+    config.pinAll({0});
+    bool ok = FJDispatchLite::Configure(config);
+
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    const FJDispatchLite::Config& active = dispatch->getConfig();
+    std::cout << "threads: min=" << active.min_threads << " initial=" << active.initial_threads
+	      << " max=" << active.max_threads << " (online cpus " << sysconf(_SC_NPROCESSORS_ONLN) << ")" << std::endl;
+    if (active.max_threads != static_cast<size_t>(sysconf(_SC_NPROCESSORS_ONLN))) ok = false;
+
+    // 生成後の設定は反映されない
+    if (FJDispatchLite::Configure(config)) ok = false;
+
+    FJTestAffinity unit;
+    fjt_handle_t h = dispatch->postQueue(&unit, &FJTestAffinity::onCheck, FJTestAffinity::MID_ON_CHECK, NULL, 0, true, __FUNCTION__, __LINE__);
+    int result = 0;
+    dispatch->waitResult(h, 1000, result);
+    std::cout << "worker affinity: " << result << " cpu(s)" << std::endl;
+    if (result != 1) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include "fjdispatchco.h"
+
+#define FLOWS (100)
+#define SLEEP_MSEC (50)
+
+static std::atomic<int> g_done(0);
+static std::atomic<int> g_bad(0);
+static std::atomic<int> g_resumed(0);
+static std::atomic<int> g_destroyed(0);
+static std::atomic<bool> g_gate(false);
+
+/**
+ * @brief コルーチンのフレームが破棄されたことを数える
+ */
+struct FJTestCoGuard {
+    ~FJTestCoGuard() { ++g_destroyed; }
+};
+
+/**
+ * @brief 既定構築できない結果の型
+ */
+struct FJTestCoValue {
+    explicit FJTestCoValue(int v) : v_(v) {}
+    int v_;
+};
+
+class FJTestCoWorker : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_DOUBLE,
+	MID_ON_PING,
+	MID_ON_GATE,
+    };
+
+    virtual int onDouble(uint32_t msg, void* buf, uint32_t len);
+    virtual int onPing(uint32_t msg);
+    virtual int onGate(uint32_t msg);
+
+    BEGIN_MAP_MESSAGES( FJTestCoWorker )
+    MAP_MESSAGES( MID_ON_DOUBLE, FJTestCoWorker::onDouble )
+    END_MAP_MESSAGES()
+
+    BEGIN_MAP_EVENTS( FJTestCoWorker )
+    MAP_EVENTS( MID_ON_PING, FJTestCoWorker::onPing )
+    MAP_EVENTS( MID_ON_GATE, FJTestCoWorker::onGate )
+    END_MAP_EVENTS()
+};
+
+int FJTestCoWorker::onDouble(uint32_t msg, void* buf, uint32_t len)
+{
+    // データは整列されていないことがある
+    int n = 0;
+    std::memcpy(&n, buf, sizeof(n));
+    return n * 2;
+}
+
+int FJTestCoWorker::onPing(uint32_t msg)
+{
+    return 7;
+}
+
+int FJTestCoWorker::onGate(uint32_t msg)
+{
+    // 開くまで結果を返さない
+    while (!g_gate.load()) usleep(1000);
+    return 1;
+}
+
+class FJTestCoFlow : public FJUnitFrames {
+public:
+    FJCoTask run(FJTestCoWorker* worker, int n);
+    FJCoTask park(uint32_t msec);
+    FJCoTask hold(FJTestCoWorker* worker);
+
+    int steps_ = 0; //!< シーケンシャル実行で更新する
+};
+
+FJCoTask FJTestCoFlow::run(FJTestCoWorker* worker, int n)
+{
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    // 別インスタンスのメッセージ
+    std::optional<int> doubled = co_await FJCo::send(worker, &FJTestCoWorker::onDouble, FJTestCoWorker::MID_ON_DOUBLE, &n, sizeof(n));
+    ++steps_;
+    std::optional<int> ping = co_await FJCo::event(worker, &FJTestCoWorker::onPing, FJTestCoWorker::MID_ON_PING);
+    ++steps_;
+    // タイマー
+    co_await FJCo::sleep(SLEEP_MSEC);
+    ++steps_;
+    // 結果ハンドル
+    int m = n + 1;
+    fjt_handle_t h = dispatch->postQueue(worker, &FJTestCoWorker::onDouble, FJTestCoWorker::MID_ON_DOUBLE, &m, sizeof(m), false, __FUNCTION__, __LINE__);
+    std::optional<int> handled = co_await FJCo::result(dispatch, h);
+    ++steps_;
+    // 型付きの結果
+    std::optional<long> sum = co_await dispatch->post(worker, [n]() { return static_cast<long>(n) * 3; }, false);
+    ++steps_;
+    // 既定構築できない型の結果と、無効なFJFuture
+    std::optional<FJTestCoValue> boxed = co_await dispatch->post(worker, [n]() { return FJTestCoValue(n); }, false);
+    std::optional<int> none = co_await FJFuture<int>();
+    if (!doubled || *doubled != n * 2 || !ping || *ping != 7 || !handled || *handled != m * 2 || !sum || *sum != n * 3) ++g_bad;
+    if (!boxed || boxed->v_ != n || none) ++g_bad;
+    ++g_done;
+}
+
+FJCoTask FJTestCoFlow::park(uint32_t msec)
+{
+    FJTestCoGuard guard;
+    co_await FJCo::sleep(msec);
+    ++g_resumed;
+}
+
+FJCoTask FJTestCoFlow::hold(FJTestCoWorker* worker)
+{
+    FJTestCoGuard guard;
+    co_await FJCo::event(worker, &FJTestCoWorker::onGate, FJTestCoWorker::MID_ON_GATE);
+    ++g_resumed;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+    FJTestCoWorker worker;
+    static FJTestCoFlow flows[FLOWS];
+
+    ////// ワーカーを塞がずに多数のフローを中断・再開 /////
+    int64_t t0 = _get_time();
+    for (int i = 0; i < FLOWS; ++i) {
+	FJTestCoFlow* flow = &flows[i];
+	dispatch->post(flow, [flow, &worker, i]() { flow->run(&worker, i); });
+    }
+    while (g_done < FLOWS && _get_time() - t0 < 10000) usleep(1000);
+    int64_t elapsed = _get_time() - t0;
+    int steps = 0;
+    for (int i = 0; i < FLOWS; ++i) steps += flows[i].steps_;
+    std::cout << "flows: " << g_done << "/" << FLOWS << " bad=" << g_bad << " steps=" << steps
+	      << " in " << elapsed << "ms" << std::endl;
+    if (g_done != FLOWS || g_bad != 0 || steps != FLOWS * 5) ok = false;
+    // 中断中にワーカーを塞いでいれば FLOWS * SLEEP_MSEC / ワーカー数 かかる
+    if (elapsed >= FLOWS * SLEEP_MSEC / FJDISPATCHLITE_MAX_THREADS) ok = false;
+
+    ////// 中断中に再開先を登録解除するとコルーチンを破棄する /////
+    FJTestCoFlow* owner = new FJTestCoFlow();
+    // park()は最初の中断で戻るので、これが完了すれば中断中
+    dispatch->post(owner, [owner]() { owner->park(SLEEP_MSEC); }).wait(1000);
+    delete owner;
+    // 遅延の満了を待たずに登録解除の中で破棄する
+    int destroyed = g_destroyed;
+    std::cout << "detached: resumed=" << g_resumed << " destroyed=" << destroyed << std::endl;
+    if (g_resumed != 0 || destroyed != 1) ok = false;
+
+    ////// 結果待ちの中断中に再開先を破棄しても、完了時に解放済みのインスタンスに触れない /////
+    owner = new FJTestCoFlow();
+    FJTestCoWorker gate;
+    dispatch->post(owner, [owner, &gate]() { owner->hold(&gate); }).wait(1000);
+    delete owner;
+    destroyed = g_destroyed;
+    g_gate = true;
+    // 完了した結果の継続が実行されるまで待つ
+    dispatch->post(&gate, []() {}).wait(1000);
+    usleep(SLEEP_MSEC * 1000);
+    std::cout << "detached while waiting: resumed=" << g_resumed << " destroyed=" << destroyed << "/" << g_destroyed << std::endl;
+    if (g_resumed != 0 || destroyed != 2 || g_destroyed != 2) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
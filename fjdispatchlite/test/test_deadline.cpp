@@ -0,0 +1,114 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+static std::atomic<bool> g_release(false);
+static std::atomic<bool> g_blocking(false);
+static std::vector<int> g_order;
+
+class FJTestDeadline : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_BLOCK,
+	MID_ON_FRAME,
+    };
+
+    virtual int onBlock(uint32_t msg, void* buf, uint32_t len);
+    virtual int onFrame(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestDeadline )
+    MAP_MESSAGES( MID_ON_BLOCK, FJTestDeadline::onBlock )
+    MAP_MESSAGES( MID_ON_FRAME, FJTestDeadline::onFrame )
+    END_MAP_MESSAGES()
+
+    int id_ = 0;
+};
+
+int FJTestDeadline::onBlock(uint32_t msg, void* buf, uint32_t len)
+{
+    g_blocking = true;
+    while (!g_release.load()) usleep(1000);
+    g_blocking = false;
+    return 0;
+}
+
+int FJTestDeadline::onFrame(uint32_t msg, void* buf, uint32_t len)
+{
+    // シリアルキューなのでロック不要(データ付きならデータ長で区別する)
+    g_order.push_back(len > 0 ? 100 + static_cast<int>(len) : id_);
+    return id_;
+}
+
+static void block(FJDispatchLite* queue, FJTestDeadline* unit)
+{
+    while (g_blocking.load()) usleep(1000);
+    g_release = false;
+    queue->postQueue(unit, &FJTestDeadline::onBlock, FJTestDeadline::MID_ON_BLOCK, NULL, 0, true, __FUNCTION__, __LINE__);
+    // ワーカーが塞がるまで待つ
+    while (!g_blocking.load()) usleep(1000);
+}
+
+int main() {
+    // ワーカー1本で実行順を確認する
+    FJDispatchLite* queue = FJDispatchLite::CreateQueue("edf", FJDispatchLite::QOS_DEFAULT, true);
+    queue->setEdfEnabled(true);
+    bool ok = true;
+
+    FJTestDeadline blocker;
+    FJTestDeadline units[5];
+    for (int i = 0; i < 5; ++i) units[i].id_ = i;
+
+    ////// 期限の早い順 /////
+    block(queue, &blocker);
+    fjt_handle_t last = 0;
+    int64_t now = _get_time_usec();
+    for (int i = 0; i < 5; ++i) {
+	// 後に投入したものほど期限が早い
+	FJPostAttr attr(C_MESSAGE_MID, now + (5 - i) * 1000000LL, FJPostAttr::MISS_RUN);
+	fjt_handle_t h = queue->postQueue(&units[i], &FJTestDeadline::onFrame, FJTestDeadline::MID_ON_FRAME, NULL, 0, true, __FUNCTION__, __LINE__, attr);
+	if (i == 0) last = h;
+    }
+    g_release = true;
+    int result = -1;
+    queue->waitResult(last, 5000, result);
+    std::cout << "edf order:";
+    for (int id : g_order) std::cout << " " << id;
+    std::cout << std::endl;
+    if (g_order != std::vector<int>({4, 3, 2, 1, 0})) ok = false;
+
+    ////// 期限切れの破棄 /////
+    g_order.clear();
+    block(queue, &blocker);
+    fjt_handle_t dropped = queue->postQueue(&units[0], &FJTestDeadline::onFrame, FJTestDeadline::MID_ON_FRAME, NULL, 0, true, __FUNCTION__, __LINE__, FJPostAttr::Within(1));
+    usleep(20000);
+    g_release = true;
+    queue->waitResult(dropped, 5000, result);
+    std::cout << "drop: result=" << result << " ran=" << g_order.size() << std::endl;
+    if (result != FJDISPATCHLITE_RESULT_DROPPED || !g_order.empty()) ok = false;
+
+    ////// 期限切れの降格 /////
+    g_order.clear();
+    block(queue, &blocker);
+    char data[2] = {0};
+    // 期限切れのMIDは後から積んだLOWの後ろに回る
+    fjt_handle_t demoted = queue->postQueue(&units[1], &FJTestDeadline::onFrame, FJTestDeadline::MID_ON_FRAME, data, 1, true, __FUNCTION__, __LINE__, FJPostAttr::Within(1, FJPostAttr::MISS_DEMOTE));
+    queue->postQueue(&units[1], &FJTestDeadline::onFrame, FJTestDeadline::MID_ON_FRAME, data, 2, true, __FUNCTION__, __LINE__, C_MESSAGE_LOW);
+    usleep(20000);
+    g_release = true;
+    queue->waitResult(demoted, 5000, result);
+    std::cout << "demote order:";
+    for (int id : g_order) std::cout << " " << id;
+    std::cout << std::endl;
+    if (g_order != std::vector<int>({102, 101})) ok = false;
+
+    FJDispatchLite::DeadlineStats stats;
+    queue->getDeadlineStats(stats);
+    std::cout << "met=" << stats.met << " missed=" << stats.missed << " dropped=" << stats.dropped << " demoted=" << stats.demoted << std::endl;
+    if (stats.met != 5 || stats.missed != 2 || stats.dropped != 1 || stats.demoted != 1) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
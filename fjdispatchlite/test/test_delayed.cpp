@@ -0,0 +1,101 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define POSTS (2000)
+#define UNITS (8)
+
+static std::atomic<int64_t> g_late_total(0);
+static std::atomic<int64_t> g_late_max(0);
+static std::atomic<int> g_done(0);
+
+class FJTestDelayed : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_TIMEOUT,
+	MID_ON_FIRST,
+	MID_ON_SECOND,
+    };
+
+    virtual int onTimeout(uint32_t msg, void* buf, uint32_t len);
+    virtual int onFirst(uint32_t msg);
+    virtual int onSecond(uint32_t msg);
+
+    BEGIN_MAP_MESSAGES( FJTestDelayed )
+    MAP_MESSAGES( MID_ON_TIMEOUT, FJTestDelayed::onTimeout )
+    END_MAP_MESSAGES()
+
+    BEGIN_MAP_EVENTS( FJTestDelayed )
+    MAP_EVENTS( MID_ON_FIRST, FJTestDelayed::onFirst )
+    MAP_EVENTS( MID_ON_SECOND, FJTestDelayed::onSecond )
+    END_MAP_EVENTS()
+
+    std::vector<uint32_t> order_;
+};
+
+int FJTestDelayed::onTimeout(uint32_t msg, void* buf, uint32_t len)
+{
+    // 予定時刻からの遅れ
+    int64_t due;
+    std::memcpy(&due, buf, sizeof(due));
+    int64_t late = _get_time_usec() - due;
+    g_late_total += late;
+    int64_t cur = g_late_max.load();
+    while (late > cur && !g_late_max.compare_exchange_weak(cur, late)) {}
+    ++g_done;
+    return 0;
+}
+
+int FJTestDelayed::onFirst(uint32_t msg)
+{
+    order_.push_back(msg);
+    return 0;
+}
+
+int FJTestDelayed::onSecond(uint32_t msg)
+{
+    order_.push_back(msg);
+    return 0;
+}
+
+int main() {
+    // 全ての遅延タスクの結果を待つまで保持できるスロット数にする
+    FJDispatchLite::Config config;
+    config.max_results = POSTS;
+    FJDispatchLite::Configure(config);
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+
+    ////// 後から積んだ近い予定が先に実行される /////
+    FJTestDelayed unit;
+    fjt_handle_t h1 = dispatch->postEventAfter(100, &unit, &FJTestDelayed::onFirst, FJTestDelayed::MID_ON_FIRST, __FUNCTION__, __LINE__);
+    fjt_handle_t h2 = dispatch->postEventAt(_get_time_usec() + 20000, &unit, &FJTestDelayed::onSecond, FJTestDelayed::MID_ON_SECOND, __FUNCTION__, __LINE__);
+    int result = -1;
+    dispatch->waitResult(h1, 1000, result);
+    dispatch->waitResult(h2, 1000, result);
+    std::cout << "order:";
+    for (uint32_t m : unit.order_) std::cout << " " << m;
+    std::cout << std::endl;
+    if (unit.order_ != std::vector<uint32_t>({FJTestDelayed::MID_ON_SECOND, FJTestDelayed::MID_ON_FIRST})) ok = false;
+
+    ////// 大量の短い遅延 /////
+    FJTestDelayed units[UNITS];
+    std::vector<fjt_handle_t> handles(POSTS);
+    for (int i = 0; i < POSTS; ++i) {
+	uint32_t delay = i % 50;
+	int64_t due = _get_time_usec() + delay * 1000;
+	handles[i] = dispatch->postQueueAfter(delay, &units[i % UNITS], &FJTestDelayed::onTimeout, FJTestDelayed::MID_ON_TIMEOUT, &due, sizeof(due), true, __FUNCTION__, __LINE__);
+    }
+    for (int i = 0; i < POSTS; ++i) {
+	if (!dispatch->waitResult(handles[i], 5000, result)) ok = false;
+    }
+    std::cout << "delayed: " << g_done << "/" << POSTS << " late avg=" << g_late_total / POSTS
+	      << "us max=" << g_late_max << "us" << std::endl;
+    if (g_done != POSTS) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define SHORT_LIVED (10000)
+#define QUEUED (100)
+
+static std::atomic<int> g_called(0);
+static std::atomic<bool> g_blocking(false);
+static std::atomic<bool> g_release(false);
+
+class FJTestDetach : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WORK,
+	MID_ON_BLOCK,
+	MID_ON_SUICIDE,
+    };
+
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBlock(uint32_t msg);
+    virtual int onSuicide(uint32_t msg);
+
+    BEGIN_MAP_MESSAGES( FJTestDetach )
+    MAP_MESSAGES( MID_ON_WORK, FJTestDetach::onWork )
+    END_MAP_MESSAGES()
+
+    BEGIN_MAP_EVENTS( FJTestDetach )
+    MAP_EVENTS( MID_ON_BLOCK, FJTestDetach::onBlock )
+    MAP_EVENTS( MID_ON_SUICIDE, FJTestDetach::onSuicide )
+    END_MAP_EVENTS()
+};
+
+int FJTestDetach::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    ++g_called;
+    return 1;
+}
+
+int FJTestDetach::onBlock(uint32_t msg)
+{
+    g_blocking = true;
+    while (!g_release) usleep(1000);
+    return 0;
+}
+
+int FJTestDetach::onSuicide(uint32_t msg)
+{
+    // 自身のタスクの中で破棄する
+    delete this;
+    return 0;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+    FJDispatchLite::InstanceStats base;
+    dispatch->getInstanceStats(base);
+
+    ////// 短命なインスタンスを大量に /////
+    for (int i = 0; i < SHORT_LIVED; ++i) {
+	FJTestDetach* unit = new FJTestDetach();
+	fjt_handle_t h = dispatch->postQueue(unit, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__);
+	int result = 0;
+	dispatch->waitResult(h, 1000, result);
+	delete unit;
+    }
+    // 最後の実行権が手放されるまで待つ
+    FJDispatchLite::InstanceStats stats;
+    for (int i = 0; i < 100; ++i) {
+	dispatch->getInstanceStats(stats);
+	if (stats.live == base.live) break;
+	usleep(1000);
+    }
+    std::cout << "short-lived: registered=" << stats.registered << " live=" << stats.live << " detached=" << stats.detached << std::endl;
+    if (stats.registered != base.registered || stats.live != base.live || stats.detached - base.detached != SHORT_LIVED) ok = false;
+
+    ////// 実行待ちを取り消す /////
+    g_called = 0;
+    FJTestDetach blocked;
+    dispatch->postEvent(&blocked, &FJTestDetach::onBlock, FJTestDetach::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+    std::vector<fjt_handle_t> handles;
+    for (int i = 0; i < QUEUED; ++i) {
+	handles.push_back(dispatch->postQueue(&blocked, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__));
+	handles.push_back(dispatch->postQueueAfter(100, &blocked, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__));
+    }
+    dispatch->detach(&blocked);
+    g_release = true;
+    int cancelled = 0;
+    for (fjt_handle_t h : handles) {
+	int result = 0;
+	if (dispatch->waitResult(h, 1000, result) && result == FJDISPATCHLITE_RESULT_CANCELLED) ++cancelled;
+    }
+    std::cout << "cancel: cancelled=" << cancelled << "/" << handles.size() << " called=" << g_called << std::endl;
+    if (cancelled != static_cast<int>(handles.size()) || g_called != 0) ok = false;
+
+    ////// 実行し終えてから解除 /////
+    g_called = 0;
+    FJTestDetach drained;
+    for (int i = 0; i < QUEUED; ++i) {
+	dispatch->postQueue(&drained, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, i % 2 == 0, __FUNCTION__, __LINE__);
+    }
+    bool detached = dispatch->detach(&drained, FJDispatchLite::DETACH_DRAIN);
+    std::cout << "drain: detached=" << detached << " called=" << g_called << std::endl;
+    if (!detached || g_called != QUEUED) ok = false;
+    if (dispatch->detach(&drained)) ok = false;
+
+    ////// 実行し終えるのを待つ間に別のスレッドから解除 /////
+    g_called = 0;
+    g_blocking = false;
+    g_release = false;
+    FJDispatchLite::InstanceStats before;
+    dispatch->getInstanceStats(before);
+    {
+	FJTestDetach raced;
+	dispatch->postEvent(&raced, &FJTestDetach::onBlock, FJTestDetach::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+	while (!g_blocking) usleep(1000);
+	for (int i = 0; i < QUEUED; ++i) {
+	    dispatch->postQueue(&raced, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__);
+	}
+	std::atomic<int> drain_ret(-1);
+	std::thread drainer([&]() {
+	    drain_ret = dispatch->detach(&raced, FJDispatchLite::DETACH_DRAIN) ? 1 : 0;
+	});
+	// DETACH_DRAINが待ち始めてから取り消す
+	usleep(50000);
+	bool cancel_ret = dispatch->detach(&raced);
+	g_release = true;
+	drainer.join();
+	dispatch->getInstanceStats(stats);
+	std::cout << "race: drain=" << drain_ret << " cancel=" << cancel_ret << " detached=" << stats.detached - before.detached << std::endl;
+	if (drain_ret != 0 || !cancel_ret || stats.detached - before.detached != 1) ok = false;
+    }
+
+    ////// 他のワーカーで実行中のタスクの完了をデストラクタが待つ /////
+    g_blocking = false;
+    g_release = false;
+    FJTestDetach* busy = new FJTestDetach();
+    dispatch->postEvent(busy, &FJTestDetach::onBlock, FJTestDetach::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+    std::thread releaser([]() {
+	usleep(50000);
+	g_release = true;
+    });
+    int64_t t0 = _get_time();
+    delete busy;
+    // 戻った時点でonBlockは抜けている
+    bool waited = g_release;
+    int64_t waited_ms = _get_time() - t0;
+    releaser.join();
+    std::cout << "destructor: waited=" << waited << " in " << waited_ms << "ms" << std::endl;
+    if (!waited) ok = false;
+
+    ////// 自身のタスクの中で破棄 /////
+    g_called = 0;
+    g_blocking = false;
+    g_release = false;
+    FJTestDetach* suicide = new FJTestDetach();
+    // 破棄後に投入しないよう、先に全て積んでから動かす
+    dispatch->postEvent(suicide, &FJTestDetach::onBlock, FJTestDetach::MID_ON_BLOCK, __FUNCTION__, __LINE__);
+    while (!g_blocking) usleep(1000);
+    dispatch->postEvent(suicide, &FJTestDetach::onSuicide, FJTestDetach::MID_ON_SUICIDE, __FUNCTION__, __LINE__);
+    fjt_handle_t after = dispatch->postQueue(suicide, &FJTestDetach::onWork, FJTestDetach::MID_ON_WORK, nullptr, 0, true, __FUNCTION__, __LINE__);
+    g_release = true;
+    int result = 0;
+    dispatch->waitResult(after, 1000, result);
+    std::cout << "delete this: result=" << result << " called=" << g_called << std::endl;
+    if (result != FJDISPATCHLITE_RESULT_CANCELLED || g_called != 0) ok = false;
+
+    // 遅延投入が取り消されて参照が手放されるのを待つ
+    usleep(200000);
+    dispatch->getInstanceStats(stats);
+    std::cout << "final: registered=" << stats.registered << " live=" << stats.live << " cancelled=" << stats.cancelled << std::endl;
+    if (stats.registered != base.registered || stats.live != base.live) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define CHAINS (1000)
+
+class FJTestFuture : public FJUnitFrames {
+public:
+    int base_ = 40;
+};
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+    FJTestFuture unit;
+
+    ////// 型付きの結果 /////
+    FJFuture<std::string> fs = dispatch->post(&unit, [&unit]() { return std::string("answer=") + std::to_string(unit.base_ + 2); });
+    std::string str;
+    if (!fs.get(1000, str) || str != "answer=42") ok = false;
+    std::cout << "post: " << str << std::endl;
+
+    ////// 継続 /////
+    std::atomic<int> last(0);
+    FJFuture<void> fv = dispatch->post(&unit, []() { return 21; })
+	.then([](int v) { return v * 2; })
+	.then([](int v) { return std::to_string(v); })
+	.then([&last](std::string s) { last = std::stoi(s); });
+    if (!fv.get(1000) || last != 42) ok = false;
+    std::cout << "then: " << last << std::endl;
+
+    ////// 完了後に登録した継続 /////
+    FJFuture<int> done = dispatch->post(&unit, []() { return 7; });
+    done.wait();
+    FJFuture<int> late = done.then([](int v) { return v + 1; });
+    int value = 0;
+    if (!late.get(1000, value) || value != 8 || done.valid()) ok = false;
+    std::cout << "late then: " << value << std::endl;
+
+    ////// 多段の並列パイプライン /////
+    std::vector<FJFuture<int>> futures;
+    for (int i = 0; i < CHAINS; ++i) {
+	futures.push_back(dispatch->post(&unit, [i]() { return i; }, false)
+			  .then([](int v) { return v + 1; })
+			  .then([](int v) { return v * 2; }));
+    }
+    int bad = 0;
+    for (int i = 0; i < CHAINS; ++i) {
+	if (!futures[i].get(5000, value) || value != (i + 1) * 2) ++bad;
+    }
+    std::cout << "pipeline: bad=" << bad << "/" << CHAINS << std::endl;
+    if (bad != 0) ok = false;
+
+    ////// 実行されずに破棄 /////
+    std::atomic<bool> called(false);
+    FJFuture<int> dropped = dispatch->post(&unit, []() { return 1; }, true, FJPostAttr(C_MESSAGE_MID, 1, FJPostAttr::MISS_DROP))
+	.then([&called](int v) { called = true; return v; });
+    bool got = dropped.get(1000, value);
+    std::cout << "dropped: got=" << got << " ready=" << dropped.ready() << " called=" << called << std::endl;
+    if (got || !dropped.ready() || called) ok = false;
+
+    ////// 無効なFJFuture /////
+    FJFuture<int> invalid;
+    FJFuture<int> invalid_next = invalid.then([](int v) { return v + 1; });
+    bool ready_called = false, ready_valid = true;
+    invalid.whenReady([&](FJFuture<int>&& f) { ready_called = true; ready_valid = f.valid(); });
+    std::cout << "invalid: then valid=" << invalid_next.valid() << " whenReady called=" << ready_called << std::endl;
+    if (invalid_next.valid() || !ready_called || ready_valid) ok = false;
+
+    ////// enqueueTaskの結果 /////
+    std::packaged_task<void()> task([]() {});
+    fjt_handle_t h = dispatch->enqueueTask(&unit, std::move(task));
+    int result = -1;
+    if (!dispatch->waitResult(h, 1000, result) || result != 0) ok = false;
+    std::cout << "enqueueTask: " << result << std::endl;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
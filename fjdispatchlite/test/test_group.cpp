@@ -0,0 +1,90 @@
+#include <iostream>
+#include <atomic>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define FANOUT (100)
+#define BEFORE (50)
+#define AFTER (50)
+
+class FJTestGroup : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WORK,
+	MID_ON_BARRIER,
+    };
+
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBarrier(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestGroup )
+    MAP_MESSAGES( MID_ON_WORK, FJTestGroup::onWork )
+    MAP_MESSAGES( MID_ON_BARRIER, FJTestGroup::onBarrier )
+    END_MAP_MESSAGES()
+
+    std::atomic<int> started_{0};
+    std::atomic<int> done_{0};
+    std::atomic<int> seen_at_barrier_{-1};
+    std::atomic<int> started_at_barrier_{-1};
+};
+
+int FJTestGroup::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    ++started_;
+    usleep(*static_cast<uint32_t*>(buf));
+    ++done_;
+    return 0;
+}
+
+int FJTestGroup::onBarrier(uint32_t msg, void* buf, uint32_t len)
+{
+    // バリア実行中は前のタスクが全て終わり、後のタスクは始まっていない
+    seen_at_barrier_ = done_.load();
+    started_at_barrier_ = started_.load();
+    usleep(10000);
+    return 0;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    uint32_t short_usec = 100;
+    uint32_t long_usec = 200;
+    bool ok = true;
+
+    ////// グループで投げて待つ /////
+    FJTestGroup unit;
+    FJDispatchGroup group;
+    std::atomic<bool> notified(false);
+    for (int i = 0; i < FANOUT; ++i) {
+	dispatch->postQueue(&unit, &FJTestGroup::onWork, FJTestGroup::MID_ON_WORK, &short_usec, sizeof(short_usec), false, __FUNCTION__, __LINE__, FJPostAttr().withGroup(&group));
+    }
+    group.notify([&]() { notified = true; });
+    bool waited = group.wait(5000);
+    // notify()の処理は最後に完了したワーカーで実行される
+    for (int i = 0; i < 100 && !notified; ++i) usleep(1000);
+    std::cout << "group: waited=" << waited << " done=" << unit.done_ << "/" << FANOUT << " notified=" << notified << std::endl;
+    if (!waited || unit.done_ != FANOUT || !notified) ok = false;
+    if (group.wait(0) != true) ok = false;
+
+    ////// バリア /////
+    FJTestGroup bunit;
+    FJDispatchGroup bgroup;
+    for (int i = 0; i < BEFORE; ++i) {
+	dispatch->postQueue(&bunit, &FJTestGroup::onWork, FJTestGroup::MID_ON_WORK, &long_usec, sizeof(long_usec), false, __FUNCTION__, __LINE__, FJPostAttr().withGroup(&bgroup));
+    }
+    fjt_handle_t hb = dispatch->postBarrier(&bunit, &FJTestGroup::onBarrier, FJTestGroup::MID_ON_BARRIER, nullptr, 0, __FUNCTION__, __LINE__, FJPostAttr().withGroup(&bgroup));
+    for (int i = 0; i < AFTER; ++i) {
+	dispatch->postQueue(&bunit, &FJTestGroup::onWork, FJTestGroup::MID_ON_WORK, &short_usec, sizeof(short_usec), false, __FUNCTION__, __LINE__, FJPostAttr().withGroup(&bgroup));
+    }
+    int result = -1;
+    if (!dispatch->waitResult(hb, 5000, result)) ok = false;
+    if (!bgroup.wait(5000)) ok = false;
+    std::cout << "barrier: done before=" << bunit.seen_at_barrier_ << "/" << BEFORE
+	      << " started before=" << bunit.started_at_barrier_ << "/" << BEFORE
+	      << " total=" << bunit.done_ << "/" << BEFORE + AFTER << std::endl;
+    if (bunit.seen_at_barrier_ != BEFORE || bunit.started_at_barrier_ != BEFORE || bunit.done_ != BEFORE + AFTER) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
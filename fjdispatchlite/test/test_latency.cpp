@@ -0,0 +1,124 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+#include "fjhistogram.h"
+
+#define ROUNDS (200)
+
+class FJTestLatency : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_FAST,
+	MID_ON_SLOW,
+    };
+
+    virtual int onFast(uint32_t msg, void* buf, uint32_t len);
+    virtual int onSlow(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestLatency )
+    MAP_MESSAGES( MID_ON_FAST, FJTestLatency::onFast )
+    MAP_MESSAGES( MID_ON_SLOW, FJTestLatency::onSlow )
+    END_MAP_MESSAGES()
+};
+
+int FJTestLatency::onFast(uint32_t msg, void* buf, uint32_t len)
+{
+    return 0;
+}
+
+int FJTestLatency::onSlow(uint32_t msg, void* buf, uint32_t len)
+{
+    usleep(1000);
+    return 0;
+}
+
+static const FJDispatchLite::LatencyStats* find(const std::vector<FJDispatchLite::LatencyStats>& stats, uint32_t msg, uint32_t line)
+{
+    for (const auto& s : stats) {
+	if (s.msg == msg && s.srcline == line && s.srcfunc != nullptr && strcmp(s.srcfunc, "main") == 0) return &s;
+    }
+    return nullptr;
+}
+
+static void report(const char* name, const FJDispatchLite::LatencyStats& s)
+{
+    std::cout << name << ": count=" << s.exec_time.count()
+	      << " exec p50=" << s.exec_time.percentile(50) << "us p99=" << s.exec_time.percentile(99) << "us max=" << s.exec_time.max() << "us"
+	      << " delay p50=" << s.queue_delay.percentile(50) << "us p99=" << s.queue_delay.percentile(99) << "us" << std::endl;
+}
+
+int main() {
+    bool ok = true;
+
+    ////// バケット配置 /////
+    uint64_t prev = 0;
+    for (int i = 1; i < FJHistogramBuckets::COUNT; ++i) {
+	uint64_t upper = FJHistogramBuckets::upper(i);
+	if (upper <= prev || FJHistogramBuckets::index(upper) != i || FJHistogramBuckets::index(prev + 1) != i) ok = false;
+	prev = upper;
+    }
+    FJHistogram h;
+    for (uint64_t v = 1; v <= 1000; ++v) h.add(v);
+    std::cout << "histogram: p50=" << h.percentile(50) << " p99=" << h.percentile(99) << " max=" << h.max() << std::endl;
+    if (h.percentile(50) < 500 || h.percentile(50) > 500 + 500 / 8 || h.max() != 1000) ok = false;
+
+    ////// 呼び出し元ごとの記録 /////
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestLatency unit;
+    std::vector<fjt_handle_t> handles;
+    uint32_t fast_line = 0;
+    uint32_t slow_line = 0;
+    for (int i = 0; i < ROUNDS; ++i) {
+	fast_line = __LINE__; handles.push_back(dispatch->postQueue(&unit, &FJTestLatency::onFast, FJTestLatency::MID_ON_FAST, nullptr, 0, true, __FUNCTION__, __LINE__));
+	if (i % 10 == 0) {
+	    slow_line = __LINE__; handles.push_back(dispatch->postQueue(&unit, &FJTestLatency::onSlow, FJTestLatency::MID_ON_SLOW, nullptr, 0, true, __FUNCTION__, __LINE__));
+	}
+    }
+    if (!dispatch->waitAll(handles.data(), handles.size(), 10000)) ok = false;
+
+    std::vector<FJDispatchLite::LatencyStats> stats;
+    dispatch->getLatencyStats(stats);
+#if FJDISPATCHLITE_LATENCY_STATS == 0
+    // 記録しない構成では常に空
+    std::cout << "disabled: stats=" << stats.size() << std::endl;
+    if (!stats.empty()) ok = false;
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+#endif
+    const FJDispatchLite::LatencyStats* fast = find(stats, FJTestLatency::MID_ON_FAST, fast_line);
+    const FJDispatchLite::LatencyStats* slow = find(stats, FJTestLatency::MID_ON_SLOW, slow_line);
+    if (fast == nullptr || slow == nullptr) {
+	std::cout << "NG: call site not found" << std::endl;
+	return 1;
+    }
+    report("fast", *fast);
+    report("slow", *slow);
+    if (fast->exec_time.count() != ROUNDS || slow->exec_time.count() != ROUNDS / 10) ok = false;
+    if (slow->exec_time.percentile(50) < 1000 || fast->exec_time.percentile(50) >= slow->exec_time.percentile(50)) ok = false;
+
+    ////// std::stringで渡した呼び出し関数名 /////
+    handles.clear();
+    uint32_t named_line = __LINE__;
+    for (int i = 0; i < ROUNDS; ++i) {
+	// 投入後すぐに破棄される一時文字列でも名前は残る
+	std::string name = std::string("named") + std::to_string(i % 2);
+	handles.push_back(dispatch->postQueue(&unit, &FJTestLatency::onFast, FJTestLatency::MID_ON_FAST, nullptr, 0, true, name, named_line));
+    }
+    if (!dispatch->waitAll(handles.data(), handles.size(), 10000)) ok = false;
+    dispatch->getLatencyStats(stats);
+    uint64_t named[2] = {0, 0};
+    for (const auto& s : stats) {
+	if (s.srcline != named_line || s.srcfunc == nullptr) continue;
+	if (strcmp(s.srcfunc, "named0") == 0) named[0] += s.exec_time.count();
+	if (strcmp(s.srcfunc, "named1") == 0) named[1] += s.exec_time.count();
+    }
+    std::cout << "named: named0=" << named[0] << " named1=" << named[1] << std::endl;
+    if (named[0] != ROUNDS / 2 || named[1] != ROUNDS / 2) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <atomic>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define BULK (200)
+
+class FJTestPrio : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_BLOCK,
+	MID_ON_BULK,
+	MID_ON_CONTROL,
+	MID_ON_BARRIER,
+    };
+
+    virtual int onBlock(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBulk(uint32_t msg, void* buf, uint32_t len);
+    virtual int onControl(uint32_t msg, void* buf, uint32_t len);
+    virtual int onBarrier(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestPrio )
+    MAP_MESSAGES( MID_ON_BLOCK, FJTestPrio::onBlock )
+    MAP_MESSAGES( MID_ON_BULK, FJTestPrio::onBulk )
+    MAP_MESSAGES( MID_ON_CONTROL, FJTestPrio::onControl )
+    MAP_MESSAGES( MID_ON_BARRIER, FJTestPrio::onBarrier )
+    END_MAP_MESSAGES()
+
+    std::atomic<bool> release_{false};
+    int bulk_done_ = 0;
+    int control_at_ = -1;
+    int barrier_at_ = -1;
+};
+
+int FJTestPrio::onBlock(uint32_t msg, void* buf, uint32_t len)
+{
+    // 後続のメッセージがメールボックスに溜まるまで止める
+    while (!release_.load()) usleep(1000);
+    return 0;
+}
+
+int FJTestPrio::onBulk(uint32_t msg, void* buf, uint32_t len)
+{
+    usleep(100);
+    return ++bulk_done_;
+}
+
+int FJTestPrio::onControl(uint32_t msg, void* buf, uint32_t len)
+{
+    control_at_ = bulk_done_;
+    return control_at_;
+}
+
+int FJTestPrio::onBarrier(uint32_t msg, void* buf, uint32_t len)
+{
+    barrier_at_ = bulk_done_;
+    // 後から積んだ制御メッセージはまだ実行されていない
+    return control_at_ < 0 ? 1 : 0;
+}
+
+/**
+ * @brief バリアが優先度の異なるレーンをまたいで積んだ順に実行されるか
+ */
+static bool check_barrier(FJDispatchLite* dispatch, const char* name)
+{
+    FJTestPrio unit;
+    char buf[256] = {0};
+    dispatch->postQueue(&unit, &FJTestPrio::onBlock, FJTestPrio::MID_ON_BLOCK, NULL, 0, true, __FUNCTION__, __LINE__);
+    for (int i = 0; i < BULK / 4; ++i) {
+	dispatch->postQueue(&unit, &FJTestPrio::onBulk, FJTestPrio::MID_ON_BULK, buf, sizeof(buf), true, __FUNCTION__, __LINE__, C_MESSAGE_LOW);
+    }
+    fjt_handle_t hb = dispatch->postBarrier(&unit, &FJTestPrio::onBarrier, FJTestPrio::MID_ON_BARRIER, NULL, 0, __FUNCTION__, __LINE__);
+    fjt_handle_t ctrl = dispatch->postQueue(&unit, &FJTestPrio::onControl, FJTestPrio::MID_ON_CONTROL, NULL, 0, true, __FUNCTION__, __LINE__, C_MESSAGE_HIGH);
+    fjt_handle_t last = 0;
+    for (int i = 0; i < BULK / 4; ++i) {
+	last = dispatch->postQueue(&unit, &FJTestPrio::onBulk, FJTestPrio::MID_ON_BULK, buf, sizeof(buf), true, __FUNCTION__, __LINE__, C_MESSAGE_MID);
+    }
+    unit.release_ = true;
+
+    int before_control = -1, at = -1, result = -1;
+    bool ok = dispatch->waitResult(hb, 10000, before_control) && dispatch->waitResult(ctrl, 10000, at) && dispatch->waitResult(last, 10000, result);
+    // バリアは先に積んだLOWを全て待ち、後から積んだHIGH・MIDはバリアの後
+    std::cout << name << " barrier: after " << unit.barrier_at_ << "/" << BULK / 4
+	      << " bulk messages, control after " << at << std::endl;
+    return ok && unit.barrier_at_ == BULK / 4 && before_control == 1 && at >= BULK / 4 && result == BULK / 2;
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestPrio unit;
+    char buf[256] = {0};
+
+    dispatch->postQueue(&unit, &FJTestPrio::onBlock, FJTestPrio::MID_ON_BLOCK, NULL, 0, true, __FUNCTION__, __LINE__);
+    fjt_handle_t last = 0;
+    for (int i = 0; i < BULK; ++i) {
+	last = dispatch->postQueue(&unit, &FJTestPrio::onBulk, FJTestPrio::MID_ON_BULK, buf, sizeof(buf), true, __FUNCTION__, __LINE__, C_MESSAGE_LOW);
+    }
+    fjt_handle_t ctrl = dispatch->postQueue(&unit, &FJTestPrio::onControl, FJTestPrio::MID_ON_CONTROL, NULL, 0, true, __FUNCTION__, __LINE__, C_MESSAGE_HIGH);
+    unit.release_ = true;
+
+    int result = -1;
+    dispatch->waitResult(last, 10000, result);
+    int at = -1;
+    dispatch->waitResult(ctrl, 10000, at);
+    // 制御メッセージは溜まっていたバルクより先に処理される
+    bool ok = (result == BULK && at == 0);
+    std::cout << "strict: control executed after " << at << "/" << BULK << " bulk messages" << std::endl;
+
+    FJDispatchLite::LaneStats stats[FJDISPATCHLITE_PRIO_LANES];
+    dispatch->getLaneStats(stats);
+    const char* names[] = {"HIGH", "MID", "LOW"};
+    for (int l = 0; l < FJDISPATCHLITE_PRIO_LANES; ++l) {
+	std::cout << names[l] << ": count=" << stats[l].count
+		  << " avg=" << (stats[l].count ? stats[l].total_delay_usec / stats[l].count : 0)
+		  << "us max=" << stats[l].max_delay_usec << "us" << std::endl;
+    }
+
+    ////// バリアの順序(両方の選択方式) /////
+    if (!check_barrier(dispatch, "strict")) ok = false;
+    dispatch->setPrioPolicy(FJDispatchLite::PRIO_WEIGHTED);
+    if (!check_barrier(dispatch, "weighted")) ok = false;
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+static std::atomic<int> g_serial_busy(0);
+static std::atomic<bool> g_serial_overlap(false);
+
+class FJTestQueue : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WHERE,
+	MID_ON_SERIAL,
+    };
+
+    virtual int onWhere(uint32_t msg, void* buf, uint32_t len);
+    virtual int onSerial(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestQueue )
+    MAP_MESSAGES( MID_ON_WHERE, FJTestQueue::onWhere )
+    MAP_MESSAGES( MID_ON_SERIAL, FJTestQueue::onSerial )
+    END_MAP_MESSAGES()
+
+    int where() {
+	int result = -1;
+	fjt_handle_t h = SendMsgSelf_S(MID_ON_WHERE, C_MESSAGE_MID, NULL, 0);
+	FJDispatchLite::GetQueueFor(this)->waitResult(h, 1000, result);
+	return result;
+    }
+
+    const char* expect_ = "";
+};
+
+int FJTestQueue::onWhere(uint32_t msg, void* buf, uint32_t len)
+{
+    // 実行しているワーカーのスレッド名がキュー名と一致するか
+    char name[16] = {0};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    return std::strcmp(name, expect_) == 0 ? 1 : 0;
+}
+
+int FJTestQueue::onSerial(uint32_t msg, void* buf, uint32_t len)
+{
+    // シリアルキューでは別インスタンスのタスクとも重ならない
+    if (g_serial_busy.fetch_add(1) != 0) g_serial_overlap = true;
+    usleep(100);
+    g_serial_busy.fetch_sub(1);
+    return 0;
+}
+
+// 名前付きキューより後に破棄される(キューの破棄で登録が解除され、自身のデストラクタでは解放済みの情報に触れない)
+static FJTestQueue g_outlive;
+
+int main() {
+    FJDispatchLite* control = FJDispatchLite::CreateQueue("control", FJDispatchLite::QOS_USER_INTERACTIVE, true);
+    FJDispatchLite* bulk = FJDispatchLite::CreateQueue("bulk", FJDispatchLite::QOS_BACKGROUND, false, 4);
+    bool ok = (control != nullptr && bulk != nullptr);
+    if (FJDispatchLite::CreateQueue("control", FJDispatchLite::QOS_DEFAULT, true) != nullptr) ok = false;
+    if (FJDispatchLite::GetQueue("bulk") != bulk) ok = false;
+    if (FJDispatchLite::GetQueue(FJDISPATCHLITE_MAIN_QUEUE) != FJDispatchLite::GetInstance()) ok = false;
+
+    ////// インスタンス単位の投入先 /////
+    FJTestQueue on_main, on_control, on_bulk;
+    on_main.expect_ = FJDISPATCHLITE_MAIN_QUEUE;
+    on_control.setDispatchQueue(control);
+    on_control.expect_ = "control";
+    on_bulk.setDispatchQueue(bulk);
+    on_bulk.expect_ = "bulk";
+    int r0 = on_main.where(), r1 = on_control.where(), r2 = on_bulk.where();
+    std::cout << "main=" << r0 << " control=" << r1 << " bulk=" << r2 << std::endl;
+    if (r0 != 1 || r1 != 1 || r2 != 1) ok = false;
+    g_outlive.setDispatchQueue(bulk);
+    g_outlive.expect_ = "bulk";
+    if (g_outlive.where() != 1) ok = false;
+
+    ////// 投入ごとの投入先(シリアルキュー) /////
+    FJTestQueue units[4];
+    fjt_handle_t last[4];
+    for (int n = 0; n < 50; ++n) {
+	for (int i = 0; i < 4; ++i) {
+	    last[i] = control->postQueue(&units[i], &FJTestQueue::onSerial, FJTestQueue::MID_ON_SERIAL, NULL, 0, true, __FUNCTION__, __LINE__);
+	}
+    }
+    for (int i = 0; i < 4; ++i) {
+	int result = -1;
+	if (!control->waitResult(last[i], 5000, result)) ok = false;
+    }
+    std::cout << "serial overlap=" << g_serial_overlap << std::endl;
+    if (g_serial_overlap) ok = false;
+
+    ////// 同じインスタンスを複数のキューへ(キャッシュの要素数を超える) /////
+    const char* names[] = { "multi0", "multi1", "multi2", "multi3" };
+    FJDispatchLite* queues[] = { FJDispatchLite::GetInstance(), control, bulk, nullptr, nullptr, nullptr, nullptr };
+    const char* expects[] = { FJDISPATCHLITE_MAIN_QUEUE, "control", "bulk", names[0], names[1], names[2], names[3] };
+    for (int i = 0; i < 4; ++i) queues[3 + i] = FJDispatchLite::CreateQueue(names[i], FJDispatchLite::QOS_DEFAULT, false, 1);
+    FJTestQueue shared;
+    int misplaced = 0;
+    for (int n = 0; n < 3; ++n) {
+	for (int q = 0; q < 7; ++q) {
+	    // 投入先ごとのメールボックスで、そのキューのワーカーが実行する
+	    shared.expect_ = expects[q];
+	    int result = -1;
+	    fjt_handle_t h = queues[q]->postQueue(&shared, &FJTestQueue::onWhere, FJTestQueue::MID_ON_WHERE, NULL, 0, true, __FUNCTION__, __LINE__);
+	    if (!queues[q]->waitResult(h, 1000, result) || result != 1) ++misplaced;
+	}
+    }
+    std::cout << "multi queue misplaced=" << misplaced << std::endl;
+    if (misplaced != 0) ok = false;
+
+    ////// キューごとのリザルトスロット数(2のべき乗に切り上げる) /////
+    FJDispatchLite* small = FJDispatchLite::CreateQueue("small", FJDispatchLite::QOS_DEFAULT, true, 1, 100);
+    size_t small_results = small ? small->getConfig().max_results : 0;
+    std::cout << "results main=" << FJDispatchLite::GetInstance()->getConfig().max_results << " control=" << control->getConfig().max_results << " small=" << small_results << std::endl;
+    if (FJDispatchLite::GetInstance()->getConfig().max_results != FJDISPATCHLITE_MAX_RESULTS) ok = false;
+    if (control->getConfig().max_results != FJDISPATCHLITE_QUEUE_MAX_RESULTS || small_results != 128) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
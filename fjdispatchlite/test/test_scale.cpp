@@ -0,0 +1,87 @@
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define BURST (16)
+#define IDLE_TIMEOUT_MSEC (200)
+
+class FJTestScale : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_WORK,
+    };
+
+    virtual int onWork(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestScale )
+    MAP_MESSAGES( MID_ON_WORK, FJTestScale::onWork )
+    END_MAP_MESSAGES()
+};
+
+int FJTestScale::onWork(uint32_t msg, void* buf, uint32_t len)
+{
+    usleep(20000);
+    return static_cast<int>(msg);
+}
+
+/**
+ * @brief パラレル実行をまとめて投入し、ワーカーが増えるまでの時間を測る
+ */
+static void burst(FJDispatchLite* dispatch, FJTestScale* unit, size_t max_threads, bool& ok)
+{
+    std::vector<fjt_handle_t> handles;
+    int64_t t0 = _get_time_usec();
+    for (int i = 0; i < BURST; ++i) {
+	handles.push_back(dispatch->postQueue(unit, &FJTestScale::onWork, i, nullptr, 0, false, __FUNCTION__, __LINE__));
+    }
+    FJDispatchLite::ScalingStats stats;
+    do {
+	dispatch->getScalingStats(stats);
+    } while (stats.threads < max_threads && _get_time_usec() - t0 < 1000000);
+    int64_t grow_usec = _get_time_usec() - t0;
+    if (!dispatch->waitAll(handles.data(), handles.size(), 5000)) ok = false;
+    int64_t done_usec = _get_time_usec() - t0;
+    std::cout << "burst: threads=" << stats.threads << " in " << grow_usec << "us, done in " << done_usec / 1000 << "ms" << std::endl;
+    if (stats.threads != max_threads || grow_usec > 10000) ok = false;
+}
+
+/**
+ * @brief 最小数まで減るのを待つ
+ */
+static void settle(FJDispatchLite* dispatch, size_t min_threads, bool& ok)
+{
+    FJDispatchLite::ScalingStats stats;
+    for (int i = 0; i < IDLE_TIMEOUT_MSEC * 5 / 10; ++i) {
+	dispatch->getScalingStats(stats);
+	if (stats.threads == min_threads) break;
+	usleep(10000);
+    }
+    std::cout << "idle: threads=" << stats.threads << " peak=" << stats.peak_threads << " grown=" << stats.grown << " retired=" << stats.retired << std::endl;
+    if (stats.threads != min_threads) ok = false;
+}
+
+int main() {
+    FJDispatchLite::Config config;
+    config.min_threads = 1;
+    config.initial_threads = 1;
+    config.max_threads = 4;
+    config.idle_timeout_msec = IDLE_TIMEOUT_MSEC;
+    bool ok = FJDispatchLite::Configure(config);
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestScale unit;
+
+    ////// まとめて投入されたらすぐに増やし、暇になったら自ら終了する /////
+    burst(dispatch, &unit, config.max_threads, ok);
+    settle(dispatch, config.min_threads, ok);
+    // 終了したスロットを使い回す
+    burst(dispatch, &unit, config.max_threads, ok);
+    settle(dispatch, config.min_threads, ok);
+    FJDispatchLite::ScalingStats stats;
+    dispatch->getScalingStats(stats);
+    if (stats.grown != 6 || stats.retired != 6 || stats.peak_threads != 4) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
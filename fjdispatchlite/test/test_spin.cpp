@@ -0,0 +1,63 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define ROUNDS (500)
+
+class FJTestSpin : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_PING,
+    };
+
+    virtual int onPing(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestSpin )
+    MAP_MESSAGES( MID_ON_PING, FJTestSpin::onPing )
+    END_MAP_MESSAGES()
+};
+
+int FJTestSpin::onPing(uint32_t msg, void* buf, uint32_t len)
+{
+    return static_cast<int>(msg);
+}
+
+/**
+ * @brief 投入から結果取得までの時間の中央値(usec)
+ * @param[in] gap_usec 投入の間隔
+ */
+static int64_t roundtrip(FJDispatchLite* dispatch, FJTestSpin* unit, useconds_t gap_usec, bool& ok)
+{
+    std::vector<int64_t> samples;
+    for (int i = 0; i < ROUNDS; ++i) {
+	if (gap_usec > 0) usleep(gap_usec);
+	int64_t t0 = _get_time_usec();
+	fjt_handle_t h = dispatch->postQueue(unit, &FJTestSpin::onPing, i, nullptr, 0, true, __FUNCTION__, __LINE__);
+	int result = -1;
+	if (!dispatch->waitResult(h, 1000, result) || result != i) ok = false;
+	samples.push_back(_get_time_usec() - t0);
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    FJTestSpin unit;
+    bool ok = true;
+
+    ////// 眠らせる場合と少し待たせる場合で取りこぼさない /////
+    dispatch->setIdleSpin(0);
+    int64_t park = roundtrip(dispatch, &unit, 0, ok);
+    int64_t park_gap = roundtrip(dispatch, &unit, 200, ok);
+    dispatch->setIdleSpin(100);
+    int64_t spin = roundtrip(dispatch, &unit, 0, ok);
+    int64_t spin_gap = roundtrip(dispatch, &unit, 200, ok);
+    std::cout << "roundtrip p50: park=" << park << "us (gap " << park_gap << "us) spin=" << spin << "us (gap " << spin_gap << "us)" << std::endl;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define FANOUT (64)
+
+class FJTestWait : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_SLEEP,
+    };
+
+    virtual int onSleep(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestWait )
+    MAP_MESSAGES( MID_ON_SLEEP, FJTestWait::onSleep )
+    END_MAP_MESSAGES()
+};
+
+int FJTestWait::onSleep(uint32_t msg, void* buf, uint32_t len)
+{
+    // 指定時間眠って値をそのまま返す
+    uint32_t usec = *static_cast<uint32_t*>(buf);
+    usleep(usec);
+    return static_cast<int>(usec);
+}
+
+int main() {
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    bool ok = true;
+    FJTestWait unit;
+
+    ////// 全ての完了を待つ /////
+    std::vector<fjt_handle_t> handles(FANOUT);
+    for (int i = 0; i < FANOUT; ++i) {
+	uint32_t usec = (FANOUT - i) * 100;
+	handles[i] = dispatch->postQueue(&unit, &FJTestWait::onSleep, FJTestWait::MID_ON_SLEEP, &usec, sizeof(usec), false, __FUNCTION__, __LINE__);
+    }
+    std::vector<int> results;
+    int64_t t0 = _get_time_usec();
+    bool all = dispatch->waitAll(handles, 5000, results);
+    int64_t t1 = _get_time_usec();
+    int bad = 0;
+    for (int i = 0; i < FANOUT; ++i) {
+	if (results[i] != (FANOUT - i) * 100) ++bad;
+    }
+    std::cout << "waitAll: " << all << " bad=" << bad << " in " << (t1 - t0) << "us" << std::endl;
+    if (!all || bad != 0) ok = false;
+
+    ////// いずれかの完了を待つ /////
+    uint32_t slow_usec = 200000;
+    uint32_t fast_usec = 1000;
+    fjt_handle_t pair[2];
+    pair[0] = dispatch->postQueue(&unit, &FJTestWait::onSleep, FJTestWait::MID_ON_SLEEP, &slow_usec, sizeof(slow_usec), false, __FUNCTION__, __LINE__);
+    pair[1] = dispatch->postQueue(&unit, &FJTestWait::onSleep, FJTestWait::MID_ON_SLEEP, &fast_usec, sizeof(fast_usec), false, __FUNCTION__, __LINE__);
+    size_t which = 99;
+    int result = -1;
+    bool any = dispatch->waitAny(pair, 2, 5000, which, result);
+    std::cout << "waitAny: " << any << " which=" << which << " result=" << result << std::endl;
+    if (!any || which != 1 || result != static_cast<int>(fast_usec)) ok = false;
+
+    ////// タイムアウト /////
+    fjt_handle_t slow = dispatch->postQueue(&unit, &FJTestWait::onSleep, FJTestWait::MID_ON_SLEEP, &slow_usec, sizeof(slow_usec), false, __FUNCTION__, __LINE__);
+    fjt_handle_t both[2] = { pair[0], slow };
+    bool timed = dispatch->waitAll(both, 2, 10);
+    std::cout << "waitAll timeout: " << timed << std::endl;
+    if (timed) ok = false;
+    if (!dispatch->waitAll(both, 2, 5000)) ok = false;
+
+    std::cout << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}
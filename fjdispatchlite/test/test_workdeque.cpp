@@ -0,0 +1,102 @@
+#include <iostream>
+#include <atomic>
+#include <pthread.h>
+#include "fjworkdeque.h"
+#include "fjdispatchlite.h"
+#include "fjunitframes.h"
+
+#define ITEMS (100000)
+#define THIEVES (3)
+
+static FJWorkDeque<int> g_deque(256);
+static std::atomic<bool> g_done(false);
+static std::atomic<long> g_sum(0);
+static std::atomic<long> g_count(0);
+static int g_items[ITEMS];
+
+static void* thiefFunc(void*)
+{
+    while (!g_done.load()) {
+	int* p = g_deque.steal();
+	if (p) {
+	    g_sum += *p;
+	    ++g_count;
+	}
+    }
+    return nullptr;
+}
+
+class FJTestCount : public FJUnitFrames {
+public:
+    enum {
+	MID_ON_COUNT,
+    };
+
+    virtual int onCount(uint32_t msg, void* buf, uint32_t len);
+
+    BEGIN_MAP_MESSAGES( FJTestCount )
+    MAP_MESSAGES( MID_ON_COUNT, FJTestCount::onCount )
+    END_MAP_MESSAGES()
+
+    int count_ = 0;
+    bool busy_ = false;
+    bool overlap_ = false;
+};
+
+int FJTestCount::onCount(uint32_t msg, void* buf, uint32_t len)
+{
+    // 同一インスタンスのタスクが並行して走っていないこと
+    if (busy_) overlap_ = true;
+    busy_ = true;
+    ++count_;
+    busy_ = false;
+    return count_;
+}
+
+int main() {
+    ////// デック単体 /////
+    pthread_t thieves[THIEVES];
+    for (int i = 0; i < THIEVES; ++i) pthread_create(&thieves[i], NULL, thiefFunc, NULL);
+
+    long expect = 0;
+    for (int i = 0; i < ITEMS; ++i) {
+	g_items[i] = i;
+	expect += i;
+	while (!g_deque.push(&g_items[i])) {
+	    int* p = g_deque.pop();
+	    if (p) {
+		g_sum += *p;
+		++g_count;
+	    }
+	}
+    }
+    while (int* p = g_deque.pop()) {
+	g_sum += *p;
+	++g_count;
+    }
+    g_done = true;
+    for (int i = 0; i < THIEVES; ++i) pthread_join(thieves[i], nullptr);
+
+    std::cout << "deque: count=" << g_count << "/" << ITEMS << " sum=" << g_sum << "/" << expect
+	      << ((g_count == ITEMS && g_sum == expect) ? " OK" : " NG") << std::endl;
+
+    ////// ディスパッチャ /////
+    FJDispatchLite* dispatch = FJDispatchLite::GetInstance();
+    dispatch->setSchedMode(FJDispatchLite::SCHEDMODE_WORKSTEAL);
+
+    FJTestCount units[8];
+    fjt_handle_t last[8];
+    for (int n = 0; n < 1000; ++n) {
+	for (int i = 0; i < 8; ++i) {
+	    last[i] = dispatch->postQueue(&units[i], &FJTestCount::onCount, FJTestCount::MID_ON_COUNT, NULL, 0, true, __FUNCTION__, __LINE__);
+	}
+    }
+    bool ok = true;
+    for (int i = 0; i < 8; ++i) {
+	int result = -1;
+	if (!dispatch->waitResult(last[i], 10000, result) || result != 1000 || units[i].overlap_) ok = false;
+	std::cout << "unit" << i << ": result=" << result << " overlap=" << units[i].overlap_ << std::endl;
+    }
+    std::cout << "dispatch: " << (ok ? "OK" : "NG") << std::endl;
+    return ok ? 0 : 1;
+}